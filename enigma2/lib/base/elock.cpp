@@ -45,6 +45,59 @@ eLocker::~eLocker()
 	lock.unlock(res);
 }
 
+eRecursiveRdWrLock::eRecursiveRdWrLock()
+	:m_readers(0), m_depth(0)
+{
+	pthread_mutex_init(&m_mutex, 0);
+	pthread_cond_init(&m_cond, 0);
+}
+
+eRecursiveRdWrLock::~eRecursiveRdWrLock()
+{
+	pthread_mutex_destroy(&m_mutex);
+	pthread_cond_destroy(&m_cond);
+}
+
+void eRecursiveRdWrLock::RdLock()
+{
+	pthread_mutex_lock(&m_mutex);
+	if (m_depth && pthread_equal(m_writer, pthread_self()))
+		++m_depth; /* the writer reads, it holds the lock already */
+	else
+	{
+		while (m_depth)
+			pthread_cond_wait(&m_cond, &m_mutex);
+		++m_readers;
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void eRecursiveRdWrLock::WrLock()
+{
+	pthread_mutex_lock(&m_mutex);
+	if (!m_depth || !pthread_equal(m_writer, pthread_self()))
+	{
+		while (m_depth || m_readers)
+			pthread_cond_wait(&m_cond, &m_mutex);
+		m_writer = pthread_self();
+	}
+	++m_depth;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void eRecursiveRdWrLock::Unlock()
+{
+	pthread_mutex_lock(&m_mutex);
+	bool released;
+	if (m_depth && pthread_equal(m_writer, pthread_self()))
+		released = !--m_depth;
+	else
+		released = !--m_readers;
+	pthread_mutex_unlock(&m_mutex);
+	if (released)
+		pthread_cond_broadcast(&m_cond);
+}
+
 eSemaphore::eSemaphore()
 {
 	v=1;
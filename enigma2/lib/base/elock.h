@@ -77,6 +77,58 @@ public:
 	}
 };
 
+/*
+ * A read/write lock the writer may lock again, for reading or writing,
+ * while holding it. Readers get in whenever no writer holds it, so a reader
+ * locking again never waits for a writer that queued up in between. A
+ * reader must not ask for the write lock, it would wait for itself.
+ */
+class eRecursiveRdWrLock
+{
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+	int m_readers;
+	int m_depth;		/* of the writer's locks */
+	pthread_t m_writer;
+	eRecursiveRdWrLock(eRecursiveRdWrLock &);
+public:
+	eRecursiveRdWrLock();
+	~eRecursiveRdWrLock();
+	void RdLock();
+	void WrLock();
+	void Unlock();
+};
+
+class eRecursiveRdLocker
+{
+	eRecursiveRdWrLock &m_lock;
+public:
+	eRecursiveRdLocker(eRecursiveRdWrLock &m)
+		: m_lock(m)
+	{
+		m_lock.RdLock();
+	}
+	~eRecursiveRdLocker()
+	{
+		m_lock.Unlock();
+	}
+};
+
+class eRecursiveWrLocker
+{
+	eRecursiveRdWrLock &m_lock;
+public:
+	eRecursiveWrLocker(eRecursiveRdWrLock &m)
+		: m_lock(m)
+	{
+		m_lock.WrLock();
+	}
+	~eRecursiveWrLocker()
+	{
+		m_lock.Unlock();
+	}
+};
+
 class eSingleLock
 {
 protected:
@@ -1,5 +1,6 @@
 #include <lib/base/filepush.h>
 #include <lib/base/eerror.h>
+#include <lib/base/tsshmring.h>
 #include <lib/gdi/xineLib.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -11,6 +12,7 @@ eFilePushThread::eFilePushThread(int io_prio_class, int io_prio_level, int block
 	:prio_class(io_prio_class),
 	prio(io_prio_level),
 	m_sg(NULL),
+	m_ring(NULL),
 	m_stop(1),
 	m_send_pvr_commit(0),
 	m_stream_mode(0),
@@ -28,6 +30,8 @@ eFilePushThread::eFilePushThread(int io_prio_class, int io_prio_level, int block
 eFilePushThread::~eFilePushThread()
 {
 	stop();
+	if (m_ring)
+		m_ring->detachWriter(this);
 	free(m_buffer);
 }
 
@@ -85,7 +89,25 @@ void eFilePushThread::thread()
 			struct timeval now;
 			gettimeofday(&starttime, NULL);
 #endif
-			buf_end = m_source->read(m_current_position, m_buffer, maxread);
+			unsigned char *buffer = m_buffer;
+				/* read straight into the ring, xine picks it up from there */
+			if (m_ring)
+			{
+				buffer = m_ring->getWriteSpan(this, maxread, 100);
+				if (!buffer)
+				{
+					if (m_stop)
+						break;
+					continue;
+				}
+			}
+			buf_end = m_source->read(m_current_position, buffer, maxread);
+			if (m_ring && buf_end > 0)
+			{
+				buf_end -= buf_end % m_blocksize;
+				filterRecordData(buffer, buf_end);
+				m_ring->commit(this, buf_end);
+			}
 #ifdef SHOW_WRITE_TIME
 			gettimeofday(&now, NULL);
 			suseconds_t diff = (1000000 * (now.tv_sec - starttime.tv_sec)) + now.tv_usec - starttime.tv_usec;
@@ -120,7 +142,17 @@ void eFilePushThread::thread()
 		if (buf_end == 0)
 		{
 				/* on EOF, try COMMITting once. */
-			if (m_send_pvr_commit)
+			if (m_send_pvr_commit && m_ring)
+			{
+				if (!m_ring->pending())
+				{
+					usleep(250000);
+					eDebug("wait for driver eof timeout");
+					continue;
+				}
+				eDebug("wait for driver eof ok");
+			}
+			else if (m_send_pvr_commit)
 			{
 				struct pollfd pfd;
 				pfd.fd = m_fd_dest;
@@ -162,6 +194,14 @@ void eFilePushThread::thread()
 				continue;
 			}
 			break;
+		} else if (m_ring)
+		{
+			/* already committed to the ring */
+			eofcount = 0;
+			m_current_position += buf_end;
+			bytes_read += buf_end;
+			if (m_sg)
+				current_span_remaining -= buf_end;
 		} else
 		{
 			/* Write data to mux */
@@ -211,6 +251,8 @@ void eFilePushThread::thread()
 	}
 	
 	} while (m_stop == 0);
+	if (m_ring)
+		m_ring->detachWriter(this);
 	eDebug("FILEPUSH THREAD STOP");
 }
 
@@ -287,6 +329,15 @@ void eFilePushThread::setScatterGather(iFilePushScatterGather *sg)
 	m_sg = sg;
 }
 
+void eFilePushThread::setTargetRing(eTsShmRing *ring)
+{
+	if (m_ring && m_ring != ring)
+		m_ring->detachWriter(this);
+	m_ring = ring;
+	if (m_ring)
+		m_ring->attachWriter(this);
+}
+
 void eFilePushThread::sendEvent(int evt)
 {
 	m_messagepump.send(evt);
@@ -375,7 +426,7 @@ void eFilePushThreadRecorder::thread()
 			break;
 		}
 	}
-//	flush();
+	flush();
 	sendEvent(evtStopped);
 	eDebug("[eFilePushThreadRecorder] THREAD STOP");
 }
@@ -389,6 +440,7 @@ void eFilePushThreadRecorder::start(int fd)
 
 void eFilePushThreadRecorder::start(int fd, ePtr<eDVBDemux> &demux)
 {
+	/* every TS recorder, stream server included, reads descrambled TS through this */
 	eDecryptRawFile *f = new eDecryptRawFile();
 	m_source = f;
 	f->setfd(fd);
@@ -408,6 +460,8 @@ void eFilePushThreadRecorder::stop()
 	eDebug("[eFilePushThreadRecorder] stopping thread."); /* just do it ONCE. it won't help to do this more than once. */
 	sendSignal(SIGUSR1);
 	kill(0);
+	/* also stops the DVR reader of a decrypting source */
+	m_source = 0;
 }
 
 void eFilePushThreadRecorder::sendEvent(int evt)
@@ -8,6 +8,8 @@
 #include <sys/types.h>
 #include <lib/base/rawfile.h>
 
+class eTsShmRing;
+
 class iFilePushScatterGather
 {
 public:
@@ -31,6 +33,8 @@ public:
 	/* stream mode will wait on EOF until more data is available. */
 	void setStreamMode(int);
 	void setScatterGather(iFilePushScatterGather *);
+		/* push into the shared memory ring instead of the destination fd */
+	void setTargetRing(eTsShmRing *);
 	
 	enum { evtEOF, evtReadError, evtWriteError, evtUser, evtStopped };
 	Signal1<void,int> m_event;
@@ -43,6 +47,7 @@ private:
 	int prio_class;
 	int prio;
 	iFilePushScatterGather *m_sg;
+	eTsShmRing *m_ring;
 	int m_stop;
 	int m_fd_dest;
 	int m_send_pvr_commit;
@@ -0,0 +1,203 @@
+#include <lib/base/iouring.h>
+#include <lib/base/eerror.h>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#include <sys/uio.h>
+
+eIOUring::eIOUring()
+	:m_ready(false), m_registered(false), m_queued(0), m_inflight(0)
+{
+}
+
+#ifdef HAVE_LIBURING
+
+eIOUring::~eIOUring()
+{
+	if (!m_ready)
+		return;
+	if (m_queued)
+		submit();
+	while (m_inflight)
+	{
+		struct io_uring_cqe *cqe;
+		int r = io_uring_wait_cqe(&m_ring, &cqe);
+		if (r < 0)
+		{
+			if (r == -EINTR)
+				continue;
+			eDebug("[eIOUring] wait failed: %s", strerror(-r));
+			break;
+		}
+		complete(cqe);
+	}
+	io_uring_queue_exit(&m_ring);
+}
+
+bool eIOUring::init(unsigned int entries)
+{
+	if (m_ready)
+		return true;
+	int r = io_uring_queue_init(entries, &m_ring, 0);
+	if (r < 0)
+	{
+		eDebug("[eIOUring] io_uring_queue_init failed: %s, using POSIX AIO", strerror(-r));
+		return false;
+	}
+	m_ready = true;
+	return true;
+}
+
+bool eIOUring::registerBuffers(void *base, size_t size, int count)
+{
+	std::vector<struct iovec> iov(count);
+	for (int i = 0; i < count; ++i)
+	{
+		iov[i].iov_base = (unsigned char*)base + i * size;
+		iov[i].iov_len = size;
+	}
+	int r = io_uring_register_buffers(&m_ring, &iov[0], count);
+	if (r < 0)
+	{
+		eDebug("[eIOUring] io_uring_register_buffers failed: %s", strerror(-r));
+		return false;
+	}
+	m_registered = true;
+	return true;
+}
+
+struct io_uring_sqe *eIOUring::getSQE(eIOUringRequest *request)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+	if (!sqe)
+	{
+			/* queue full, hand over what is there */
+		submit();
+		sqe = io_uring_get_sqe(&m_ring);
+		if (!sqe)
+			return NULL;
+	}
+	request->busy = true;
+	request->result = 0;
+	++m_queued;
+	++m_inflight;
+	return sqe;
+}
+
+void eIOUring::complete(struct io_uring_cqe *cqe)
+{
+	eIOUringRequest *request = (eIOUringRequest*)io_uring_cqe_get_data(cqe);
+	request->result = cqe->res;
+	request->busy = false;
+	io_uring_cqe_seen(&m_ring, cqe);
+	--m_inflight;
+}
+
+int eIOUring::write(int fd, const void *buffer, size_t len, off_t offset, int index, eIOUringRequest *request)
+{
+	struct io_uring_sqe *sqe = getSQE(request);
+	if (!sqe)
+		return -EBUSY;
+	if (m_registered && index >= 0)
+		io_uring_prep_write_fixed(sqe, fd, buffer, len, offset, index);
+	else
+		io_uring_prep_write(sqe, fd, buffer, len, offset);
+	io_uring_sqe_set_data(sqe, request); /* after the prep, which may clear the sqe */
+	return 0;
+}
+
+int eIOUring::fdatasync(int fd, eIOUringRequest *request)
+{
+	struct io_uring_sqe *sqe = getSQE(request);
+	if (!sqe)
+		return -EBUSY;
+	io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+		/* a link would only order it after the write right before it,
+		   the data of the writes still in flight needs syncing too */
+	io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+	io_uring_sqe_set_data(sqe, request);
+	return 0;
+}
+
+int eIOUring::submit()
+{
+	if (!m_queued)
+		return 0;
+	int r = io_uring_submit(&m_ring);
+	if (r < 0)
+	{
+		eDebug("[eIOUring] io_uring_submit failed: %s", strerror(-r));
+		return r;
+	}
+	m_queued = 0;
+	return r;
+}
+
+void eIOUring::reap()
+{
+	struct io_uring_cqe *cqe;
+	while (m_inflight && io_uring_peek_cqe(&m_ring, &cqe) == 0)
+		complete(cqe);
+}
+
+int eIOUring::wait(eIOUringRequest *request)
+{
+	if (m_queued && submit() < 0)
+		return -EIO;
+	while (request->busy)
+	{
+		struct io_uring_cqe *cqe;
+		int r = io_uring_wait_cqe(&m_ring, &cqe);
+		if (r < 0)
+		{
+			if (r == -EINTR)
+				continue;
+			eDebug("[eIOUring] wait failed: %s", strerror(-r));
+			return r;
+		}
+		complete(cqe);
+	}
+	return request->result;
+}
+
+#else
+
+eIOUring::~eIOUring()
+{
+}
+
+bool eIOUring::init(unsigned int entries)
+{
+	return false;
+}
+
+bool eIOUring::registerBuffers(void *base, size_t size, int count)
+{
+	return false;
+}
+
+int eIOUring::write(int fd, const void *buffer, size_t len, off_t offset, int index, eIOUringRequest *request)
+{
+	return -ENOSYS;
+}
+
+int eIOUring::fdatasync(int fd, eIOUringRequest *request)
+{
+	return -ENOSYS;
+}
+
+int eIOUring::submit()
+{
+	return -ENOSYS;
+}
+
+void eIOUring::reap()
+{
+}
+
+int eIOUring::wait(eIOUringRequest *request)
+{
+	return -ENOSYS;
+}
+
+#endif
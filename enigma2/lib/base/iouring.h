@@ -0,0 +1,58 @@
+#ifndef __lib_base_iouring_h
+#define __lib_base_iouring_h
+
+#include <sys/types.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+	/* one write or sync, owned by the caller, which polls it */
+struct eIOUringRequest
+{
+	bool busy;
+	int result;	/* bytes written or -errno, once no longer busy */
+	eIOUringRequest(): busy(false), result(0) {}
+};
+
+/*
+ * The writes of a recording thread through io_uring: the TS buffer and the
+ * .sc pages that came with it are queued and go to the kernel with one
+ * io_uring_enter, the completions are collected without another thread or
+ * signal in between. Not thread safe, one ring per recording.
+ *
+ * Only there when built --with-liburing; init() fails without it, or on
+ * kernels without io_uring, and the callers stay with POSIX AIO. The
+ * recorder only tries it when config.recording.io_uring is set.
+ */
+class eIOUring
+{
+#ifdef HAVE_LIBURING
+	struct io_uring m_ring;
+	struct io_uring_sqe *getSQE(eIOUringRequest *request);
+	void complete(struct io_uring_cqe *cqe);
+#endif
+	bool m_ready;
+	bool m_registered;
+	unsigned int m_queued;		/* prepared, not yet submitted */
+	unsigned int m_inflight;
+public:
+	eIOUring();
+	~eIOUring();			/* waits for what is in flight */
+	bool init(unsigned int entries);
+	bool ready() const { return m_ready; }
+		/* registers count buffers of size bytes each, starting at base.
+		   Fails when the memlock limit is too low, then writes go without */
+	bool registerBuffers(void *base, size_t size, int count);
+
+		/* queued until submit(), index is the registered buffer or -1 */
+	int write(int fd, const void *buffer, size_t len, off_t offset, int index, eIOUringRequest *request);
+		/* after all requests queued before it completed */
+	int fdatasync(int fd, eIOUringRequest *request);
+	int submit();
+
+		/* collects the completions there are, does not block */
+	void reap();
+	int wait(eIOUringRequest *request);
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <lib/base/rawfile.h>
 #include <lib/base/eerror.h>
+#include <lib/base/ioprio.h>
+#include <lib/base/nconfig.h>
 #include <lib/gdi/xineLib.h>
 
 DEFINE_REF(eRawFile);
@@ -192,12 +195,105 @@ off_t eRawFile::offset()
 #define VIDEO_STREAM_S   0xE0
 #define VIDEO_STREAM_E   0xEF
 
+#define DVR_READ_CHUNK   KILOBYTE(32)
+
+eDVRReader::eDVRReader(cRingBufferTS *ring, int chunksize)
+	:m_ring(ring), m_fd(-1), m_stop(1), m_chunksize(chunksize),
+	m_scratch(new unsigned char[chunksize]),
+	m_overflow_count(0), m_dropped_count(0)
+{
+}
+
+eDVRReader::~eDVRReader()
+{
+	stop();
+	if (m_overflow_count || m_dropped_count)
+		eDebug("[eDVRReader] DVR overflows: %u, chunks dropped on full ring: %u", m_overflow_count, m_dropped_count);
+	delete [] m_scratch;
+}
+
+void eDVRReader::start(int fd)
+{
+	m_fd = fd;
+	m_stop = 0;
+	run();
+}
+
+void eDVRReader::stop()
+{
+	if (m_stop == 1)
+		return;
+	m_stop = 1;
+	kill();
+}
+
+void eDVRReader::thread()
+{
+	setIoPrio(IOPRIO_CLASS_RT, 7);
+	hasStarted();
+
+	/* the poll timeout bounds how long stop() waits for us */
+	while (!m_stop)
+	{
+		struct pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		int r = ::poll(&pfd, 1, 100);
+		if (r < 0 && errno != EINTR)
+		{
+			eDebug("[eDVRReader] poll failed (%m), stopping");
+			break;
+		}
+		if (r <= 0)
+			continue;
+		if (pfd.revents & POLLNVAL)
+			break;
+
+		int n;
+		if (m_ring->Free() < m_chunksize && !m_ring->WaitForSpace(m_chunksize, 20))
+		{
+			/* the consumer is stuck, keep draining the DVR anyway so
+			   the loss is ours and counted, not a kernel overflow */
+			n = ::read(m_fd, m_scratch, m_chunksize);
+			if (n > 0)
+			{
+				m_ring->ReportOverflow();
+				if (!(m_dropped_count++ % 100))
+					eWarning("[eDVRReader] ring full, dropped %u chunks", m_dropped_count);
+			}
+		}
+		else
+			n = m_ring->Read(m_fd, m_chunksize);
+
+		if (n < 0)
+		{
+			if (errno == EOVERFLOW)
+			{
+				eWarning("[eDVRReader] OVERFLOW while reading DVR");
+				++m_overflow_count;
+				continue;
+			}
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			eDebug("[eDVRReader] read error (%m), stopping");
+			break;
+		}
+	}
+}
+
 eDecryptRawFile::eDecryptRawFile(int packetsize)
  : eRawFile(packetsize)
 {
-	ringBuffer = new cRingBufferLinear(KILOBYTE(8192),TS_SIZE,true,"IN-TS");
-	ringBuffer->SetTimeouts(100,100);
+	ringBuffer = new cRingBufferTS(KILOBYTE(8192),"IN-TS");
+	reader = new eDVRReader(ringBuffer, DVR_READ_CHUNK);
+	/* how much the consumer lets the reader buffer before it takes packets */
+	readAhead = KILOBYTE(eConfigManager::getConfigIntValue("config.pc.dvr_readahead", 64));
+	if (readAhead < DVR_READ_CHUNK)
+		readAhead = DVR_READ_CHUNK;
+	if (readAhead > ringBuffer->Size() / 2)
+		readAhead = ringBuffer->Size() / 2;
 	bs_size = dvbcsa_bs_batch_size();
+	consumer = NULL;
 	delivered=false;
 	lastPacketsCount = 0;
 	stream_correct = false;
@@ -205,11 +301,26 @@ eDecryptRawFile::eDecryptRawFile(int packetsize)
 
 eDecryptRawFile::~eDecryptRawFile()
 {
+	delete reader;
 	delete ringBuffer;
+	if (consumer)
+		demux->detachDecrypt(consumer);
+}
+
+void eDecryptRawFile::setfd(int fd)
+{
+	reader->stop();
+	eRawFile::setfd(fd);
+	if (fd >= 0)
+		reader->start(fd);
 }
 
 void eDecryptRawFile::setDemux(ePtr<eDVBDemux> _demux) {
+	eSingleLocker l(m_lock);
+	if (consumer)
+		demux->detachDecrypt(consumer);
 	demux = _demux;
+	consumer = demux ? demux->attachDecrypt() : NULL;
 }
 
 uint8_t* eDecryptRawFile::getPackets(int &packetsCount) {
@@ -239,11 +350,13 @@ uint8_t* eDecryptRawFile::getPackets(int &packetsCount) {
 				eDebug("ERROR: skipped %d bytes to sync on TS packet", Count);
 				return NULL;
 		}
-		if(!demux->decrypt(p, Count, packetsCount)) {
+		int parkedCount = 0;
+		if(!demux->decrypt(consumer, p, Count, packetsCount, parkedCount)) {
 			cCondWait::SleepMs(20);
 			return NULL;
 		}
 		lastPacketsCount = packetsCount;
+		packetsCount -= parkedCount;
 		delivered=true;
 		return p;
 	}
@@ -256,13 +369,15 @@ ssize_t eDecryptRawFile::read(off_t offset, void *buf, size_t count)
 	eSingleLocker l(m_lock);
 	int ret = 0;
 
-	while (ringBuffer->Available()<KILOBYTE(64)) {
-		ret = ringBuffer->Read(m_fd, KILOBYTE(32));
-		if (ret<0)
-			break;
-	}
+	ringBuffer->WaitForData(readAhead, 100);
 
 	int packetsCount = 0;
+	int released = 0;
+
+	/* packets parked by the descrambler until their key arrived go first,
+	   the buffer always has room for 32K of them on top of getPackets() */
+	if (stream_correct)
+		released = demux->getParked(consumer, (uint8_t*)buf, KILOBYTE(32)/TS_SIZE);
 
 	uint8_t *data = getPackets(packetsCount);
 
@@ -299,10 +414,15 @@ ssize_t eDecryptRawFile::read(off_t offset, void *buf, size_t count)
 			}
           	} else {
 			ret = packetsCount*TS_SIZE;
-			memcpy(buf, data, ret);
+			memcpy((uint8_t*)buf + released*TS_SIZE, data, ret);
 		}
 	}
 
+	if (released)
+		ret = (ret > 0 ? ret : 0) + released*TS_SIZE;
+	else if (ret < 0)
+		errno = EBUSY;
+
 	return ret;
 }
 
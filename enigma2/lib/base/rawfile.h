@@ -3,6 +3,7 @@
 
 #include <string>
 #include <lib/base/itssource.h>
+#include <lib/base/thread.h>
 #include <lib/base/tsRingbuffer.h>
 #include <lib/dvb/demux.h>
 
@@ -38,16 +39,42 @@ private:
 	int openFileUncached(int nr);
 };
 
+/* drains the DVR device into the descramble ring, so acquisition keeps
+   going while the consumer waits for keys or for the output to take data */
+class eDVRReader: public eThread
+{
+public:
+	eDVRReader(cRingBufferTS *ring, int chunksize);
+	~eDVRReader();
+	void start(int fd);
+	void stop();
+	unsigned int overflowCount() const { return m_overflow_count; }
+	unsigned int droppedCount() const { return m_dropped_count; }
+private:
+	void thread();
+	cRingBufferTS *m_ring;
+	int m_fd;
+	int m_stop;
+	int m_chunksize;
+	unsigned char *m_scratch;
+	unsigned int m_overflow_count; /* the kernel demux buffer overflowed */
+	unsigned int m_dropped_count; /* chunks dropped because the ring was full */
+};
+
 class eDecryptRawFile: public eRawFile
 {
 public:
 	eDecryptRawFile(int packetsize = 188);
 	~eDecryptRawFile();
+	void setfd(int fd);
 	void setDemux(ePtr<eDVBDemux> demux);
 	ssize_t read(off_t offset, void *buf, size_t count);
 private:
 	ePtr<eDVBDemux> demux;
-	cRingBufferLinear *ringBuffer;
+	cDeCSAConsumer *consumer; /* our parity and parked packets */
+	cRingBufferTS *ringBuffer;
+	eDVRReader *reader;
+	int readAhead;
 	int bs_size;
 	bool delivered;
 	int lastPacketsCount;
@@ -9,7 +9,10 @@
  */
 
 #include <lib/base/tsRingbuffer.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 
@@ -332,4 +335,214 @@ void cRingBufferLinear::Del(int Count)
 #endif
 }
 
+// --- cRingBufferTS ---------------------------------------------------------
 
+// head and tail are the only state shared between the two threads
+#define LOAD_ACQUIRE(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define FULL_BARRIER()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+cRingBufferTS::cRingBufferTS(int Size, const char *Description)
+{
+  description = Description ? strdup(Description) : NULL;
+  margin = TS_SIZE;
+  size = Size - (Size - margin) % TS_SIZE;
+  head = tail = margin;
+  putWaiting = getWaiting = 0;
+  gotten = 0;
+  maxFill = 0;
+  overflowCount = 0;
+  buffer = NULL;
+  if (size > 2 * margin) {
+     buffer = (uint8_t*)malloc(sizeof(uint8_t) * size);
+     if (!buffer)
+        printf("ERROR: can't allocate ring buffer (size=%d)\n", size);
+     }
+  else
+     printf("ERROR: invalid size for ring buffer (%d)\n", Size);
+}
+
+cRingBufferTS::~cRingBufferTS()
+{
+  printf("buffer stats %s: %d (%d%%) used, %d overflows\n", description ? description : "", maxFill, maxFill * 100 / (size - 1), overflowCount);
+  free(buffer);
+  free(description);
+}
+
+int cRingBufferTS::Available(int Head, int Tail)
+{
+  int diff = Head - Tail;
+  return (diff >= 0) ? diff : size + diff - margin;
+}
+
+int cRingBufferTS::Available(void)
+{
+  return Available(LOAD_ACQUIRE(&head), LOAD_ACQUIRE(&tail));
+}
+
+int cRingBufferTS::Free(void)
+{
+  return size - Available() - 1 - margin;
+}
+
+void cRingBufferTS::Clear(void)
+{
+  STORE_RELEASE(&tail, LOAD_ACQUIRE(&head));
+  gotten = 0;
+  FULL_BARRIER();
+  if (LOAD_ACQUIRE(&putWaiting))
+     readyForPut.Signal();
+}
+
+int cRingBufferTS::WriteSpan(int &Free)
+{
+  // the producer owns head, only tail may move under our feet
+  int Head = head;
+  int Tail = LOAD_ACQUIRE(&tail);
+  int diff = Tail - Head;
+  Free = (diff > 0) ? diff - 1 : size - Head;
+  if (Tail <= margin)
+     Free--;
+  int fill = Available(Head, Tail);
+  if (fill > maxFill)
+     maxFill = fill;
+  return Head;
+}
+
+void cRingBufferTS::Publish(int Head)
+{
+  if (Head >= size)
+     Head = margin;
+  STORE_RELEASE(&head, Head);
+  // pairs with the barrier in WaitForData(), either it sees the new head
+  // or we see that it is about to sleep
+  FULL_BARRIER();
+  if (LOAD_ACQUIRE(&getWaiting))
+     readyForGet.Signal();
+}
+
+int cRingBufferTS::Read(int FileHandle, int Max)
+{
+  int free;
+  int Head = WriteSpan(free);
+  if (free <= 0) {
+     errno = EAGAIN;
+     return -1;
+     }
+  if (0 < Max && Max < free)
+     free = Max;
+  if (free >= TS_SIZE)
+     free -= free % TS_SIZE;
+  int Count = read(FileHandle, buffer + Head, free);
+  if (Count > 0)
+     Publish(Head + Count);
+  return Count;
+}
+
+int cRingBufferTS::Put(const uint8_t *Data, int Count)
+{
+  if (Count <= 0)
+     return 0;
+  int Head = head;
+  int Tail = LOAD_ACQUIRE(&tail);
+  int rest = size - Head;
+  int diff = Tail - Head;
+  int free = ((Tail < margin) ? rest : (diff > 0) ? diff : size + diff - margin) - 1;
+  if (free <= 0)
+     return 0;
+  if (free < Count)
+     Count = free;
+  if (Available(Head, Tail) + Count > maxFill)
+     maxFill = Available(Head, Tail) + Count;
+  if (Count >= rest) {
+     memcpy(buffer + Head, Data, rest);
+     if (Count - rest)
+        memcpy(buffer + margin, Data + rest, Count - rest);
+     Publish(margin + Count - rest);
+     }
+  else {
+     memcpy(buffer + Head, Data, Count);
+     Publish(Head + Count);
+     }
+  return Count;
+}
+
+uint8_t *cRingBufferTS::Get(int &Count)
+{
+  int Head = LOAD_ACQUIRE(&head);
+  int Tail = tail;
+  int rest = size - Tail;
+  if (rest < margin && Head < Tail) {
+     // a packet is split at the end of the buffer, move its first part
+     // in front of the data area, the producer never writes there
+     int t = margin - rest;
+     memcpy(buffer + t, buffer + Tail, rest);
+     Tail = t;
+     STORE_RELEASE(&tail, Tail);
+     rest = Head - Tail;
+     }
+  int cont = Available(Head, Tail);
+  if (cont > rest)
+     cont = rest;
+  if (cont >= TS_SIZE) {
+     Count = gotten = cont;
+     return buffer + Tail;
+     }
+  return NULL;
+}
+
+void cRingBufferTS::Del(int Count)
+{
+  if (Count > gotten) {
+     printf("ERROR: invalid Count in cRingBufferTS::Del: %d (limited to %d)\n", Count, gotten);
+     Count = gotten;
+     }
+  if (Count > 0) {
+     int Tail = tail + Count;
+     gotten -= Count;
+     if (Tail >= size)
+        Tail = margin;
+     STORE_RELEASE(&tail, Tail);
+     FULL_BARRIER();
+     if (LOAD_ACQUIRE(&putWaiting))
+        readyForPut.Signal();
+     }
+}
+
+bool cRingBufferTS::WaitForData(int Bytes, int TimeoutMs)
+{
+  cTimeMs t;
+  while (Available() < Bytes) {
+        int left = TimeoutMs - int(t.Elapsed());
+        if (left <= 0)
+           return false;
+        STORE_RELEASE(&getWaiting, 1);
+        FULL_BARRIER();
+        // re-check, the producer may have published before seeing the flag
+        if (Available() < Bytes)
+           readyForGet.Wait(left);
+        STORE_RELEASE(&getWaiting, 0);
+        }
+  return true;
+}
+
+bool cRingBufferTS::WaitForSpace(int Bytes, int TimeoutMs)
+{
+  cTimeMs t;
+  while (Free() < Bytes) {
+        int left = TimeoutMs - int(t.Elapsed());
+        if (left <= 0)
+           return false;
+        STORE_RELEASE(&putWaiting, 1);
+        FULL_BARRIER();
+        if (Free() < Bytes)
+           readyForPut.Wait(left);
+        STORE_RELEASE(&putWaiting, 0);
+        }
+  return true;
+}
+
+void cRingBufferTS::ReportOverflow(void)
+{
+  overflowCount++;
+}
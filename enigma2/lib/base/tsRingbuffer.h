@@ -3,6 +3,10 @@
 
 #include <lib/base/condVar.h>
 
+#ifndef TS_SIZE
+#define TS_SIZE          188
+#endif
+
 class cRingBuffer {
 private:
   cCondWait readyForPut, readyForGet;
@@ -87,4 +91,72 @@ public:
     ///< call to Get().
   };
 
+class cRingBufferTS {
+///< Lock-free single producer/single consumer ring buffer for transport
+///< stream data. One thread may Read()/Put(), one other thread may
+///< Get()/Del(). Head and tail live on separate cache lines and are
+///< published with acquire/release semantics, so the fast path takes no
+///< lock at all. The condition variables are only touched when one side
+///< actually sleeps in WaitForData() or WaitForSpace().
+///< The data area is a multiple of TS_SIZE, so as long as the producer
+///< writes whole packets Get() always returns whole, contiguous packets.
+///< A packet split at the end of the buffer is moved in front of the
+///< data area (the 'margin'), like cRingBufferLinear does.
+private:
+  enum { CACHE_LINE = 64 };
+  char pad0[CACHE_LINE];
+  // written by the producer only
+  int head;
+  int putWaiting;
+  char pad1[CACHE_LINE - 2 * sizeof(int)];
+  // written by the consumer only
+  int tail;
+  int getWaiting;
+  int gotten;
+  char pad2[CACHE_LINE - 3 * sizeof(int)];
+  int size, margin;
+  uint8_t *buffer;
+  char *description;
+  cCondWait readyForPut, readyForGet;
+  int maxFill;
+  int overflowCount;
+  int Available(int Head, int Tail);
+  int WriteSpan(int &Free);
+  void Publish(int Head);
+public:
+  cRingBufferTS(int Size, const char *Description = NULL);
+    ///< Creates a ring buffer of roughly Size bytes, rounded down so the
+    ///< data area holds a whole number of TS packets.
+  ~cRingBufferTS();
+  int Size(void) { return size; }
+  int Available(void);
+    ///< Bytes ready for the consumer. Safe to call from both sides.
+  int Free(void);
+    ///< Bytes the producer can still store. Safe to call from both sides.
+  void Clear(void);
+    ///< Drops all data. Must only be called by the consumer.
+  int Read(int FileHandle, int Max = 0);
+    ///< Reads at most Max bytes from FileHandle into the buffer, in whole
+    ///< packets if there is room for one. Only one read() call is done.
+    ///< \return Returns the number of bytes stored, or -1 with errno set
+    ///< (EAGAIN if the buffer is full).
+  int Put(const uint8_t *Data, int Count);
+    ///< Puts at most Count bytes of Data into the buffer.
+    ///< \return Returns the number of bytes actually stored.
+  uint8_t *Get(int &Count);
+    ///< Gets at least one packet of contiguous data, without waiting.
+    ///< The data stays in the buffer until Del() deletes it.
+    ///< \return Returns NULL if less than TS_SIZE bytes are available.
+  void Del(int Count);
+    ///< Deletes at most Count bytes, at most what the last Get() returned.
+  bool WaitForData(int Bytes, int TimeoutMs);
+    ///< Consumer side: blocks until at least Bytes are available.
+    ///< \return Returns false on timeout.
+  bool WaitForSpace(int Bytes, int TimeoutMs);
+    ///< Producer side: blocks until at least Bytes can be stored.
+    ///< \return Returns false on timeout.
+  void ReportOverflow(void);
+    ///< Counts data the producer had to drop because the buffer was full.
+  };
+
 #endif
@@ -0,0 +1,268 @@
+#include <lib/base/tsshmring.h>
+#include <lib/base/eerror.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define TS_PACKET_SIZE		188
+#define TS_SHM_HEADER_SIZE	4096
+	/* 188 * 4096 is a multiple of the page size, as the double mapping requires */
+#define TS_SHM_RING_SIZE	(TS_PACKET_SIZE * 4096 * 4)
+	/* with nobody reading keep about as much as the old FIFO plus the aio buffers held */
+#define TS_SHM_IDLE_BACKLOG	(TS_PACKET_SIZE * 1024 * 2)
+
+eTsShmRing *eTsShmRing::instance;
+bool eTsShmRing::m_failed;
+
+eTsShmRing::eTsShmRing()
+	:m_fd(-1), m_map(NULL), m_map_size(0), m_ring(NULL), m_data(NULL), m_size(0), m_idle_backlog(TS_SHM_IDLE_BACKLOG), m_writer(NULL)
+{
+}
+
+eTsShmRing::~eTsShmRing()
+{
+	close();
+}
+
+eTsShmRing *eTsShmRing::getInstance()
+{
+	if (!instance && !m_failed)
+	{
+		eTsShmRing *ring = new eTsShmRing();
+		if (ring->open(TS_SHM_RING_SIZE) < 0)
+		{
+			delete ring;
+			m_failed = true;
+			eWarning("[eTsShmRing] shared memory unavailable, using /tmp/ENIGMA_FIFO");
+		}
+		else
+			instance = ring;
+	}
+	return instance;
+}
+
+int eTsShmRing::open(size_t size)
+{
+		/* a stale object may hold a mutex owned by a crashed process, never reuse it */
+	shm_unlink(TS_SHM_RING_NAME);
+	m_fd = shm_open(TS_SHM_RING_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (m_fd < 0)
+	{
+		eDebug("[eTsShmRing] shm_open failed: %m");
+		return -1;
+	}
+	fchmod(m_fd, 0666);
+	if (ftruncate(m_fd, TS_SHM_HEADER_SIZE + size) < 0)
+	{
+		eDebug("[eTsShmRing] ftruncate failed: %m");
+		close();
+		return -1;
+	}
+
+	/*
+	 * Reserve room for the header and the data area twice, then map the
+	 * data area a second time right behind itself. A span starting
+	 * anywhere in the first copy is then contiguous up to m_size bytes,
+	 * so producers never have to split a write at the wrap point.
+	 */
+	m_map_size = TS_SHM_HEADER_SIZE + 2 * size;
+	m_map = (unsigned char*)::mmap(NULL, m_map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m_map == MAP_FAILED)
+	{
+		m_map = NULL;
+		eDebug("[eTsShmRing] reserving address space failed: %m");
+		close();
+		return -1;
+	}
+	if (::mmap(m_map, TS_SHM_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m_fd, 0) == MAP_FAILED
+		|| ::mmap(m_map + TS_SHM_HEADER_SIZE + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m_fd, TS_SHM_HEADER_SIZE) == MAP_FAILED)
+	{
+		eDebug("[eTsShmRing] mmap failed: %m");
+		close();
+		return -1;
+	}
+
+	m_ring = (ts_shm_ring*)m_map;
+	m_data = m_map + TS_SHM_HEADER_SIZE;
+	m_size = size;
+
+	pthread_mutexattr_t mattr;
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&m_ring->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_t cattr;
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&m_ring->cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	m_ring->size = size;
+	m_ring->data_offset = TS_SHM_HEADER_SIZE;
+	m_ring->head = 0;
+	m_ring->tail = 0;
+	m_ring->readers = 0;
+	m_ring->overruns = 0;
+	m_ring->version = TS_SHM_RING_VERSION;
+		/* the reader only attaches once it sees the magic */
+	__sync_synchronize();
+	m_ring->magic = TS_SHM_RING_MAGIC;
+
+	eDebug("[eTsShmRing] %s ready, %d kB", TS_SHM_RING_NAME, (int)(size >> 10));
+	return 0;
+}
+
+void eTsShmRing::close()
+{
+	if (m_map)
+		::munmap(m_map, m_map_size);
+	m_map = NULL;
+	m_ring = NULL;
+	m_data = NULL;
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+		shm_unlink(TS_SHM_RING_NAME);
+	}
+	m_fd = -1;
+}
+
+/* called with the lock held */
+bool eTsShmRing::waitFor(int timeout_ms)
+{
+	struct timeval now;
+	struct timespec abstime;
+	gettimeofday(&now, NULL);
+	abstime.tv_sec = now.tv_sec + timeout_ms / 1000;
+	abstime.tv_nsec = now.tv_usec * 1000 + (timeout_ms % 1000) * 1000000;
+	if (abstime.tv_nsec >= 1000000000)
+	{
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000;
+	}
+	return pthread_cond_timedwait(&m_ring->cond, &m_ring->lock, &abstime) != ETIMEDOUT;
+}
+
+bool eTsShmRing::attachWriter(const void *writer)
+{
+	pthread_mutex_lock(&m_ring->lock);
+	if (!m_writer)
+		m_writer = writer;
+	bool owner = m_writer == writer;
+	pthread_mutex_unlock(&m_ring->lock);
+	if (!owner)
+		eDebug("[eTsShmRing] still written by %p, %p has to wait", m_writer, writer);
+	return owner;
+}
+
+void eTsShmRing::detachWriter(const void *writer)
+{
+	pthread_mutex_lock(&m_ring->lock);
+	if (m_writer == writer)
+	{
+		m_writer = NULL;
+		pthread_cond_broadcast(&m_ring->cond);
+	}
+	pthread_mutex_unlock(&m_ring->lock);
+}
+
+unsigned char *eTsShmRing::getWriteSpan(const void *writer, size_t len, int timeout_ms)
+{
+	if (len > m_size)
+		return NULL;
+
+	pthread_mutex_lock(&m_ring->lock);
+		/* two producers filling the same span would interleave their packets */
+	while (m_writer != writer)
+	{
+		if (!m_writer)
+			m_writer = writer;
+		else if (timeout_ms <= 0 || !waitFor(timeout_ms))
+		{
+			pthread_mutex_unlock(&m_ring->lock);
+			return NULL;
+		}
+	}
+	size_t used = m_ring->head - m_ring->tail;
+	if (!m_ring->readers && used + len > m_idle_backlog)
+	{
+			/* nobody is watching, drop the oldest packets instead of
+			   presenting seconds of stale data to the next reader */
+		size_t drop = used + len - m_idle_backlog;
+		drop += (TS_PACKET_SIZE - drop % TS_PACKET_SIZE) % TS_PACKET_SIZE;
+		if (drop > used)
+			drop = used;
+		m_ring->tail += drop;
+		used -= drop;
+	}
+	while (m_size - used < len)
+	{
+		if (timeout_ms <= 0 || !waitFor(timeout_ms))
+		{
+			used = m_ring->head - m_ring->tail;
+			if (m_size - used >= len)
+				break;
+			pthread_mutex_unlock(&m_ring->lock);
+			return NULL;
+		}
+		used = m_ring->head - m_ring->tail;
+	}
+	unsigned char *span = m_data + m_ring->head % m_size;
+	pthread_mutex_unlock(&m_ring->lock);
+	return span;
+}
+
+void eTsShmRing::commit(const void *writer, size_t len)
+{
+	if (!len)
+		return;
+	pthread_mutex_lock(&m_ring->lock);
+	if (m_writer == writer)
+	{
+		m_ring->head += len;
+		pthread_cond_broadcast(&m_ring->cond);
+	}
+	pthread_mutex_unlock(&m_ring->lock);
+}
+
+ssize_t eTsShmRing::write(const void *writer, const unsigned char *data, size_t len, int timeout_ms)
+{
+	unsigned char *span = getWriteSpan(writer, len, timeout_ms);
+	if (!span)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	memcpy(span, data, len);
+	commit(writer, len);
+	return len;
+}
+
+void eTsShmRing::flush()
+{
+	pthread_mutex_lock(&m_ring->lock);
+	m_ring->tail = m_ring->head;
+	pthread_cond_broadcast(&m_ring->cond);
+	pthread_mutex_unlock(&m_ring->lock);
+}
+
+size_t eTsShmRing::pending()
+{
+	pthread_mutex_lock(&m_ring->lock);
+	size_t used = m_ring->head - m_ring->tail;
+	pthread_mutex_unlock(&m_ring->lock);
+	return used;
+}
+
+void eTsShmRing::countOverrun()
+{
+	pthread_mutex_lock(&m_ring->lock);
+	if (!(m_ring->overruns++ % 100))
+		eDebug("[eTsShmRing] reader too slow, %u writes dropped", m_ring->overruns);
+	pthread_mutex_unlock(&m_ring->lock);
+}
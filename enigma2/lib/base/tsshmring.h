@@ -0,0 +1,87 @@
+#ifndef __lib_base_tsshmring_h
+#define __lib_base_tsshmring_h
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Shared memory transport stream ring between enigma2 (the only writer) and
+ * the xine "enigma:/" input plugin (the only reader). It replaces the
+ * /tmp/ENIGMA_FIFO pipe: the writer produces TS packets directly inside the
+ * ring, so data is no longer copied into and out of a kernel pipe.
+ *
+ * Within enigma2 the live recorder and the PVR filepush take turns: the
+ * ring belongs to one writer thread at a time, which passes itself to every
+ * write call. Another writer waits until the owner detaches.
+ *
+ * The layout below is shared with xine-lib/src/input/enigma_ring.h and both
+ * must be changed together (bump TS_SHM_RING_VERSION).
+ */
+
+#define TS_SHM_RING_NAME	"/ENIGMA_TS_RING"
+#define TS_SHM_RING_MAGIC	0x45545352 /* "ETSR" */
+#define TS_SHM_RING_VERSION	1
+
+struct ts_shm_ring
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* bytes in the data area, multiple of 188 and the page size */
+	uint32_t data_offset;	/* start of the data area within the shm object */
+	pthread_mutex_t lock;	/* process shared, protects everything below */
+	pthread_cond_t cond;	/* broadcast on every commit, consume and flush */
+	uint64_t head;		/* total bytes committed by the writer */
+	uint64_t tail;		/* total bytes consumed by the reader */
+	uint32_t readers;	/* attached readers, the writer trims stale data while 0 */
+	uint32_t overruns;	/* writes dropped because the reader fell behind */
+};
+
+class eTsShmRing
+{
+	static eTsShmRing *instance;
+	static bool m_failed;
+
+	int m_fd;
+	unsigned char *m_map;
+	size_t m_map_size;
+	ts_shm_ring *m_ring;
+	unsigned char *m_data; /* data area, mapped twice back to back */
+	size_t m_size;
+	size_t m_idle_backlog;
+	const void *m_writer; /* owner of the head, NULL when free */
+
+	eTsShmRing();
+	int open(size_t size);
+	void close();
+	bool waitFor(int timeout_ms);
+public:
+	~eTsShmRing();
+		/* creates the ring on first use, NULL if shared memory is unavailable */
+	static eTsShmRing *getInstance();
+
+		/* takes the ring for writer if it is free, false while another
+		   writer has it. detachWriter() gives it back on stop */
+	bool attachWriter(const void *writer);
+	void detachWriter(const void *writer);
+
+		/* returns a contiguous writable span of at least len bytes at the
+		   ring head, waiting up to timeout_ms for the ring to be free and
+		   for the reader to make room. The span stays valid until commit().
+		   NULL on timeout. */
+	unsigned char *getWriteSpan(const void *writer, size_t len, int timeout_ms);
+		/* ignored unless writer still owns the ring */
+	void commit(const void *writer, size_t len);
+		/* copies len bytes in, waiting up to timeout_ms. returns len or -1 */
+	ssize_t write(const void *writer, const unsigned char *data, size_t len, int timeout_ms);
+
+		/* drop everything the reader has not consumed yet (seek, zap) */
+	void flush();
+		/* bytes committed but not consumed yet */
+	size_t pending();
+
+	void countOverrun();
+	size_t size() const { return m_size; }
+};
+
+#endif
@@ -57,7 +57,13 @@ void caConnector::thread()
 	hasStarted();
 
 	while (1) {
-		nl_recvmsgs_default(sock);
+		int ret = nl_recvmsgs_default(sock);
+		/* a dead netlink socket would make this spin, control words
+		   can still arrive on the CAPMT socket (see ePMTClient) */
+		if (ret < 0 && ret != -NLE_INTR && ret != -NLE_AGAIN) {
+			eDebug("caConnector: netlink receive failed (%s), stopping", nl_geterror(ret));
+			break;
+		}
 	}
 }
 
@@ -94,8 +100,8 @@ int caConnector::parse_cb(struct nl_msg *msg, void *arg) {
 			return -1;
 		}
 
-		if(!demux->setCaDescr(ca,0)) {
-			eDebug("CA_SET_DESCR failed (%s). Expect a black screen.",strerror(errno));
+		if(demux->setCaDescr(ca,0)) {
+			eDebug("CA_SET_DESCR failed (index %d). Expect a black screen.", ca->index);
 		}
 	}
 	if (attrs[ATTR_CA_NUM] && attrs[ATTR_CA_PID]) {
@@ -111,7 +117,7 @@ int caConnector::parse_cb(struct nl_msg *msg, void *arg) {
 			return -1;
 		}
 
-		if(!demux->setCaPid(ca_pid)) {
+		if(demux->setCaPid(ca_pid)) {
 			eDebug("CA_SET_PID failed");
 		}
 	}
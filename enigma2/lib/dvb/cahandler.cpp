@@ -1,10 +1,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <linux/dvb/dmx.h>
 
 #include <dvbsi++/ca_descriptor.h>
 #include <dvbsi++/ca_program_map_section.h>
 #include <lib/dvb/cahandler.h>
+#include <lib/dvb/dvb.h>
+#include <lib/dvb/demux.h>
 #include <lib/base/eerror.h>
 #include <lib/base/init.h>
 #include <lib/base/init_num.h>
@@ -15,6 +18,10 @@ ePMTClient::ePMTClient(eDVBCAHandler *handler, int socket) : eUnixDomainSocket(s
 	receivedLength = 0;
 	receivedValue = NULL;
 	displayText = NULL;
+	dvbapiState = dvbapiNone;
+	dvbapiRequestCode = 0;
+	dvbapiPayloadLength = 0;
+	dvbapiNetworkOrder = false;
 	CONNECT(connectionClosed_, ePMTClient::connectionLost);
 	CONNECT(readyRead_, ePMTClient::dataAvailable);
 }
@@ -29,12 +36,23 @@ void ePMTClient::dataAvailable()
 	while (1)
 	{
 		/* this handler might be called multiple times (by the socket notifier), till we have the complete message */
+		if (dvbapiState != dvbapiNone)
+		{
+			if (!dvbapiDataAvailable()) return;
+			if (!receivedTag[0]) continue;
+		}
 		if (!receivedTag[0])
 		{
 			if (bytesAvailable() < 4) return;
 			/* read the tag (3 bytes) + the first byte of the length */
 			if(readBlock((char*)receivedTag, 4) < 4) return;
 			receivedLength = 0;
+			if (receivedTag[0] != 0x9F)
+			{
+				/* not a TLV object, maybe a dvbapi descrambler request */
+				dvbapiState = receivedTag[0] == DVBAPI_PROTOCOL_START ? dvbapiHeader : dvbapiRequest;
+				continue;
+			}
 		}
 		if (receivedTag[0] && !receivedLength)
 		{
@@ -79,6 +97,135 @@ void ePMTClient::dataAvailable()
 	}
 }
 
+static uint32_t dvbapiGet32(const unsigned char *data, bool networkorder)
+{
+	if (networkorder)
+		return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+/* the length of what follows the request, -1 if unknown */
+static int dvbapiRequestLength(uint32_t request, bool networkorder)
+{
+	int adapter = networkorder ? 1 : 0;
+	switch (request)
+	{
+	case DVBAPI_CA_SET_DESCR:
+		return adapter + sizeof(ca_descr_t);
+	case DVBAPI_CA_SET_PID:
+		return adapter + sizeof(ca_pid_t);
+	}
+	if (!networkorder)
+		return -1;
+	switch (request)
+	{
+	case DVBAPI_CA_SET_DESCR_MODE:
+		return 1 + 3 * 4; /* adapter, index, algo, cipher mode */
+	case DVBAPI_DMX_SET_FILTER:
+		return 2 + sizeof(struct dmx_sct_filter_params); /* demux, filter */
+	case DVBAPI_DMX_STOP:
+		return 2 + 2; /* demux, filter, pid */
+	}
+	return -1;
+}
+
+/* returns false while the message is incomplete, and after the connection was closed */
+bool ePMTClient::dvbapiDataAvailable()
+{
+	if (dvbapiState == dvbapiHeader)
+	{
+		/* we have 0xA5 and three bytes of the message id, skip the
+		   rest of it and read the request that follows */
+		unsigned char header[5];
+		if (bytesAvailable() < 5) return false;
+		if (readBlock((char*)header, 5) < 5) return false;
+		memcpy(receivedTag, header + 1, 4);
+		dvbapiState = dvbapiRequest;
+	}
+	if (dvbapiState == dvbapiRequest)
+	{
+		uint32_t request = dvbapiGet32(receivedTag, true);
+		dvbapiNetworkOrder = true;
+		int length = dvbapiRequestLength(request, true);
+		if (length < 0)
+		{
+			/* protocol 0 uses host byte order, which we can tell apart on little endian hosts */
+			request = dvbapiGet32(receivedTag, false);
+			dvbapiNetworkOrder = false;
+			length = dvbapiRequestLength(request, false);
+		}
+		if (length < 0)
+		{
+			/* we cannot tell where the next message starts, the softcam
+			   connects again. We might get destroyed by the close */
+			eDebug("[ePMTClient] unknown request %02X%02X%02X%02X, closing the connection", receivedTag[0], receivedTag[1], receivedTag[2], receivedTag[3]);
+			close();
+			return false;
+		}
+		dvbapiRequestCode = request;
+		dvbapiPayloadLength = length;
+		dvbapiState = dvbapiPayload;
+	}
+
+	unsigned char payload[2 + sizeof(struct dmx_sct_filter_params)];
+	int size = dvbapiPayloadLength;
+	if (bytesAvailable() < size) return false;
+	if (readBlock((char*)payload, size) < size) return false;
+
+	if (dvbapiRequestCode == DVBAPI_CA_SET_DESCR || dvbapiRequestCode == DVBAPI_CA_SET_PID)
+		dvbapiRequestReceived(payload);
+	else
+		eDebug("[ePMTClient] ignoring request %08X", dvbapiRequestCode);
+
+	/* prepare for a new message */
+	dvbapiState = dvbapiNone;
+	receivedTag[0] = 0;
+	return true;
+}
+
+void ePMTClient::dvbapiRequestReceived(const unsigned char *data)
+{
+	ePtr<eDVBResourceManager> res_mgr;
+	eDVBResourceManager::getInstance(res_mgr);
+	if (!res_mgr)
+		return;
+
+	int adapter = 0;
+	if (dvbapiNetworkOrder)
+		adapter = *data++;
+
+	/* descrambler indices are per adapter in the dvbapi protocol, every
+	   demux gets the request, a demux only uses the pids it records */
+	ePtr<eDVBDemux> demux;
+	if (dvbapiRequestCode == DVBAPI_CA_SET_DESCR)
+	{
+		ca_descr_t ca;
+		ca.index = dvbapiGet32(data, dvbapiNetworkOrder);
+		ca.parity = dvbapiGet32(data + 4, dvbapiNetworkOrder);
+		memcpy(ca.cw, data + 8, sizeof(ca.cw));
+		eDebug("[ePMTClient] CA_SET_DESCR adapter %d, idx %d, parity %d, cw %02X...%02X", adapter, ca.index, ca.parity, ca.cw[0], ca.cw[7]);
+		for (int nr = 0; !res_mgr->getAdapterDemux(demux, adapter, nr); ++nr)
+		{
+			if (demux->setCaDescr(&ca, 0))
+				eDebug("[ePMTClient] CA_SET_DESCR failed on demux %d", nr);
+		}
+	}
+	else
+	{
+		ca_pid_t ca_pid;
+		ca_pid.pid = dvbapiGet32(data, dvbapiNetworkOrder);
+		ca_pid.index = (int)dvbapiGet32(data + 4, dvbapiNetworkOrder);
+		eDebug("[ePMTClient] CA_SET_PID adapter %d, pid %04X, index %d", adapter, ca_pid.pid, ca_pid.index);
+		for (int nr = 0; !res_mgr->getAdapterDemux(demux, adapter, nr); ++nr)
+		{
+			if (demux->setCaPid(&ca_pid))
+				eDebug("[ePMTClient] CA_SET_PID failed on demux %d", nr);
+		}
+	}
+}
+
 void ePMTClient::parseTLVObjects(unsigned char *data, int size)
 {
 	/* parse all tlv objects in the buffer */
@@ -81,6 +81,27 @@
 												 * that there is no CI definition to send an empty list)
 												 */
 
+/*
+ * Besides TLV objects, a client may send descrambler requests in the OSCam
+ * dvbapi network format on the same socket (boxtype pc-nodmx). They feed the
+ * software descrambler of the demuxes directly, without the dvbsoftwareca
+ * kernel module and its netlink round trip:
+ *
+ *  [0xA5 msgid(4)] request(4) [adapter(1)] ca_descr_t or ca_pid_t
+ *
+ * The 0xA5 prefix is only sent by protocol 3 and up. Protocol 0 sends the
+ * request and the structure in host byte order without the adapter byte,
+ * protocol 1 and up use network byte order and add the adapter index.
+ * The other fixed size requests of the network format are skipped, on any
+ * other request the connection is closed, its length is unknown.
+ */
+#define DVBAPI_PROTOCOL_START	0xA5
+#define DVBAPI_CA_SET_PID	0x40086F87
+#define DVBAPI_CA_SET_DESCR	0x40106F86
+#define DVBAPI_CA_SET_DESCR_MODE	0x400C6F88
+#define DVBAPI_DMX_SET_FILTER	0x403C6F2B
+#define DVBAPI_DMX_STOP	0x00006F2A
+
 class eDVBCAHandler;
 
 class ePMTClient : public eUnixDomainSocket
@@ -89,6 +110,13 @@ class ePMTClient : public eUnixDomainSocket
 	int receivedLength;
 	unsigned char *receivedValue;
 	char *displayText;
+	enum { dvbapiNone, dvbapiHeader, dvbapiRequest, dvbapiPayload };
+	int dvbapiState;
+	uint32_t dvbapiRequestCode;
+	int dvbapiPayloadLength;
+	bool dvbapiNetworkOrder;
+	bool dvbapiDataAvailable();
+	void dvbapiRequestReceived(const unsigned char *data);
 protected:
 	eDVBCAHandler *parent;
 	void connectionLost();
@@ -1639,6 +1639,31 @@ RESULT eDVBDB::flush()
 	return 0;
 }
 
+void eDVBDB::getChannels(std::vector<eDVBChannelID> &chids)
+{
+	for (std::map<eDVBChannelID, channel>::iterator it(m_channels.begin()); it != m_channels.end(); ++it)
+		chids.push_back(it->first);
+}
+
+void eDVBDB::getBouquetChannels(std::vector<eDVBChannelID> &chids, bool favourites)
+{
+	std::set<eDVBChannelID> seen;
+	for (std::map<std::string, eBouquet>::iterator it(m_bouquets.begin()); it != m_bouquets.end(); ++it)
+	{
+		if ((it->first.find(".favourites.") != std::string::npos) != favourites)
+			continue;
+		for (eBouquet::list::iterator s(it->second.m_services.begin()); s != it->second.m_services.end(); ++s)
+		{
+			if (s->type != eServiceReference::idDVB || (s->flags & (eServiceReference::isDirectory|eServiceReference::isMarker)))
+				continue;
+			eDVBChannelID chid;
+			((const eServiceReferenceDVB&)*s).getChannelID(chid);
+			if (m_channels.find(chid) != m_channels.end() && seen.insert(chid).second)
+				chids.push_back(chid);
+		}
+	}
+}
+
 RESULT eDVBDB::getBouquet(const eServiceReference &ref, eBouquet* &bouquet)
 {
 	std::string str = ref.path;
@@ -62,6 +62,10 @@ public:
 	RESULT startQuery(ePtr<iDVBChannelListQuery> &query, eDVBChannelQuery *q, const eServiceReference &source);
 
 	RESULT getBouquet(const eServiceReference &ref, eBouquet* &bouquet);
+		/* all transponders of the channel list */
+	void getChannels(std::vector<eDVBChannelID> &chids);
+		/* the transponders of the services in the favourites bouquets, or in all the others */
+	void getBouquetChannels(std::vector<eDVBChannelID> &chids, bool favourites);
 //////
 	int loadBouquet(const char *path, int startChannelNum = 1);
 	eServiceReference searchReference(int tsid, int onid, int sid);
@@ -2,8 +2,116 @@
  * Based on "Softcam plugin to VDR (C++)"
  */
 
+#include <unistd.h>
 #include <lib/dvb/decsa.h>
 
+// --- cDeCSAWorker ----------------------------------------------------------
+
+cDeCSAWorker::cDeCSAWorker(cDeCSAPool *Pool)
+  :pool(Pool)
+{
+  run();
+}
+
+cDeCSAWorker::~cDeCSAWorker()
+{
+  kill();
+}
+
+void cDeCSAWorker::thread()
+{
+  hasStarted();
+  pool->Work();
+}
+
+// --- cDeCSAPool ------------------------------------------------------------
+
+cDeCSAPool::cDeCSAPool(int Threads)
+{
+  stopping = false;
+  for(int i=0; i<Threads; i++)
+    workers.push_back(new cDeCSAWorker(this));
+  printf("decsa: using %d worker thread(s)\n", Threads);
+}
+
+cDeCSAPool::~cDeCSAPool()
+{
+  mutex.Lock();
+  stopping = true;
+  jobReady.Broadcast();
+  mutex.Unlock();
+  for(unsigned int i=0; i<workers.size(); i++)
+    delete workers[i];
+}
+
+cDeCSAPool *cDeCSAPool::getInstance()
+{
+  static cDeCSAPool *instance;
+  if (!instance) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 1 ? cpus - 1 : 0;
+    if (threads > MAX_CSA_WORKERS)
+      threads = MAX_CSA_WORKERS;
+    instance = new cDeCSAPool(threads);
+  }
+  return instance;
+}
+
+void cDeCSAPool::RunOne(void)
+{
+  // called with mutex held, the bitslice work itself runs unlocked
+  cDeCSAJob job = jobs.front();
+  jobs.pop_front();
+  mutex.Unlock();
+  dvbcsa_bs_decrypt(job.key, job.batch, 184);
+  mutex.Lock();
+  if (!--*job.pending)
+    jobDone.Broadcast();
+}
+
+void cDeCSAPool::Work(void)
+{
+  cMutexLock lock(&mutex);
+  while (!stopping) {
+    if (jobs.empty())
+      jobReady.Wait(mutex);
+    else
+      RunOne();
+  }
+}
+
+void cDeCSAPool::Process(std::vector<cDeCSAJob> &List)
+{
+  if (List.empty())
+    return;
+  int pending = List.size();
+  cMutexLock lock(&mutex);
+  for(unsigned int i=0; i<List.size(); i++) {
+    List[i].pending = &pending;
+    jobs.push_back(List[i]);
+  }
+  if (List.size() > 1)
+    jobReady.Broadcast();
+  while (pending) {
+    if (!jobs.empty())
+      RunOne();
+    else
+      jobDone.Wait(mutex);
+  }
+}
+
+// --- cDeCSAConsumer --------------------------------------------------------
+
+cDeCSAConsumer::cDeCSAConsumer()
+{
+  memset(even_odd, 0, sizeof(even_odd));
+  memset(waited, 0, sizeof(waited));
+  memset(dropped, 0, sizeof(dropped));
+  parkedTotal = 0;
+}
+
+// --- cDeCSA ----------------------------------------------------------------
+
 static bool CheckNull(const unsigned char *data, int len)
 {
   while(--len>=0)
@@ -19,11 +127,17 @@ cDeCSA::cDeCSA(int _adapter, int _demux)
   demux = _demux;
 
   cs=dvbcsa_bs_batch_size();
-  cs_tsbbatch_even = (dvbcsa_bs_batch_s *) malloc((cs + 1) * sizeof(struct dvbcsa_bs_batch_s));
-  cs_tsbbatch_odd = (dvbcsa_bs_batch_s *) malloc((cs + 1) * sizeof(struct dvbcsa_bs_batch_s));
+  cs_tsbbatch = NULL;
+  cs_slots = 0;
+  slot = 0;
+  memset(batch_even, 0, sizeof(batch_even));
+  memset(batch_odd, 0, sizeof(batch_odd));
+  pool = cDeCSAPool::getInstance();
   memset(cs_key_even, 0, sizeof(cs_key_even));
   memset(cs_key_odd, 0, sizeof(cs_key_odd));
   memset(pidmap, 0, sizeof(pidmap));
+  memset(pendingSince, 0, sizeof(pendingSince));
+  memset(installed, 0, sizeof(installed));
 
   ResetState();
 }
@@ -36,19 +150,39 @@ cDeCSA::~cDeCSA()
     if (cs_key_odd[i])
       dvbcsa_bs_key_free(cs_key_odd[i]);
   }
-  free(cs_tsbbatch_even);
-  free(cs_tsbbatch_odd);
+  free(cs_tsbbatch);
+  for(unsigned int i=0; i<consumers.size(); i++)
+    delete consumers[i];
 }
 
 void cDeCSA::ResetState(void)
 {
   printf("adapter%d/demux%d: reset state", adapter, demux);
-  memset(even_odd,0,sizeof(even_odd));
   memset(flags,0,sizeof(flags));
 //  memset(usedPids,0,sizeof(usedPids));
   lastData=0;
 }
 
+cDeCSAConsumer *cDeCSA::Attach(void)
+{
+  cMutexLock lock(&mutex);
+  cDeCSAConsumer *c = new cDeCSAConsumer;
+  consumers.push_back(c);
+  return c;
+}
+
+void cDeCSA::Detach(cDeCSAConsumer *c)
+{
+  cMutexLock lock(&mutex);
+  for(unsigned int i=0; i<consumers.size(); i++)
+    if(consumers[i] == c) {
+      consumers.erase(consumers.begin() + i);
+      break;
+    }
+  delete c;
+  // keys it held back are installed by the next CheckPending
+}
+
 bool cDeCSA::GetKeyStruct(int idx)
 {
   if (!cs_key_even[idx])
@@ -58,40 +192,97 @@ bool cDeCSA::GetKeyStruct(int idx)
   return (cs_key_even[idx] != 0) && (cs_key_odd[idx] != 0);
 }
 
+bool cDeCSA::GetBatchSlots(int packets)
+{
+  // one slot per full batch, plus a partial one for each index and parity
+  int slots = packets / cs + 2 * MAX_CSA_IDX;
+  if (slots > cs_slots) {
+    struct dvbcsa_bs_batch_s *b = (dvbcsa_bs_batch_s *) realloc(cs_tsbbatch, slots * (cs + 1) * sizeof(struct dvbcsa_bs_batch_s));
+    if (!b)
+      return false;
+    cs_tsbbatch = b;
+    cs_slots = slots;
+  }
+  return true;
+}
+
+void cDeCSA::InstallKey(int idx, int parity, const unsigned char *cw)
+{
+  pendingSince[idx][parity] = 0;
+  if(parity==0) {
+    dvbcsa_bs_key_set(cw, cs_key_even[idx]);
+
+    if(!CheckNull(cw,8)) {
+      flags[idx] |= FL_EVEN_GOOD;
+      installed[idx]++;
+    }
+    else
+      printf("adapter%d/demux%d idx %d: zero even CW\n", adapter, demux, idx);
+  } else {
+    dvbcsa_bs_key_set(cw, cs_key_odd[idx]);
+
+    if(!CheckNull(cw,8)) {
+      flags[idx] |= FL_ODD_GOOD;
+      installed[idx]++;
+    }
+    else
+      printf("adapter%d/demux%d idx%d: zero odd CW\n", adapter, demux, idx);
+  }
+}
+
+void cDeCSA::CheckPending(void)
+{
+  // must only be called while no batch is queued, it may replace a key in use
+  uint64_t now = cTimeMs::Now();
+  for(int idx=0; idx<MAX_CSA_IDX; idx++)
+    for(int parity=0; parity<2; parity++) {
+      if(!pendingSince[idx][parity])
+        continue;
+      if(KeyInUse(idx, parity)) {
+        if(now - pendingSince[idx][parity] < MAX_REL_WAIT)
+          continue;
+        printf("adapter%d/demux%d idx %d: %s key not released. setting anyways\n", adapter, demux, idx, parity?"odd":"even");
+      }
+      InstallKey(idx, parity, pending[idx][parity].cw);
+    }
+}
+
+bool cDeCSA::KeyInUse(int idx, int parity)
+{
+  // until the last consumer has passed the parity change, a consumer
+  // behind the others still needs the key of the old parity
+  for(unsigned int i=0; i<consumers.size(); i++) {
+    unsigned int ev_od = consumers[i]->even_odd[idx];
+    if(ev_od && ((ev_od&0x40)>>6) == (unsigned int)parity)
+      return true;
+  }
+  return false;
+}
+
 bool cDeCSA::SetDescr(ca_descr_t *ca_descr, bool initial)
 {
   cMutexLock lock(&mutex);
 
   int idx=ca_descr->index;
-  if(idx<MAX_CSA_IDX && GetKeyStruct(idx)) {
-    if(!initial && ca_descr->parity==(even_odd[idx]&0x40)>>6) {
-      if(flags[idx] & (ca_descr->parity?FL_ODD_GOOD:FL_EVEN_GOOD)) {
-        printf("adapter%d/demux%d idx %d: %s key in use (%d ms)", adapter, demux ,idx,ca_descr->parity?"odd":"even",MAX_REL_WAIT);
-        if(wait.TimedWait(mutex,MAX_REL_WAIT))
-          printf("adapter%d/demux%d idx %d: successfully waited for release\n", adapter, demux, idx);
-        else
-          printf("adapter%d/demux%d idx %d: timed out. setting anyways\n", adapter, demux, idx);
+  if(idx<0 || idx>=MAX_CSA_IDX) {
+    printf("adapter%d/demux%d: bad descrambler index %d\n", adapter, demux, idx);
+    return false;
+  }
+  if(GetKeyStruct(idx)) {
+    int parity = ca_descr->parity ? 1 : 0;
+    if(!initial && KeyInUse(idx, parity)) {
+      if(flags[idx] & (parity?FL_ODD_GOOD:FL_EVEN_GOOD)) {
+        // never block the caller, the key is installed on the next
+        // parity change or after MAX_REL_WAIT
+        printf("adapter%d/demux%d idx %d: %s key in use, deferred (%d ms)\n", adapter, demux ,idx,parity?"odd":"even",MAX_REL_WAIT);
+        pending[idx][parity] = *ca_descr;
+        pendingSince[idx][parity] = cTimeMs::Now();
+        return true;
       }
       else
         printf("adapter%d/demux%d idx %d: late key set...\n", adapter, demux, idx);
     }
-    if(ca_descr->parity==0) {
-      dvbcsa_bs_key_set(ca_descr->cw, cs_key_even[idx]);
-
-      if(!CheckNull(ca_descr->cw,8))
-        flags[idx] |= FL_EVEN_GOOD|FL_ACTIVITY;
-      else
-        printf("adapter%d/demux%d idx %d: zero even CW\n", adapter, demux, idx);
-      wait.Broadcast();
-    } else {
-      dvbcsa_bs_key_set(ca_descr->cw, cs_key_odd[idx]);
-
-      if(!CheckNull(ca_descr->cw,8))
-        flags[idx] |= FL_ODD_GOOD|FL_ACTIVITY;
-      else
-        printf("adapter%d/demux%d idx%d: zero odd CW\n", adapter, demux, idx);
-      wait.Broadcast();
-    }
+    InstallKey(idx, parity, ca_descr->cw);
   }
 
   return true;
@@ -101,8 +292,15 @@ bool cDeCSA::SetCaPid(ca_pid_t *ca_pid)
 {
   cMutexLock lock(&mutex);
 
-  if(ca_pid->index<MAX_CSA_IDX && ca_pid->pid<MAX_CSA_PIDS) {
-
+  if(ca_pid->pid>=MAX_CSA_PIDS || ca_pid->index<-1 || ca_pid->index>=MAX_CSA_IDX) {
+    printf("adapter%d/demux%d: bad pid %04x or index %d\n", adapter, demux, ca_pid->pid, ca_pid->index);
+    return false;
+  }
+  if(ca_pid->index<0) {
+    pidmap[ca_pid->pid] = CSA_IDX_NONE;
+    printf("adapter%d/demux%d: remove pid %04x\n", adapter, demux, ca_pid->pid);
+  }
+  else {
     pidmap[ca_pid->pid] = ca_pid->index;
     printf("adapter%d/demux%d idx %d: set pid %04x\n", adapter, demux, ca_pid->index, ca_pid->pid);
     //printf("adapter%d/demux%d idx %d: udedPids %d\n", adapter, demux, idx, usedPids[idx]);
@@ -111,6 +309,16 @@ bool cDeCSA::SetCaPid(ca_pid_t *ca_pid)
   return true;
 }
 
+void cDeCSA::QueueBatch(struct dvbcsa_bs_batch_s *batch, int fill, struct dvbcsa_bs_key_s *key)
+{
+  cDeCSAJob job;
+  batch[fill].data = NULL;
+  job.key = key;
+  job.batch = batch;
+  job.pending = NULL;
+  jobs.push_back(job);
+}
+
 unsigned char ts_packet_get_payload_offset(unsigned char *ts_packet)
 {
   if (ts_packet[0] != TS_SYNC_BYTE)
@@ -139,109 +347,205 @@ unsigned char ts_packet_get_payload_offset(unsigned char *ts_packet)
   }
 }
 
-bool cDeCSA::Decrypt(unsigned char *data, int len, int& packetsCount)
+bool cDeCSA::KeyReady(int idx, unsigned int ev_od)
+{
+  return flags[idx] & ((ev_od&0x40) ? FL_ODD_GOOD : FL_EVEN_GOOD);
+}
+
+void cDeCSA::KeyChange(cDeCSAConsumer *c, int idx, unsigned int ev_od)
+{
+  // the very first packet of an index releases nothing
+  bool first = !c->even_odd[idx];
+  c->even_odd[idx]=ev_od;
+  printf("adapter%d/demux%d idx %d: change to %s key\n", adapter, demux, idx, (ev_od&0x40)?"odd":"even");
+
+  int released = (ev_od&0x40) ? 0 : 1;
+  if(!KeyInUse(idx, released)) {
+    if(!first)
+      flags[idx]&=~(released ? FL_ODD_GOOD : FL_EVEN_GOOD);
+    if(pendingSince[idx][released]) {
+      printf("adapter%d/demux%d idx %d: successfully waited for release\n", adapter, demux, idx);
+      InstallKey(idx, released, pending[idx][released].cw);
+    }
+  }
+  if(!KeyReady(idx, ev_od)) {
+    if(c->waited[idx] != installed[idx])
+      printf("adapter%d/demux%d idx %d: %s key not ready, parking packets (%d ms)\n",
+          adapter, demux, idx, (ev_od&0x40)?"odd":"even", MAX_KEY_WAIT);
+    else
+      printf("adapter%d/demux%d idx %d: not active. wait skipped\n", adapter, demux, idx);
+  }
+}
+
+bool cDeCSA::Park(cDeCSAConsumer *c, int idx, const unsigned char *data)
+{
+  if(c->parked[idx].empty()) {
+    // only wait for a key if the softcam set one since the last wait
+    if(c->waited[idx] == installed[idx])
+      return false;
+    // no room to start waiting, nothing of this index to overtake either
+    if(c->parkedTotal >= MAX_PARKED_PACKETS)
+      return false;
+    c->waited[idx] = installed[idx];
+  }
+  else if(c->parkedTotal >= MAX_PARKED_PACKETS) {
+    // taken out and dropped, it must not go out ahead of the packets
+    // parked before it
+    if(!c->dropped[idx]++)
+      printf("adapter%d/demux%d idx %d: parking queue full, dropping packets\n", adapter, demux, idx);
+    return true;
+  }
+  cDeCSAParked p;
+  memcpy(p.data, data, TS_SIZE);
+  p.since = cTimeMs::Now();
+  c->parked[idx].push_back(p);
+  c->parkedTotal++;
+  return true;
+}
+
+void cDeCSA::AddPacket(cDeCSABatch &b, unsigned char *data, int len, struct dvbcsa_bs_key_s *key)
+{
+  if (!b.batch)
+    b.batch = cs_tsbbatch + slot++ * (cs + 1);
+  b.batch[b.fill].data = data;
+  b.batch[b.fill].len = len;
+  if (++b.fill >= cs) {
+    QueueBatch(b.batch, b.fill, key);
+    b.batch = NULL;
+    b.fill = 0;
+  }
+}
+
+void cDeCSA::Flush(void)
+{
+  for(int idx=0; idx<MAX_CSA_IDX; idx++) {
+    if (batch_even[idx].fill)
+      QueueBatch(batch_even[idx].batch, batch_even[idx].fill, cs_key_even[idx]);
+    if (batch_odd[idx].fill)
+      QueueBatch(batch_odd[idx].batch, batch_odd[idx].fill, cs_key_odd[idx]);
+  }
+  memset(batch_even, 0, sizeof(batch_even));
+  memset(batch_odd, 0, sizeof(batch_odd));
+  pool->Process(jobs);
+  jobs.clear();
+  slot = 0;
+}
+
+bool cDeCSA::Decrypt(cDeCSAConsumer *c, unsigned char *data, int len, int& packetsCount, int& parkedCount)
 {
   cMutexLock lock(&mutex);
 //  printf("Begin Decrypting %d\n", len);
-  if (!cs_tsbbatch_even || !cs_tsbbatch_odd)
+  if (!GetBatchSlots(len / TS_SIZE))
   {
     printf("Error allocating memory for DeCSA\n");
     return false;
   }
 
-  int ccs = 0, currIdx=-1;
+  CheckPending();
+
+  int ccs = 0;
   int payload_len, offset;
-  int cs_fill_even = 0;
-  int cs_fill_odd = 0;
   len-=(TS_SIZE-1);
-  int l;
-  int packets=0;
-
+  int l, w = 0;
+  int packets=0, parkedNow=0;
+
+  // every key index and parity gets its own batch table, so one pass
+  // over the buffer descrambles all of it. Full batches are handed to
+  // the pool, the TS order is kept as everything is descrambled in place.
+  // Packets whose key is not ready yet are parked and the rest is moved
+  // up, so other indices keep flowing while one waits for its key.
   for(l=0; l<len; l+=TS_SIZE) {
     if (data[l] != TS_SYNC_BYTE)
     {                           // let higher level cope with that
       break;
     }
+    packets++;
     unsigned int ev_od=data[l+3]&0xC0;
-    if(ev_od==0x80 || ev_od==0xC0) { // encrypted
-      offset = ts_packet_get_payload_offset(data + l);
-      payload_len = TS_SIZE - offset;
-      int idx=pidmap[((data[l+1]<<8)+data[l+2])&(MAX_CSA_PIDS-1)];
-      if(currIdx<0 || idx==currIdx) { // same or no index
-        data[l + 3] &= 0x3F;
-        currIdx=idx;
-        if(ccs == 0 && ev_od!=even_odd[idx]) {
-//          if (cryptedPackets==0) {
-            even_odd[idx]=ev_od;
-            wait.Broadcast();
-            printf("adapter%d/demux%d idx %d: change to %s key\n", adapter, demux, idx, (ev_od&0x40)?"odd":"even");
-          
-            bool doWait=false;
-            if(ev_od&0x40) {
-              flags[idx]&=~FL_EVEN_GOOD;
-              if(!(flags[idx]&FL_ODD_GOOD)) doWait=true;
-            }
-            else {
-              flags[idx]&=~FL_ODD_GOOD;
-              if(!(flags[idx]&FL_EVEN_GOOD)) doWait=true;
-            }
-            if(doWait) {
-              printf("adapter%d/demux%d idx %d: %s key not ready (%d ms)\n",
-                  adapter, demux, idx, (ev_od&0x40)?"odd":"even", MAX_KEY_WAIT);
-              if(flags[idx]&FL_ACTIVITY) {
-                flags[idx]&=~FL_ACTIVITY;
-                if(wait.TimedWait(mutex,MAX_KEY_WAIT))
-                  printf("adapter%d/demux%d idx %d: successfully waited for key\n", adapter, demux, idx);
-                else
-                  printf("adapter%d/demux%d idx %d: timed out. proceeding anyways\n", adapter, demux, idx);
-              } else
-                printf("adapter%d/demux%d idx %d: not active. wait skipped\n", adapter, demux, idx);
-            }
-//          } else {
-//            break;
-//          }
-        }
+    int idx=pidmap[((data[l+1]<<8)+data[l+2])&(MAX_CSA_PIDS-1)];
+    if((ev_od==0x80 || ev_od==0xC0) && idx!=CSA_IDX_NONE) { // encrypted
+      if(!GetKeyStruct(idx)) {
+        packets--;
+        break;
       }
-//      else
-//        break;
-
-      if (((ev_od & 0x40) >> 6) == 0) {
-          cs_tsbbatch_even[cs_fill_even].data = &data[l + offset];
-          cs_tsbbatch_even[cs_fill_even].len = payload_len;
-          cs_fill_even++;
-      } else {
-          cs_tsbbatch_odd[cs_fill_odd].data = &data[l + offset];
-          cs_tsbbatch_odd[cs_fill_odd].len = payload_len;
-          cs_fill_odd++;
+      if(ev_od!=c->even_odd[idx]) {
+        // a deferred key of the old parity may be installed now, so
+        // everything queued so far is descrambled first
+        if (ccs)
+          Flush();
+        KeyChange(c, idx, ev_od);
       }
+      if((!c->parked[idx].empty() || !KeyReady(idx, ev_od)) && Park(c, idx, data + l)) {
+        parkedNow++;
+        continue;
+      }
+      if (w != l)
+        memmove(data + w, data + l, TS_SIZE);
+      offset = ts_packet_get_payload_offset(data + w);
+      payload_len = TS_SIZE - offset;
+      data[w + 3] &= 0x3F;
 
-      if(++ccs >= cs)
-        break;
+      if (((ev_od & 0x40) >> 6) == 0)
+        AddPacket(batch_even[idx], &data[w + offset], payload_len, cs_key_even[idx]);
+      else
+        AddPacket(batch_odd[idx], &data[w + offset], payload_len, cs_key_odd[idx]);
+      ccs++;
     }
-
-    packets++;
+    else if (w != l)
+      memmove(data + w, data + l, TS_SIZE);
+    w += TS_SIZE;
   }
 
-  if (GetKeyStruct(currIdx)) {
-   if (cs_fill_even)
-    {
-      cs_tsbbatch_even[cs_fill_even].data = NULL;
-      dvbcsa_bs_decrypt(cs_key_even[currIdx], cs_tsbbatch_even, 184);
-      cs_fill_even = 0;
-    }
-    if (cs_fill_odd)
-    {
-      cs_tsbbatch_odd[cs_fill_odd].data = NULL;
-      dvbcsa_bs_decrypt(cs_key_odd[currIdx], cs_tsbbatch_odd, 184);
-      cs_fill_odd = 0;
-    }
+  if (ccs) {
+    Flush();
     stall.Set(MAX_STALL_MS);
-
   }
 
   packetsCount = packets;
+  parkedCount = parkedNow;
 
   return true;
 }
 
+int cDeCSA::GetParked(cDeCSAConsumer *c, unsigned char *data, int maxPackets)
+{
+  cMutexLock lock(&mutex);
+  if (!c->parkedTotal || !GetBatchSlots(maxPackets))
+    return 0;
 
+  CheckPending();
+
+  uint64_t now = cTimeMs::Now();
+  int count = 0;
+  for(int idx=0; idx<MAX_CSA_IDX && count<maxPackets; idx++) {
+    bool timedOut = false;
+    while(!c->parked[idx].empty() && count<maxPackets) {
+      cDeCSAParked &p = c->parked[idx].front();
+      unsigned int ev_od = p.data[3]&0xC0;
+      if(!KeyReady(idx, ev_od)) {
+        if(now - p.since < MAX_KEY_WAIT)
+          break;
+        if(!timedOut)
+          printf("adapter%d/demux%d idx %d: timed out. proceeding anyways\n", adapter, demux, idx);
+        timedOut = true;
+      }
+      unsigned char *d = data + count * TS_SIZE;
+      memcpy(d, p.data, TS_SIZE);
+      int offset = ts_packet_get_payload_offset(d);
+      d[3] &= 0x3F;
+      if (((ev_od & 0x40) >> 6) == 0)
+        AddPacket(batch_even[idx], d + offset, TS_SIZE - offset, cs_key_even[idx]);
+      else
+        AddPacket(batch_odd[idx], d + offset, TS_SIZE - offset, cs_key_odd[idx]);
+      c->parked[idx].pop_front();
+      c->parkedTotal--;
+      count++;
+    }
+    if(c->parked[idx].empty() && c->dropped[idx]) {
+      printf("adapter%d/demux%d idx %d: %u packets dropped while waiting\n", adapter, demux, idx, c->dropped[idx]);
+      c->dropped[idx] = 0;
+    }
+  }
+  if (count)
+    Flush();
+  return count;
+}
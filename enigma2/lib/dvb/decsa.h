@@ -2,7 +2,10 @@
 #define __dvb_decsa_h
 
 #include <linux/dvb/ca.h>
+#include <deque>
+#include <vector>
 #include <lib/base/condVar.h>
+#include <lib/base/thread.h>
 
 extern "C" {
 #include <dvbcsa/dvbcsa.h>
@@ -11,40 +14,135 @@ extern "C" {
 #define TS_SIZE          188
 #define TS_SYNC_BYTE     0x47
 
-#define MAX_REL_WAIT 100 // time to wait if key in used on set
-#define MAX_KEY_WAIT 500 // time to wait if key not ready on change
+#define MAX_REL_WAIT 100 // time a key in use is held back on set
+#define MAX_KEY_WAIT 500 // time packets are parked if key not ready on change
 #define MAX_STALL_MS 70
 
 #define MAX_CSA_PIDS 8192
 #define MAX_CSA_IDX  16
+#define CSA_IDX_NONE 0xFF // pidmap entry of a pid the softcam removed, left as is
 #define FL_EVEN_GOOD 1
 #define FL_ODD_GOOD  2
-#define FL_ACTIVITY  4
+
+#define MAX_PARKED_PACKETS 8192 // packets a consumer parks while waiting for a key, all indices
+
+#define MAX_CSA_WORKERS 4 // upper limit of descrambler threads, the caller always helps
+
+struct cDeCSAJob {
+  const struct dvbcsa_bs_key_s *key;
+  struct dvbcsa_bs_batch_s *batch; // NULL terminated, at most dvbcsa_bs_batch_size() entries
+  int *pending;
+};
+
+struct cDeCSABatch {
+  struct dvbcsa_bs_batch_s *batch;
+  int fill;
+};
+
+struct cDeCSAParked {
+  unsigned char data[TS_SIZE];
+  uint64_t since;
+};
+
+struct cDeCSAConsumer {
+  // every reader of a demux descrambles its own copy of the TS and may be
+  // behind the others, so the parity it is at and its parked packets are
+  // its own. The keys are shared.
+  unsigned int even_odd[MAX_CSA_IDX];
+  unsigned int waited[MAX_CSA_IDX]; // keys installed when the last wait began
+  std::deque<cDeCSAParked> parked[MAX_CSA_IDX];
+  int parkedTotal;
+  unsigned int dropped[MAX_CSA_IDX]; // queue full during the current wait
+  cDeCSAConsumer();
+};
+
+class cDeCSAPool;
+
+class cDeCSAWorker : public eThread {
+private:
+  cDeCSAPool *pool;
+  virtual void thread();
+public:
+  cDeCSAWorker(cDeCSAPool *Pool);
+  ~cDeCSAWorker();
+};
+
+class cDeCSAPool {
+  friend class cDeCSAWorker;
+private:
+  cMutex mutex;
+  cCondVar jobReady, jobDone;
+  std::deque<cDeCSAJob> jobs;
+  std::vector<cDeCSAWorker *> workers;
+  bool stopping;
+  void RunOne(void);
+  void Work(void);
+public:
+  cDeCSAPool(int Threads);
+  ~cDeCSAPool();
+  static cDeCSAPool *getInstance();
+  int Threads(void) { return workers.size(); }
+  void Process(std::vector<cDeCSAJob> &List);
+    ///< Queues all batches of List, helps processing the queue and returns
+    ///< when every batch of List has been descrambled in place.
+};
 
 class cDeCSA {
 private:
   int cs;
   unsigned char *lastData;
   unsigned char pidmap[MAX_CSA_PIDS];
-  unsigned int even_odd[MAX_CSA_IDX], flags[MAX_CSA_IDX], usedPids[MAX_CSA_IDX];
+  unsigned int flags[MAX_CSA_IDX], usedPids[MAX_CSA_IDX];
+  unsigned int installed[MAX_CSA_IDX]; // good keys set so far
   cMutex mutex;
-  cCondVar wait;
   cTimeMs stall;
   int adapter, demux;
   struct dvbcsa_bs_key_s *cs_key_even[MAX_CSA_IDX];
   struct dvbcsa_bs_key_s *cs_key_odd[MAX_CSA_IDX];
-  struct dvbcsa_bs_batch_s *cs_tsbbatch_even;
-  struct dvbcsa_bs_batch_s *cs_tsbbatch_odd;
+  struct dvbcsa_bs_batch_s *cs_tsbbatch;
+  int cs_slots, slot;
+  cDeCSABatch batch_even[MAX_CSA_IDX], batch_odd[MAX_CSA_IDX];
+  std::vector<cDeCSAJob> jobs;
+  cDeCSAPool *pool;
+  std::vector<cDeCSAConsumer *> consumers;
+  ca_descr_t pending[MAX_CSA_IDX][2];
+  uint64_t pendingSince[MAX_CSA_IDX][2];
 
   bool GetKeyStruct(int idx);
+  bool GetBatchSlots(int packets);
+  void QueueBatch(struct dvbcsa_bs_batch_s *batch, int fill, struct dvbcsa_bs_key_s *key);
+  void AddPacket(cDeCSABatch &b, unsigned char *data, int len, struct dvbcsa_bs_key_s *key);
+  void Flush(void);
+  void KeyChange(cDeCSAConsumer *c, int idx, unsigned int ev_od);
+  bool KeyReady(int idx, unsigned int ev_od);
+  bool KeyInUse(int idx, int parity);
+  void InstallKey(int idx, int parity, const unsigned char *cw);
+  void CheckPending(void);
+  bool Park(cDeCSAConsumer *c, int idx, const unsigned char *data);
   void ResetState(void);
 public:
   cDeCSA(int _adapter, int _demux);
   ~cDeCSA();
-  bool Decrypt(unsigned char *data, int len, int& packetsCount);
+  cDeCSAConsumer *Attach(void);
+    ///< Registers a reader of the demux, to be passed to Decrypt and GetParked.
+  void Detach(cDeCSAConsumer *c);
+    ///< Unregisters and frees c, dropping the packets it still has parked.
+  bool Decrypt(cDeCSAConsumer *c, unsigned char *data, int len, int& packetsCount, int& parkedCount);
+    ///< Descrambles the packets of data in place. packetsCount is the number
+    ///< of packets consumed, parkedCount the number of them that wait for a
+    ///< key and were taken out (or dropped, when the parking queue is full).
+    ///< The remaining packetsCount-parkedCount packets
+    ///< are moved to the start of data in their original order.
+  int GetParked(cDeCSAConsumer *c, unsigned char *data, int maxPackets);
+    ///< Copies at most maxPackets packets parked by c, whose key became ready or
+    ///< who waited longer than MAX_KEY_WAIT, descrambled to data.
+    ///< \return Returns the number of packets stored.
 
   bool SetDescr(ca_descr_t *ca_descr, bool initial);
+    ///< \return Returns false if the index is out of range.
   bool SetCaPid(ca_pid_t *ca_pid);
+    ///< Index -1 removes the pid. \return Returns false if the index or
+    ///< the pid is out of range.
 };
 
 #endif
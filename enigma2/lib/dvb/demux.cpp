@@ -28,12 +28,17 @@ static int determineBufferCount()
 
 static int recordingBufferCount = determineBufferCount();
 
+// block size of the O_DIRECT writes, the recording buffers are multiples of it
+static const size_t directIOAlignment = 4096;
+
 #include <linux/dvb/dmx.h>
 
 #include "crc32.h"
 
 #include <lib/base/eerror.h>
 #include <lib/base/filepush.h>
+#include <lib/base/nconfig.h>
+#include <lib/base/tsshmring.h>
 #include <lib/dvb/idvb.h>
 #include <lib/dvb/demux.h>
 #include <lib/dvb/esection.h>
@@ -100,10 +105,25 @@ RESULT eDVBDemux::setSourcePVR(int pvrnum)
 	return res;
 }
 
+RESULT eDVBDemux::getSoftDemux(ePtr<eDVBSoftDemux> &soft)
+{
+	if (!eConfigManager::getConfigBoolValue("config.usage.software_demux", false))
+		return -1;
+	eSingleLocker lock(m_soft_lock);
+	if (!m_soft)
+		m_soft = new eDVBSoftDemux(adapter, demux);
+	soft = m_soft;
+	return 0;
+}
+
 RESULT eDVBDemux::createSectionReader(eMainloop *context, ePtr<iDVBSectionReader> &reader)
 {
 	RESULT res;
-	reader = new eDVBSectionReader(this, context, res);
+	ePtr<eDVBSoftDemux> soft;
+	if (!getSoftDemux(soft))
+		reader = new eDVBSoftSectionReader(soft, context, res);
+	else
+		reader = new eDVBSectionReader(this, context, res);
 	if (res)
 		reader = 0;
 	return res;
@@ -112,7 +132,11 @@ RESULT eDVBDemux::createSectionReader(eMainloop *context, ePtr<iDVBSectionReader
 RESULT eDVBDemux::createPESReader(eMainloop *context, ePtr<iDVBPESReader> &reader)
 {
 	RESULT res;
-	reader = new eDVBPESReader(this, context, res);
+	ePtr<eDVBSoftDemux> soft;
+	if (!getSoftDemux(soft))
+		reader = new eDVBSoftPESReader(soft, context, res);
+	else
+		reader = new eDVBPESReader(this, context, res);
 	if (res)
 		reader = 0;
 	return res;
@@ -174,16 +198,28 @@ RESULT eDVBDemux::connectEvent(const Slot1<void,int> &event, ePtr<eConnection> &
 
 RESULT eDVBDemux::setCaDescr(ca_descr_t *ca_descr, bool initial)
 {
-	return decsa->SetDescr(ca_descr, initial);
+	return decsa->SetDescr(ca_descr, initial) ? 0 : -1;
 }
 
 RESULT eDVBDemux::setCaPid(ca_pid_t *ca_pid)
 {
-	return decsa->SetCaPid(ca_pid);
+	return decsa->SetCaPid(ca_pid) ? 0 : -1;
 }
 
-bool eDVBDemux::decrypt(uint8_t *data, int len, int &packetsCount) {
-	return decsa->Decrypt(data, len, packetsCount);
+cDeCSAConsumer *eDVBDemux::attachDecrypt() {
+	return decsa->Attach();
+}
+
+void eDVBDemux::detachDecrypt(cDeCSAConsumer *consumer) {
+	decsa->Detach(consumer);
+}
+
+bool eDVBDemux::decrypt(cDeCSAConsumer *consumer, uint8_t *data, int len, int &packetsCount, int &parkedCount) {
+	return decsa->Decrypt(consumer, data, len, packetsCount, parkedCount);
+}
+
+int eDVBDemux::getParked(cDeCSAConsumer *consumer, uint8_t *data, int maxPackets) {
+	return decsa->GetParked(consumer, data, maxPackets);
 }
 
 void eDVBSectionReader::data(int)
@@ -407,34 +443,53 @@ public:
 	void stopSaveMetaInformation();
 	int getLastPTS(pts_t &pts);
 	int getFirstPTS(pts_t &pts);
-	void setTargetFD(int fd) { m_fd_dest = fd; }
+	virtual void setTargetFD(int fd);
+	void setTargetRing(eTsShmRing *ring);
+	virtual void setTargetFanout(eStreamFanout *fanout) {}
 	void enableAccessPoints(bool enable) { m_ts_parser.enableAccessPoints(enable); }
 protected:
 	int asyncWrite(int len);
+	int preallocate(off_t end);
+	int ringWrite(int len);
+	void nextRingBuffer();
 	/* override */ int writeData(int len);
 	/* override */ void flush();
 	struct AsyncIO
 	{
 		struct aiocb aio;
 		unsigned char* buffer;
+		int index; // of the registered buffer
+		eIOUring *ring; // NULL for POSIX AIO
+		eIOUringRequest request;
 		AsyncIO()
 		{
 			memset(&aio, 0, sizeof(struct aiocb));
 			buffer = NULL;
+			index = -1;
+			ring = NULL;
 		}
 		int wait();
 		int start(int fd, off_t offset, size_t nbytes, void* buffer);
 		int poll(); // returns 1 if busy, 0 if ready, <0 on error return
 		int cancel(int fd); // returns <0 on error, 0 cancelled, >0 bytes written?
 	};
+	eIOUring m_uring; // before m_ts_parser, whose .sc writes may still use it
 	eMPEGStreamParserTS m_ts_parser;
 	off_t m_current_offset;
 	int m_fd_dest;
+	eTsShmRing *m_ring;
+	unsigned int m_ring_overruns;
 	typedef std::vector<AsyncIO> AsyncIOvector;
 	unsigned char* m_allocated_buffer;
 	AsyncIOvector m_aio;
 	AsyncIOvector::iterator m_current_buffer;
 	std::vector<int> m_buffer_use_histogram;
+	size_t m_aio_buffersize; // m_buffersize shrinks by the carry with O_DIRECT
+	off_t m_preallocate; // chunk size, 0 when off
+	off_t m_preallocated; // the file has blocks up to here
+	bool m_direct;
+	size_t m_carry; // bytes in front of m_buffer not yet written (O_DIRECT)
+	unsigned char *m_carry_from;
 };
 
 eDVBRecordFileThread::eDVBRecordFileThread(int packetsize, int bufferCount):
@@ -444,9 +499,17 @@ eDVBRecordFileThread::eDVBRecordFileThread(int packetsize, int bufferCount):
 	 m_ts_parser(packetsize),
 	 m_current_offset(0),
 	 m_fd_dest(-1),
+	 m_ring(NULL),
+	 m_ring_overruns(0),
 	 m_aio(bufferCount),
 	 m_current_buffer(m_aio.begin()),
-	 m_buffer_use_histogram(bufferCount+1, 0)
+	 m_buffer_use_histogram(bufferCount+1, 0),
+	 m_aio_buffersize(packetsize * 1024),
+	 m_preallocate(0),
+	 m_preallocated(0),
+	 m_direct(false),
+	 m_carry(0),
+	 m_carry_from(NULL)
 {
 	if (m_buffer == MAP_FAILED)
 		eFatal("Failed to allocate filepush buffer, contact MiLo\n");
@@ -459,13 +522,16 @@ eDVBRecordFileThread::eDVBRecordFileThread(int packetsize, int bufferCount):
 	for (AsyncIOvector::iterator it = m_aio.begin(); it != m_aio.end(); ++it)
 	{
 		it->buffer = m_allocated_buffer + (index * m_buffersize);
+		it->index = index;
 		++index;
 	}
 }
 
 eDVBRecordFileThread::~eDVBRecordFileThread()
 {
-	::munmap(m_allocated_buffer, m_aio.size() * m_buffersize);
+	if (m_ring)
+		m_ring->detachWriter(this);
+	::munmap(m_allocated_buffer, m_aio.size() * m_aio_buffersize);
 }
 
 void eDVBRecordFileThread::setTimingPID(int pid, iDVBTSRecorder::timing_pid_type pidtype, int streamtype)
@@ -495,6 +561,19 @@ int eDVBRecordFileThread::getFirstPTS(pts_t &pts)
 
 int eDVBRecordFileThread::AsyncIO::wait()
 {
+	if (ring)
+	{
+		if (!request.busy && !request.result)
+			return 0;
+		int r = ring->wait(&request);
+		request.result = 0;
+		if (r < 0)
+		{
+			eDebug("[eDVBRecordFileThread] wait: io_uring write returned failure: %s", strerror(-r));
+			return -1;
+		}
+		return 0;
+	}
 	if (aio.aio_buf != NULL) // Only if we had a request outstanding
 	{
 		while (aio_error(&aio) == EINPROGRESS)
@@ -524,12 +603,29 @@ int eDVBRecordFileThread::AsyncIO::cancel(int fd)
 	int r = poll();
 	if (r <= 0)
 		return r; // Either no need to cancel, or error return
+	if (ring)
+		return r; // completes anyway, the buffer stays busy until then
 	eDebug("[eDVBRecordFileThread] cancelling");
 	return aio_cancel(fd, &aio);
 }
 
 int eDVBRecordFileThread::AsyncIO::poll()
 {
+	if (ring)
+	{
+		if (request.busy)
+			ring->reap();
+		if (request.busy)
+			return 1;
+		int r = request.result;
+		request.result = 0;
+		if (r < 0)
+		{
+			eDebug("[eDVBRecordFileThread] poll: io_uring write returned failure: %s", strerror(-r));
+			return -1;
+		}
+		return 0;
+	}
 	if (aio.aio_buf == NULL)
                return 0;
 	if (aio_error(&aio) == EINPROGRESS)
@@ -548,6 +644,19 @@ int eDVBRecordFileThread::AsyncIO::poll()
 
 int eDVBRecordFileThread::AsyncIO::start(int fd, off_t offset, size_t nbytes, void* buffer)
 {
+	if (ring)
+	{
+		// goes to the kernel together with the .sc writes the parser just queued
+		int r = ring->write(fd, buffer, nbytes, offset, index, &request);
+		if (r == 0)
+			r = ring->submit();
+		if (r < 0)
+		{
+			errno = -r;
+			return -1;
+		}
+		return 0;
+	}
 	memset(&aio, 0, sizeof(struct aiocb)); // Documentation says "zero it before call".
 	aio.aio_fildes = fd;
 	aio.aio_nbytes = nbytes;
@@ -574,13 +683,37 @@ int eDVBRecordFileThread::asyncWrite(int len)
 	gettimeofday(&starttime, NULL);
 #endif
 
-	int r = m_current_buffer->start(m_fd_dest, m_current_offset, len, m_buffer);
+	unsigned char *data = m_buffer;
+	size_t size = len;
+	off_t offset = m_current_offset;
+	m_current_offset += len;
+	if (m_direct)
+	{
+		// Whole blocks from the start of the buffer only, what is left
+		// over goes in front of the next one.
+		data = m_current_buffer->buffer;
+		offset -= m_carry;
+		size = (m_carry + len) & ~(size_t)(directIOAlignment - 1);
+		m_carry += len - size;
+		m_carry_from = data + size;
+		if (!size)
+		{
+			// not even a block yet, keep filling this buffer
+			m_buffer += len;
+			m_buffersize -= len;
+			return len;
+		}
+	}
+
+	if (m_preallocate && offset + (off_t)size > m_preallocated)
+		preallocate(offset + size);
+
+	int r = m_current_buffer->start(m_fd_dest, offset, size, data);
 	if (r < 0)
 	{
-		eDebug("[eDVBRecordFileThread] aio_write failed: %m");
+		eDebug("[eDVBRecordFileThread] write failed: %m");
 		return r;
 	}
-	m_current_offset += len;
 
 #ifdef SHOW_WRITE_TIME
 	gettimeofday(&now, NULL);
@@ -613,11 +746,102 @@ int eDVBRecordFileThread::asyncWrite(int len)
 	if (m_current_buffer == m_aio.end())
 		m_current_buffer = m_aio.begin();
 	m_buffer = m_current_buffer->buffer;
+	if (m_direct)
+	{
+		m_buffer += m_carry;
+		m_buffersize = m_aio_buffersize - m_carry;
+	}
+	return len;
+}
+
+int eDVBRecordFileThread::preallocate(off_t end)
+{
+	// Whole chunks, so that parallel recordings on the same disk each get
+	// long extents instead of interleaving block by block. KEEP_SIZE leaves
+	// the file size at what was written, playback of a running recording
+	// does not see the blocks ahead of it.
+	off_t size = ((end - m_preallocated + m_preallocate - 1) / m_preallocate) * m_preallocate;
+	if (::fallocate(m_fd_dest, FALLOC_FL_KEEP_SIZE, m_preallocated, size) < 0)
+	{
+		eDebug("[eDVBRecordFileThread] fallocate failed: %m, not preallocating");
+		m_preallocate = 0;
+		return -1;
+	}
+	m_preallocated += size;
+	return 0;
+}
+
+void eDVBRecordFileThread::setTargetFD(int fd)
+{
+	m_fd_dest = fd;
+	m_preallocate = (off_t)eConfigManager::getConfigIntValue("config.recording.preallocate") << 20;
+	m_preallocated = m_current_offset;
+	m_direct = false;
+	m_carry = 0;
+	m_buffersize = m_aio_buffersize;
+	// Direct writes need aligned buffers, lengths and file offsets. The
+	// buffers are whole pages, the rest holds when starting on a block.
+	if (fd >= 0 && !(m_current_offset & (directIOAlignment - 1)) && eConfigManager::getConfigBoolValue("config.recording.direct_io"))
+	{
+		int flags = ::fcntl(fd, F_GETFL);
+		if (flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_DIRECT) >= 0)
+			m_direct = true;
+		else
+			eDebug("[eDVBRecordFileThread] O_DIRECT not supported: %m, writing through the page cache");
+	}
+	// POSIX AIO unless asked for, io_uring has not seen enough receivers yet
+	if (m_uring.ready() || !eConfigManager::getConfigBoolValue("config.recording.io_uring") || !m_uring.init(m_aio.size() * 2))
+		return;
+	// pinned once instead of mapped for every write, optional
+	if (!m_uring.registerBuffers(m_allocated_buffer, m_buffersize, m_aio.size()))
+		eDebug("[eDVBRecordFileThread] io_uring without registered buffers");
+	for (AsyncIOvector::iterator it = m_aio.begin(); it != m_aio.end(); ++it)
+		it->ring = &m_uring;
+	m_ts_parser.setIOUring(&m_uring);
+}
+
+void eDVBRecordFileThread::setTargetRing(eTsShmRing *ring)
+{
+	if (m_ring && m_ring != ring)
+		m_ring->detachWriter(this);
+	m_ring = ring;
+	if (m_ring)
+		m_ring->attachWriter(this);
+	nextRingBuffer();
+}
+
+void eDVBRecordFileThread::nextRingBuffer()
+{
+	unsigned char *span = m_ring ? m_ring->getWriteSpan(this, m_buffersize, 0) : NULL;
+	// Let the source read straight into the ring. When the reader is behind,
+	// use our own buffer and try to copy it over on the next write.
+	m_buffer = span ? span : m_allocated_buffer;
+}
+
+int eDVBRecordFileThread::ringWrite(int len)
+{
+	m_ts_parser.parseData(m_current_offset, m_buffer, len);
+	if (m_uring.ready())
+		m_uring.submit(); // the .sc writes
+	if (m_buffer == m_allocated_buffer && len > 0)
+	{
+		if (m_ring->write(this, m_buffer, len, 100) < 0)
+		{
+			++m_ring_overruns;
+			m_ring->countOverrun();
+		}
+	}
+	else
+		m_ring->commit(this, len);
+	m_current_offset += len;
+	nextRingBuffer();
 	return len;
 }
 
 int eDVBRecordFileThread::writeData(int len)
 {
+	if (m_ring)
+		return ringWrite(len);
 	len = asyncWrite(len);
 	if (len < 0)
 		return len;
@@ -625,6 +849,12 @@ int eDVBRecordFileThread::writeData(int len)
 	int r = m_current_buffer->wait();
 	if (r < 0)
 		return -1;
+	if (m_direct && m_carry && m_carry_from != m_current_buffer->buffer)
+	{
+		// the rest of the previous buffer, its write only reads the part before
+		memmove(m_current_buffer->buffer, m_carry_from, m_carry);
+		m_carry_from = m_current_buffer->buffer;
+	}
 
 	return len;
 }
@@ -637,7 +867,7 @@ void eDVBRecordFileThread::flush()
 		it->wait();
 	}
 	int bufferCount = m_aio.size();
-	eDebug("[eDVBRecordFileThread] buffer usage histogram (%d buffers of %d kB)", bufferCount, m_buffersize>>10);
+	eDebug("[eDVBRecordFileThread] buffer usage histogram (%d buffers of %d kB)", bufferCount, m_aio_buffersize>>10);
 	for (int i=0; i <= bufferCount; ++i)
 	{
 		if (m_buffer_use_histogram[i] != 0) eDebug("     %2d: %6d", i, m_buffer_use_histogram[i]);
@@ -646,6 +876,36 @@ void eDVBRecordFileThread::flush()
 	{
 		eDebug("[eDVBRecordFileThread] Demux buffer overflows: %d", m_overflow_count);
 	}
+	if (m_ring_overruns)
+	{
+		eDebug("[eDVBRecordFileThread] Ring buffer overruns: %d", m_ring_overruns);
+	}
+	if (m_ring)
+	{
+		// stopped, the next producer (timeshift playback) may have the ring
+		m_ring->detachWriter(this);
+		m_buffer = m_allocated_buffer;
+	}
+	if (m_fd_dest >= 0 && m_direct)
+	{
+		// the last partial block, which O_DIRECT cannot write
+		int flags = ::fcntl(m_fd_dest, F_GETFL);
+		if (flags >= 0)
+			::fcntl(m_fd_dest, F_SETFL, flags & ~O_DIRECT);
+		m_direct = false;
+		if (m_carry && ::pwrite(m_fd_dest, m_carry_from, m_carry, m_current_offset - m_carry) != (ssize_t)m_carry)
+			eDebug("[eDVBRecordFileThread] writing the last %zu bytes failed: %m", m_carry);
+		m_carry = 0;
+		m_buffer = m_current_buffer->buffer;
+		m_buffersize = m_aio_buffersize;
+	}
+	if (m_fd_dest >= 0 && m_preallocated > m_current_offset)
+	{
+		// give back the blocks preallocated past the end
+		if (::ftruncate(m_fd_dest, m_current_offset) < 0)
+			eDebug("[eDVBRecordFileThread] ftruncate failed: %m");
+		m_preallocated = m_current_offset;
+	}
 	if (m_fd_dest >= 0)
 	{
 		posix_fadvise(m_fd_dest, 0, 0, POSIX_FADV_DONTNEED);
@@ -656,70 +916,65 @@ class eDVBRecordStreamThread: public eDVBRecordFileThread
 {
 public:
 	eDVBRecordStreamThread(int packetsize):
-		eDVBRecordFileThread(packetsize, /*bufferCount*/ 4)
+		eDVBRecordFileThread(packetsize, /*bufferCount*/ 1),
+		m_chunk(NULL)
+	{
+	}
+	~eDVBRecordStreamThread()
+	{
+		if (m_chunk)
+			m_fanout->freeChunk(m_chunk);
+	}
+	void setTargetFD(int fd)
+	{
+		/* a single client, served by the same writer as the stream server clients */
+		ePtr<eStreamFanout> fanout = new eStreamFanout();
+		if (fanout->addClient(fd) < 0)
+			eDebug("[eDVBRecordStreamThread] cannot stream to %d", fd);
+		m_fd_dest = fd;
+		setTargetFanout(fanout);
+	}
+	void setTargetFanout(eStreamFanout *fanout)
 	{
+		if (m_chunk)
+			m_fanout->freeChunk(m_chunk);
+		m_fanout = fanout;
+		// The source reads straight into a chunk, which is then queued to
+		// the clients without another copy.
+		m_chunk = m_fanout->allocChunk(m_buffersize);
+		m_buffer = m_chunk->data;
 	}
 protected:
 	int writeData(int len)
 	{
-		len = asyncWrite(len);
-		if (len < 0)
-			return len;
-		// Cancel aio on this buffer before returning, streams should not be held up. So we CANCEL
-		// any request that hasn't finished on the second round.
-		int r = m_current_buffer->cancel(m_fd_dest);
-		switch (r)
-		{
-			//case 0: // that's one of these two:
-			case AIO_CANCELED:
-			case AIO_ALLDONE:
-				break;
-			case AIO_NOTCANCELED:
-				eDebug("[eDVBRecordStreamThread] failed to cancel, killing all waiting IO");
-				aio_cancel(m_fd_dest, NULL);
-				// Poll all open requests, because they are all in error state now.
-				for (AsyncIOvector::iterator it = m_aio.begin(); it != m_aio.end(); ++it)
-				{
-					it->poll();
-				}
-				break;
-			case -1:
-				eDebug("[eDVBRecordStreamThread] failed: %m");
-				return r;
-		}
-		// we want to have a consistent state, so wait for completion, just to be sure
-		r = m_current_buffer->wait();
-		if (r < 0)
+		if (!m_fanout || (m_fd_dest >= 0 && m_fanout->clientFailed(m_fd_dest)))
 		{
-			eDebug("[eDVBRecordStreamThread] wait failed: %m");
+			errno = EPIPE;
 			return -1;
 		}
+		m_ts_parser.parseData(m_current_offset, m_buffer, len);
+		m_current_offset += len;
+		if (len <= 0)
+			return len;
+		m_chunk->len = len;
+		m_fanout->push(m_chunk);
+		m_chunk = m_fanout->allocChunk(m_buffersize);
+		m_buffer = m_chunk->data;
 		return len;
 	}
 	void flush()
 	{
-		eDebug("[eDVBRecordStreamThread] cancelling aio");
-		switch (aio_cancel(m_fd_dest, NULL))
-		{
-			case AIO_CANCELED:
-				eDebug("[eDVBRecordStreamThread] ok");
-				break;
-			case AIO_NOTCANCELED:
-				eDebug("[eDVBRecordStreamThread] not all cancelled");
-				break;
-			case AIO_ALLDONE:
-				eDebug("[eDVBRecordStreamThread] all done");
-				break;
-			case -1:
-				eDebug("[eDVBRecordStreamThread] failed: %m");
-				break;
-			default:
-				eDebug("[eDVBRecordStreamThread] unexpected return code");
-				break;
-		}
-		// Call inherited flush to clean up the rest.
-		eDVBRecordFileThread::flush();
+		std::vector<eStreamClientStats> stats;
+		if (m_fanout)
+			m_fanout->getStats(stats);
+		for (std::vector<eStreamClientStats>::iterator it = stats.begin(); it != stats.end(); ++it)
+			eDebug("[eDVBRecordStreamThread] client %d: %llu bytes sent, backlog %zd kB (peak %zd kB), %u chunks dropped",
+				it->fd, it->sent, it->backlog >> 10, it->peak_backlog >> 10, it->dropped);
+		if (m_overflow_count)
+			eDebug("[eDVBRecordStreamThread] Demux buffer overflows: %d", m_overflow_count);
 	}
+	ePtr<eStreamFanout> m_fanout;
+	eStreamChunk *m_chunk;
 };
 
 
@@ -729,6 +984,7 @@ eDVBTSRecorder::eDVBTSRecorder(eDVBDemux *demux, int packetsize, bool streaming)
 	m_demux(demux),
 	m_running(0),
 	m_target_fd(-1),
+	m_target_ring(NULL),
 	m_thread(streaming ? new eDVBRecordStreamThread(packetsize) : new eDVBRecordFileThread(packetsize, recordingBufferCount)),
 	m_packetsize(packetsize)
 {
@@ -748,7 +1004,7 @@ RESULT eDVBTSRecorder::start()
 	if (m_running)
 		return -1;
 
-	if (m_target_fd == -1)
+	if (m_target_fd == -1 && !m_target_ring && !m_target_fanout)
 		return -2;
 
 	if (i == m_pids.end())
@@ -842,6 +1098,20 @@ RESULT eDVBTSRecorder::setTargetFD(int fd)
 	return 0;
 }
 
+RESULT eDVBTSRecorder::setTargetRing(eTsShmRing *ring)
+{
+	m_target_ring = ring;
+	m_thread->setTargetRing(ring);
+	return 0;
+}
+
+RESULT eDVBTSRecorder::setTargetFanout(eStreamFanout *fanout)
+{
+	m_target_fanout = fanout;
+	m_thread->setTargetFanout(fanout);
+	return 0;
+}
+
 RESULT eDVBTSRecorder::setTargetFilename(const std::string& filename)
 {
 	m_target_filename = filename;
@@ -861,40 +1131,26 @@ RESULT eDVBTSRecorder::setBoundary(off_t max)
 
 RESULT eDVBTSRecorder::stop()
 {
-	int state=3;
-
 	for (std::map<int,int>::iterator i(m_pids.begin()); i != m_pids.end(); ++i)
 		stopPID(i->first);
 
 	if (!m_running)
 		return -1;
 
-	/* workaround for record thread stop */
+	if (m_source_fd >= 0 && ::ioctl(m_source_fd, DMX_STOP) < 0)
+		perror("DMX_STOP");
+
+	/* the DVR reader thread polls the source, it must be gone before
+	   the fd is closed and its number can be reused */
+	m_thread->stop();
+
 	if (m_source_fd >= 0)
 	{
-		if (::ioctl(m_source_fd, DMX_STOP) < 0)
-			perror("DMX_STOP");
-		else
-			state &= ~1;
-
 		if (::close(m_source_fd) < 0)
 			perror("close");
-		else
-			state &= ~2;
 		m_source_fd = -1;
 	}
 
-	m_thread->stop();
-
-	if (state & 3)
-	{
-		if (m_source_fd >= 0)
-		{
-			::close(m_source_fd);
-			m_source_fd = -1;
-		}
-	}
-
 	m_running = 0;
 
 	m_thread->stopSaveMetaInformation();
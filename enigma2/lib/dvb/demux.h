@@ -4,6 +4,8 @@
 #include <lib/dvb/idvb.h>
 #include <lib/dvb/idemux.h>
 #include <lib/dvb/decsa.h>
+#include <lib/dvb/streamfanout.h>
+#include <lib/dvb/swdemux.h>
 
 class eDVBDemux: public iDVBDemux
 {
@@ -34,12 +36,20 @@ public:
 
 	RESULT setCaDescr(ca_descr_t *ca_descr, bool initial);
 	RESULT setCaPid(ca_pid_t *ca_pid);
-	bool decrypt(uint8_t *data, int len, int &packetsCount);
+		/* each reader of the demux descrambles through its own consumer */
+	cDeCSAConsumer *attachDecrypt();
+	void detachDecrypt(cDeCSAConsumer *consumer);
+	bool decrypt(cDeCSAConsumer *consumer, uint8_t *data, int len, int &packetsCount, int &parkedCount);
+	int getParked(cDeCSAConsumer *consumer, uint8_t *data, int maxPackets);
 private:
 	int adapter, demux, source;
 	cDeCSA *decsa;
 
 	int m_dvr_busy;
+		/* shared by the readers when config.usage.software_demux is set */
+	ePtr<eDVBSoftDemux> m_soft;
+	eSingleLock m_soft_lock;
+	RESULT getSoftDemux(ePtr<eDVBSoftDemux> &soft);
 	friend class eDVBSectionReader;
 	friend class eDVBPESReader;
 	friend class eDVBAudio;
@@ -108,6 +118,8 @@ public:
 	RESULT setTimingPID(int pid, timing_pid_type pidtype, int streamtype);
 	
 	RESULT setTargetFD(int fd);
+	RESULT setTargetRing(eTsShmRing *ring);
+	RESULT setTargetFanout(eStreamFanout *fanout);
 	RESULT setTargetFilename(const std::string& filename);
 	RESULT setBoundary(off_t max);
 	RESULT enableAccessPoints(bool enable);
@@ -131,6 +143,8 @@ private:
 	
 	int m_running;
 	int m_target_fd;
+	eTsShmRing *m_target_ring;
+	ePtr<eStreamFanout> m_target_fanout;
 	int m_source_fd;
 	eDVBRecordFileThread *m_thread;
 	std::string m_target_filename;
@@ -4,6 +4,7 @@
 
 #include <lib/base/eerror.h>
 #include <lib/base/filepush.h>
+#include <lib/base/tsshmring.h>
 #include <lib/base/eenv.h>
 #include <lib/base/wrappers.h>
 #include <lib/dvb/cahandler.h>
@@ -811,6 +812,19 @@ void eDVBResourceManager::setFrontendType(int index, const char *type)
 }
 
 RESULT eDVBResourceManager::allocateFrontend(ePtr<eDVBAllocatedFrontend> &fe, ePtr<iDVBFrontendParameters> &feparm, bool simulate)
+{
+	int err = findFrontend(fe, feparm, simulate);
+		/* also when no source was found, a background channel can block linked tuners */
+	if (err && !simulate && !m_background_channels.empty())
+	{
+		eDebug("no free frontend, release background channels");
+		/* emit */ m_releaseBackgroundChannels();
+		err = findFrontend(fe, feparm, simulate);
+	}
+	return err;
+}
+
+RESULT eDVBResourceManager::findFrontend(ePtr<eDVBAllocatedFrontend> &fe, ePtr<iDVBFrontendParameters> &feparm, bool simulate)
 {
 	eSmartPtrList<eDVBRegisteredFrontend> &frontends = simulate ? m_simulate_frontend : m_frontend;
 	ePtr<eDVBRegisteredFrontend> best;
@@ -1148,6 +1162,12 @@ RESULT eDVBResourceManager::allocateRawChannel(eUsePtr<iDVBChannel> &channel, in
 	}
 
 	int err = allocateFrontendByIndex(fe, slot_index);
+	if (err && !m_background_channels.empty())
+	{
+		eDebug("frontend %d not free, release background channels", slot_index);
+		/* emit */ m_releaseBackgroundChannels();
+		err = allocateFrontendByIndex(fe, slot_index);
+	}
 	if (err)
 		return err;
 
@@ -1155,6 +1175,56 @@ RESULT eDVBResourceManager::allocateRawChannel(eUsePtr<iDVBChannel> &channel, in
 	return 0;
 }
 
+RESULT eDVBResourceManager::allocateBackgroundChannel(const eDVBChannelID &channelid, eUsePtr<iDVBChannel> &channel)
+{
+		/* a transponder somebody watches or records gets its EPG read anyway */
+	for (std::list<active_channel>::iterator i(m_active_channels.begin()); i != m_active_channels.end(); ++i)
+		if (i->m_channel_id == channelid)
+			return errChannelInUse;
+
+	if (!m_list)
+		return errNoChannelList;
+
+	ePtr<iDVBFrontendParameters> feparm;
+	if (m_list->getChannelFrontendData(channelid, feparm))
+		return errChannelNotInList;
+
+		/* never takes a frontend from anybody, not even from the cached channel */
+	ePtr<eDVBAllocatedFrontend> fe;
+	int err = findFrontend(fe, feparm, false);
+	if (err)
+		return err;
+
+	ePtr<eDVBChannel> ch = new eDVBChannel(this, fe);
+	if (ch->setChannel(channelid, feparm))
+	{
+		channel = 0;
+		return errChidNotFound;
+	}
+	m_background_channels.push_back(ch);
+	channel = ch;
+	return 0;
+}
+
+	/* the frontends only background channels use count as free while delta is -1 */
+void eDVBResourceManager::adjustBackgroundFrontends(int delta)
+{
+	for (std::list<eDVBChannel*>::iterator i(m_background_channels.begin()); i != m_background_channels.end(); ++i)
+	{
+		ePtr<iDVBFrontend> fe;
+		if ((*i)->getUseCount() != 1 || (*i)->getFrontend(fe))
+			continue;
+		for (eSmartPtrList<eDVBRegisteredFrontend>::iterator ii(m_frontend.begin()); ii != m_frontend.end(); ++ii)
+		{
+			if ( &(*fe) == &(*ii->m_frontend) )
+			{
+				ii->m_inuse += delta;
+				break;
+			}
+		}
+	}
+}
+
 
 RESULT eDVBResourceManager::allocatePVRChannel(const eDVBChannelID &channelid, eUsePtr<iDVBPVRChannel> &channel)
 {
@@ -1221,6 +1291,7 @@ RESULT eDVBResourceManager::removeChannel(eDVBChannel *ch)
 			++i;
 	}
 	ASSERT(cnt == 1);
+	m_background_channels.remove(ch);
 	if (cnt == 1)
 		return 0;
 	return -ENOENT;
@@ -1232,6 +1303,12 @@ RESULT eDVBResourceManager::connectChannelAdded(const Slot1<void,eDVBChannel*> &
 	return 0;
 }
 
+RESULT eDVBResourceManager::connectReleaseBackgroundChannels(const Slot0<void> &releaseBackgroundChannels, ePtr<eConnection> &connection)
+{
+	connection = new eConnection((eDVBResourceManager*)this, m_releaseBackgroundChannels.connect(releaseBackgroundChannels));
+	return 0;
+}
+
 int eDVBResourceManager::canAllocateFrontend(ePtr<iDVBFrontendParameters> &feparm, bool simulate)
 {
 	eSmartPtrList<eDVBRegisteredFrontend> &frontends = simulate ? m_simulate_frontend : m_frontend;
@@ -1377,7 +1454,11 @@ int eDVBResourceManager::canAllocateChannel(const eDVBChannelID &channelid, cons
 	}
 	feparm->getSystem(system);
 
+	if (!simulate)
+		adjustBackgroundFrontends(-1);
 	ret = canAllocateFrontend(feparm, simulate);
+	if (!simulate)
+		adjustBackgroundFrontends(1);
 
 error:
 	if (decremented_fe_usecount)
@@ -2149,6 +2230,7 @@ RESULT eDVBChannel::playSource(ePtr<iTsSource> &source, const char *streaminfo_f
 	m_pvr_thread->enablePVRCommit(1);
 	m_pvr_thread->setStreamMode(m_source->isStream());
 	m_pvr_thread->setScatterGather(this);
+	m_pvr_thread->setTargetRing(eTsShmRing::getInstance());
 
 	m_event(this, evtPreStart);
 
@@ -2250,6 +2332,9 @@ void eDVBChannel::flushPVR(iDVBDemux *decoding_demux)
 	m_pvr_thread->pause();
 		/* HACK: flush PVR buffer */
 	::ioctl(m_pvr_fd_dst, 0);
+	eTsShmRing *ring = eTsShmRing::getInstance();
+	if (ring)
+		ring->flush();
 
 		/* flush ratebuffers (video, audio) */
 	if (decoding_demux)
@@ -191,6 +191,12 @@ class eDVBResourceManager: public iObject, public Object
 
 	Signal1<void,eDVBChannel*> m_channelAdded;
 
+		/* channels of the EPG harvester, given up whenever their frontends are needed */
+	std::list<eDVBChannel*> m_background_channels;
+	Signal0<void> m_releaseBackgroundChannels;
+	RESULT findFrontend(ePtr<eDVBAllocatedFrontend> &fe, ePtr<iDVBFrontendParameters> &feparm, bool simulate);
+	void adjustBackgroundFrontends(int delta);
+
 	eUsePtr<iDVBChannel> m_cached_channel;
 	Connection m_cached_channel_state_changed_conn;
 	ePtr<eTimer> m_releaseCachedChannelTimer;
@@ -214,14 +220,21 @@ public:
 		errChannelNotInList = -5,
 		errAllSourcesBusy = -6,
 		errNoSourceFound = -7,
+		errChannelInUse = -8,
 	};
 	
 	RESULT connectChannelAdded(const Slot1<void,eDVBChannel*> &channelAdded, ePtr<eConnection> &connection);
+		/* releaseBackgroundChannels must drop all channels from allocateBackgroundChannel */
+	RESULT connectReleaseBackgroundChannels(const Slot0<void> &releaseBackgroundChannels, ePtr<eConnection> &connection);
 	int canAllocateChannel(const eDVBChannelID &channelid, const eDVBChannelID &ignore, int &system, bool simulate=false);
 
 		/* allocate channel... */
 	RESULT allocateChannel(const eDVBChannelID &channelid, eUsePtr<iDVBChannel> &channel, bool simulate=false);
 	RESULT allocatePVRChannel(const eDVBChannelID &channelid, eUsePtr<iDVBPVRChannel> &channel);
+		/* allocates an idle frontend for a transponder nobody else is tuned to. The
+		   channel is not cached and its frontend counts as free, the next allocation
+		   that finds all frontends busy takes it back through releaseBackgroundChannels */
+	RESULT allocateBackgroundChannel(const eDVBChannelID &channelid, eUsePtr<iDVBChannel> &channel);
 	static RESULT getInstance(ePtr<eDVBResourceManager> &);
 
 			/* allocates a frontend able to tune to frontend paramters 'feperm'.
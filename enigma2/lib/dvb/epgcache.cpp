@@ -10,6 +10,7 @@
 #include <fstream>
 #include <time.h>
 #include <unistd.h>  // for usleep
+#include <fcntl.h>
 #include <sys/vfs.h> // for statfs
 // #include <libmd5sum.h>
 #include <lib/base/eerror.h>
@@ -19,12 +20,13 @@
 #include <lib/dvb/db.h>
 #include <lib/python/python.h>
 #include <lib/base/nconfig.h>
+#include <lib/base/ioprio.h>
 #include <dvbsi++/descriptor_tag.h>
 
 int eventData::CacheSize=0;
 bool eventData::isCacheCorrupt = 0;
-descriptorMap eventData::descriptors;
-__u8 eventData::data[4108];
+eEPGDescriptorPool eventData::descriptors;
+__thread __u8 eventData::data[4108];
 extern const uint32_t crc32_table[256];
 
 const eServiceReference &handleGroup(const eServiceReference &ref)
@@ -83,16 +85,8 @@ eventData::eventData(const eit_event_struct* e, int size, int type, int tsidonid
 					while(cnt++ < descr_len)
 						crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ data[ptr++]) & 0xFF];
 
-					descriptorMap::iterator it = descriptors.find(crc);
-					if ( it == descriptors.end() )
-					{
-						CacheSize+=descr_len;
-						__u8 *d = new __u8[descr_len];
-						memcpy(d, descr, descr_len);
-						descriptors[crc] = descriptorPair(1, d);
-					}
-					else
-						++it->second.first;
+					if (!descriptors.addRef(crc))
+						CacheSize += descriptors.insert(crc, descr);
 					*pdescr++=crc;
 					break;
 				}
@@ -124,7 +118,7 @@ eventData::eventData(const eit_event_struct* e, int size, int type, int tsidonid
 						*/
 						eventNameUTF8len = truncateUTF8(eventNameUTF8, 255 - 6);
 						int title_len = 6 + eventNameUTF8len;
-						__u8 *title_data = new __u8[title_len + 2];
+						__u8 title_data[257];
 						title_data[0] = SHORT_EVENT_DESCRIPTOR;
 						title_data[1] = title_len;
 						title_data[2] = descr[2];
@@ -143,17 +137,8 @@ eventData::eventData(const eit_event_struct* e, int size, int type, int tsidonid
 						while(cnt++ < title_len)
 							title_crc = (title_crc << 8) ^ crc32_table[((title_crc >> 24) ^ title_data[tmpPtr++]) & 0xFF];
 
-						descriptorMap::iterator it = descriptors.find(title_crc);
-						if ( it == descriptors.end() )
-						{
-							CacheSize+=title_len;
-							descriptors[title_crc] = descriptorPair(1, title_data);
-						}
-						else
-						{
-							++it->second.first;
-							delete [] title_data;
-						}
+						if (!descriptors.addRef(title_crc))
+							CacheSize += descriptors.insert(title_crc, title_data);
 						*pdescr++=title_crc;
 					}
 
@@ -162,7 +147,7 @@ eventData::eventData(const eit_event_struct* e, int size, int type, int tsidonid
 					{
 						textUTF8len = truncateUTF8(textUTF8, 255 - 6);
 						int text_len = 6 + textUTF8len;
-						__u8 *text_data = new __u8[text_len + 2];
+						__u8 text_data[257];
 						text_data[0] = SHORT_EVENT_DESCRIPTOR;
 						text_data[1] = text_len;
 						text_data[2] = descr[2];
@@ -180,17 +165,8 @@ eventData::eventData(const eit_event_struct* e, int size, int type, int tsidonid
 						while(cnt++ < text_len)
 							text_crc = (text_crc << 8) ^ crc32_table[((text_crc >> 24) ^ text_data[tmpPtr++]) & 0xFF];
 
-						descriptorMap::iterator it = descriptors.find(text_crc);
-						if ( it == descriptors.end() )
-						{
-							CacheSize+=text_len;
-							descriptors[text_crc] = descriptorPair(1, text_data);
-						}
-						else
-						{
-							++it->second.first;
-							delete [] text_data;
-						}
+						if (!descriptors.addRef(text_crc))
+							CacheSize += descriptors.insert(text_crc, text_data);
 						*pdescr++=text_crc;
 					}
 
@@ -208,108 +184,82 @@ eventData::eventData(const eit_event_struct* e, int size, int type, int tsidonid
 	}
 	ASSERT(pdescr <= &descr[65]);
 	ByteSize = 10+((pdescr-descr)*4);
-	EITdata = new __u8[ByteSize];
+	EITdata = (__u8*)eEPGSlab::alloc(ByteSize);
 	CacheSize+=ByteSize;
 	memcpy(EITdata, (__u8*) e, 10);
 	memcpy(EITdata+10, descr, ByteSize-10);
 }
 
-const eit_event_struct* eventData::get() const
+const eit_event_struct* eventData::get(__u8 *buf) const
 {
 	int pos = 12;
-	int tmp = ByteSize-10;
-	memcpy(data, EITdata, 10);
+	memcpy(buf, EITdata, 10);
 	int descriptors_length=0;
-	__u32 *p = (__u32*)(EITdata+10);
-	while(tmp>3)
+	for (int i = 0; i < getDescriptorCount(); ++i)
 	{
-		descriptorMap::iterator it =
-			descriptors.find(*p++);
-		if ( it != descriptors.end() )
+		const __u8 *descr = getDescriptor(i);
+		if (descr)
 		{
-			int b = it->second.second[1]+2;
-			memcpy(data+pos, it->second.second, b );
+			int b = descr[1]+2;
+			memcpy(buf+pos, descr, b );
 			pos += b;
 			descriptors_length += b;
 		}
 		else
 			cacheCorrupt("eventData::get");
-		tmp-=4;
 	}
 	ASSERT(pos <= 4108);
-	data[10] = (descriptors_length >> 8) & 0x0F;
-	data[11] = descriptors_length & 0xFF;
-	return (eit_event_struct*)data;
+	buf[10] = (descriptors_length >> 8) & 0x0F;
+	buf[11] = descriptors_length & 0xFF;
+	return (eit_event_struct*)buf;
 }
 
-eventData::~eventData()
+const eit_event_struct* eventData::get() const
 {
-	if ( ByteSize )
+	return get(data);
+}
+
+/* the header of the event with an empty descriptor loop for Event to parse */
+struct eventHeader
+{
+	__u8 bytes[12];
+	eventHeader(const __u8 *EITdata)
 	{
-		CacheSize -= ByteSize;
-		__u32 *d = (__u32*)(EITdata+10);
-		ByteSize -= 10;
-		while(ByteSize>3)
-		{
-			descriptorMap::iterator it =
-				descriptors.find(*d++);
-			if ( it != descriptors.end() )
-			{
-				descriptorPair &p = it->second;
-				if (!--p.first) // no more used descriptor
-				{
-					CacheSize -= it->second.second[1];
-					delete [] it->second.second;  	// free descriptor memory
-					descriptors.erase(it);	// remove entry from descriptor map
-				}
-			}
-			else
-			{
-				cacheCorrupt("eventData::~eventData");
-			}
-			ByteSize -= 4;
-		}
-		delete [] EITdata;
+		memcpy(bytes, EITdata, 10);
+		bytes[10] = bytes[11] = 0;
 	}
-}
+};
 
-void eventData::load(FILE *f)
+eEPGEvent::eEPGEvent(const eventData &data)
+	:Event(eventHeader(data.EITdata).bytes)
 {
-	int size=0;
-	int id=0;
-	__u8 header[2];
-	descriptorPair p;
-	fread(&size, sizeof(int), 1, f);
-	while(size)
-	{
-		fread(&id, sizeof(__u32), 1, f);
-		fread(&p.first, sizeof(int), 1, f);
-		fread(header, 2, 1, f);
-		int bytes = header[1]+2;
-		p.second = new __u8[bytes];
-		p.second[0] = header[0];
-		p.second[1] = header[1];
-		fread(p.second+2, bytes-2, 1, f);
-		descriptors[id]=p;
-		--size;
-		CacheSize+=bytes;
+	for (int i = 0; i < data.getDescriptorCount(); ++i)
+	{
+		const __u8 *descr = data.getDescriptor(i);
+		if (descr)
+			descriptor(descr, SCOPE_SI);
+		else
+			eventData::cacheCorrupt("eEPGEvent");
 	}
 }
 
-void eventData::save(FILE *f)
+eventData::~eventData()
 {
-	if (isCacheCorrupt)
-		return;
-	int size=descriptors.size();
-	descriptorMap::iterator it(descriptors.begin());
-	fwrite(&size, sizeof(int), 1, f);
-	while(size)
+	if ( ByteSize )
 	{
-		fwrite(&it->first, sizeof(__u32), 1, f);
-		fwrite(&it->second.first, sizeof(int), 1, f);
-		fwrite(it->second.second, it->second.second[1]+2, 1, f);
-		++it;
-		--size;
+		CacheSize -= ByteSize;
+		__u32 *d = (__u32*)(EITdata+10);
+		int tmp = ByteSize-10;
+		while(tmp>3)
+		{
+			int freed = descriptors.release(*d++);
+			if (freed < 0)
+				cacheCorrupt("eventData::~eventData");
+			else
+				CacheSize -= freed;
+			tmp -= 4;
+		}
+		eEPGSlab::release(EITdata, ByteSize);
 	}
 }
 
@@ -327,16 +277,19 @@ void eventData::cacheCorrupt(const char* context)
 
 
 eEPGCache* eEPGCache::instance;
-pthread_mutex_t eEPGCache::cache_lock=
-	PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+eRecursiveRdWrLock eEPGCache::cache_lock;
 pthread_mutex_t eEPGCache::channel_map_lock=
 	PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+pthread_mutex_t eEPGCache::load_lock=
+	PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
 DEFINE_REF(eEPGCache)
 
 eEPGCache::eEPGCache()
-	:messages(this,1), cleanTimer(eTimer::create(this)), m_running(false) 
+	:messages(this,1), cleanTimer(eTimer::create(this)), m_running(false), m_saver(this)
+	,m_journal_full(false), m_journal_size(0)
 {
+	memset(&m_journal_base, 0, sizeof(m_journal_base));
 	eDebug("[EPGC] Initialized EPGCache (wait for setCacheFile call now)");
 
 	enabledSources = 0;
@@ -576,7 +529,7 @@ void eEPGCache::DVBChannelStateChanged(iDVBChannel *chan)
 	}
 }
 
-bool eEPGCache::FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t TM, int duration, const timeMap::iterator &tm_it, const uniqueEPGKey &service)
+bool eEPGCache::FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t TM, int duration, timeMap::iterator tm_it, const uniqueEPGKey &service)
 {
 	bool ret = false;
 	timeMap::iterator tmp = tm_it;
@@ -593,8 +546,9 @@ bool eEPGCache::FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t T
 		{
 			__u16 event_id = tmp->second->getEventID();
 			servicemap.first.erase(event_id);
+			journalRemove(service, event_id);
 #ifdef EPG_DEBUG
-			Event evt((uint8_t*)tmp->second->get());
+			eEPGEvent evt(*tmp->second);
 			eServiceEvent event;
 			event.parseFrom(&evt, service.sid<<16|service.onid);
 			eDebug("(1)erase no more used event %04x %d\n%s %s\n%s",
@@ -607,10 +561,14 @@ bool eEPGCache::FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t T
 			if (tmp == servicemap.second.begin())
 			{
 				servicemap.second.erase(tmp);
+				ret = true;
 				break;
 			}
 			else
-				servicemap.second.erase(tmp--);
+			{
+				tmp = servicemap.second.erase(tmp);
+				--tmp;
+			}
 			ret = true;
 		}
 		else
@@ -621,15 +579,17 @@ bool eEPGCache::FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t T
 		}
 	}
 
-	tmp = tm_it;
+	// entries before tm_it have moved, look it up again
+	tmp = ret ? servicemap.second.find(TM) : tm_it;
 	while(tmp->first < (TM+duration-300))
 	{
 		if (tmp->first != TM && tmp->second->type != PRIVATE)
 		{
 			__u16 event_id = tmp->second->getEventID();
 			servicemap.first.erase(event_id);
+			journalRemove(service, event_id);
 #ifdef EPG_DEBUG  
-			Event evt((uint8_t*)tmp->second->get());
+			eEPGEvent evt(*tmp->second);
 			eServiceEvent event;
 			event.parseFrom(&evt, service.sid<<16|service.onid);
 			eDebug("(2)erase no more used event %04x %d\n%s %s\n%s",
@@ -639,7 +599,7 @@ bool eEPGCache::FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t T
 				event.getExtendedDescription().c_str());
 #endif
 			delete tmp->second;
-			servicemap.second.erase(tmp++);
+			tmp = servicemap.second.erase(tmp);
 			ret = true;
 		}
 		else
@@ -704,10 +664,10 @@ void eEPGCache::sectionRead(const __u8 *data, int source, channel_data *channel)
 	if ( TM != 3599 && TM > -1 && channel)
 		channel->haveData |= source;
 
-	singleLock s(cache_lock);
+	eRecursiveWrLocker s(cache_lock);
 	// hier wird immer eine eventMap zurck gegeben.. entweder eine vorhandene..
 	// oder eine durch [] erzeugte
-	std::pair<eventMap,timeMap> &servicemap = eventDB[service];
+	std::pair<eventMap,timeMap> &servicemap = getService(service);
 	eventMap::iterator prevEventIt = servicemap.first.end();
 	timeMap::iterator prevTimeIt = servicemap.second.end();
 
@@ -770,8 +730,9 @@ void eEPGCache::sectionRead(const __u8 *data, int source, channel_data *channel)
 					{
 						// exempt memory
 						eventData *tmp = ev_it->second;
-						ev_it->second = tm_it_tmp->second =
-							new eventData(eit_event, eit_event_size, source, (tsid<<16)|onid);
+						evt = new eventData(eit_event, eit_event_size, source, (tsid<<16)|onid);
+						ev_it->second = tm_it_tmp->second = evt;
+						journalEvent(service, evt, tmp);
 						if (FixOverlapping(servicemap, TM, duration, tm_it_tmp, service))
 						{
 							prevEventIt = servicemap.first.end();
@@ -812,6 +773,8 @@ void eEPGCache::sectionRead(const __u8 *data, int source, channel_data *channel)
 					// delete the found record from eventmap
 					servicemap.first.erase(ev_it_tmp);
 					prevEventIt=servicemap.first.end();
+					// the erase moved the entries behind it
+					ev_it = servicemap.first.find(event_id);
 				}
 			}
 			evt = new eventData(eit_event, eit_event_size, source, (tsid<<16)|onid);
@@ -868,6 +831,7 @@ void eEPGCache::sectionRead(const __u8 *data, int source, channel_data *channel)
 						ev_it->first, event_id );
 			}
 #endif
+			journalEvent(service, evt, NULL);
 			if (FixOverlapping(servicemap, TM, duration, tm_it, service))
 			{
 				prevEventIt = servicemap.first.end();
@@ -906,9 +870,13 @@ next:
 void eEPGCache::flushEPG(const uniqueEPGKey & s)
 {
 	eDebug("[EPGC] flushEPG %d", (int)(bool)s);
-	singleLock l(cache_lock);
+	eRecursiveWrLocker l(cache_lock);
+	journalFlush(s);
 	if (s)  // clear only this service
 	{
+		mappedServiceMap::iterator m = mappedServices.find(s);
+		if (m != mappedServices.end())
+			dropMappedService(m);
 		eventCache::iterator it = eventDB.find(s);
 		if ( it != eventDB.end() )
 		{
@@ -945,10 +913,17 @@ void eEPGCache::flushEPG(const uniqueEPGKey & s)
 			tmMap.clear();
 		}
 		eventDB.clear();
+		// the descriptors left are those of the mapped services
+		mappedServices.clear();
+		expiredDescriptors.clear();
+		eventData::descriptors.clear();
+		eventData::CacheSize = 0;
+		mappedFile = 0;
 #ifdef ENABLE_PRIVATE_EPG
 		content_time_tables.clear();
 #endif
 		channelLastUpdated.clear();
+		eEPGSlab::trim();
 		singleLock m(channel_map_lock);
 		for (channelMapIterator it(m_knownChannels.begin()); it != m_knownChannels.end(); ++it)
 			it->second->startEPG();
@@ -957,13 +932,24 @@ void eEPGCache::flushEPG(const uniqueEPGKey & s)
 
 void eEPGCache::cleanLoop()
 {
-	singleLock s(cache_lock);
-	if (!eventDB.empty())
+	// one service at a time, the lookups get in between
+	std::vector<uniqueEPGKey> services;
+	{
+		eRecursiveRdLocker s(cache_lock);
+		services.reserve(eventDB.size());
+		for (eventCache::iterator DBIt = eventDB.begin(); DBIt != eventDB.end(); DBIt++)
+			services.push_back(DBIt->first);
+	}
+	if (!services.empty())
 	{
 		time_t now = ::time(0) - historySeconds;
 
-		for (eventCache::iterator DBIt = eventDB.begin(); DBIt != eventDB.end(); DBIt++)
+		for (std::vector<uniqueEPGKey>::iterator key = services.begin(); key != services.end(); ++key)
 		{
+			eRecursiveWrLocker s(cache_lock);
+			eventCache::iterator DBIt = eventDB.find(*key);
+			if (DBIt == eventDB.end())
+				continue;
 			bool updated = false;
 			for (timeMap::iterator It = DBIt->second.second.begin(); It != DBIt->second.second.end() && It->first < now;)
 			{
@@ -981,7 +967,7 @@ void eEPGCache::cleanLoop()
 					// remove entry from timeMap
 //					eDebug("[EPGC] release heap mem");
 					delete It->second;
-					DBIt->second.second.erase(It++);
+					It = DBIt->second.second.erase(It);
 //					eDebug("[EPGC] delete old event (timeMap)");
 					updated = true;
 				}
@@ -1016,6 +1002,20 @@ void eEPGCache::cleanLoop()
 #endif
 		}
 	}
+	{
+		eRecursiveWrLocker s(cache_lock);
+		for (std::vector<__u32>::iterator crc = expiredDescriptors.begin(); crc != expiredDescriptors.end(); ++crc)
+		{
+			int freed = eventData::descriptors.release(*crc);
+			if (freed < 0)
+				eventData::cacheCorrupt("eEPGCache::cleanLoop");
+			else
+				eventData::CacheSize -= freed;
+		}
+		expiredDescriptors.clear();
+		eEPGSlab::trim();
+		checkMappedFile();
+	}
 	cleanTimer->start(CLEAN_INTERVAL,true);
 }
 
@@ -1023,10 +1023,14 @@ eEPGCache::~eEPGCache()
 {
 	messages.send(Message::quit);
 	kill(); // waiting for thread shutdown
-	singleLock s(cache_lock);
+	eRecursiveWrLocker s(cache_lock);
 	for (eventCache::iterator evIt = eventDB.begin(); evIt != eventDB.end(); evIt++)
 		for (eventMap::iterator It = evIt->second.first.begin(); It != evIt->second.first.end(); It++)
 			delete It->second;
+	mappedServices.clear();
+	expiredDescriptors.clear();
+	eventData::descriptors.clear();
+	mappedFile = 0;
 }
 
 void eEPGCache::gotMessage( const Message &msg )
@@ -1165,6 +1169,7 @@ void eEPGCache::thread()
 	cleanLoop();
 	runLoop();
 	save();
+	m_saver.kill(); // the save has to be complete
 	m_running = false;
 }
 
@@ -1194,41 +1199,78 @@ void eEPGCache::load()
 				fclose(f);
 				return;
 			}
+			bool loaded = false;
+			bool mapped = false;
 			char text1[13];
 			fread( text1, 13, 1, f);
-			if ( !memcmp( text1, "ENIGMA_EPG_V7", 13) )
+			if ( !memcmp( text1, "ENIGMA_EPG_V8", 13) )
+				loaded = mapped = loadMapped(f);
+			else if ( !memcmp( text1, "ENIGMA_EPG_V7", 13) )
 			{
-				singleLock s(cache_lock);
+				// read without holding the lock, the services are
+				// published once the descriptors they use are in
+				std::vector<std::pair<uniqueEPGKey, std::vector<__u8> > > services;
+				std::vector<int> events;
 				fread( &size, sizeof(int), 1, f);
-				while(size--)
+				while(size-- > 0 && !feof(f))
 				{
 					uniqueEPGKey key;
-					eventMap evMap;
-					timeMap tmMap;
 					int size=0;
 					fread( &key, sizeof(uniqueEPGKey), 1, f);
 					fread( &size, sizeof(int), 1, f);
-					while(size--)
+					services.push_back(std::make_pair(key, std::vector<__u8>()));
+					events.push_back(size);
+					std::vector<__u8> &records = services.back().second;
+					while(size-- > 0)
 					{
-						__u8 len=0;
-						__u8 type=0;
-						eventData *event=0;
-						fread( &type, sizeof(__u8), 1, f);
-						fread( &len, sizeof(__u8), 1, f);
-						event = new eventData(0, len, type);
-						event->EITdata = new __u8[len];
-						eventData::CacheSize+=len;
-						fread( event->EITdata, len, 1, f);
-						evMap[ event->getEventID() ]=event;
-						tmMap[ event->getStartTime() ]=event;
+						__u8 header[2] = {0, 0}; // type, len
+						fread( header, 2, 1, f);
+						size_t pos = records.size();
+						records.resize(pos + 2 + header[1]);
+						memcpy(&records[pos], header, 2);
+						fread( &records[pos + 2], header[1], 1, f);
 						++cnt;
 					}
-					eventDB[key]=std::pair<eventMap,timeMap>(evMap,tmMap);
 				}
-				eventData::load(f);
+				// the descriptor table: count, count times crc, refs, descriptor
+				std::vector<__u8> descriptors;
+				fread( &size, sizeof(int), 1, f);
+				while(size-- > 0 && !feof(f))
+				{
+					size_t pos = descriptors.size();
+					descriptors.resize(pos + 10);
+					fread( &descriptors[pos], 10, 1, f);
+					descriptors.resize(pos + 10 + descriptors[pos + 9]);
+					fread( &descriptors[pos + 10], descriptors[pos + 9], 1, f);
+				}
+				{
+					eRecursiveWrLocker s(cache_lock);
+					for (size_t pos = 0; pos < descriptors.size(); pos += 10 + descriptors[pos + 9])
+					{
+						__u32 crc, refs;
+						memcpy(&crc, &descriptors[pos], 4);
+						memcpy(&refs, &descriptors[pos + 4], 4);
+						eventData::CacheSize += eventData::descriptors.insert(crc, &descriptors[pos + 8], refs);
+					}
+				}
+				for (size_t i = 0; i < services.size(); ++i)
+				{
+					std::vector<__u8> &records = services[i].second;
+					eRecursiveWrLocker s(cache_lock);
+					if (!records.empty())
+						loadEvents(services[i].first, &records[0], &records[0] + records.size(), events[i], "eEPGCache::load");
+				}
 				eDebug("[EPGC] %d events read from %s", cnt, EPGDAT);
+				loaded = true;
+			}
+			else
+				eDebug("[EPGC] don't read old epg database");
 #ifdef ENABLE_PRIVATE_EPG
+			if (loaded)
+			{
+				eRecursiveWrLocker s(cache_lock);
 				char text2[11];
+				memset(text2, 0, sizeof(text2));
 				fread( text2, 11, 1, f);
 				if ( !memcmp( text2, "PRIVATE_EPG", 11) )
 				{
@@ -1239,7 +1281,7 @@ void eEPGCache::load()
 						int size=0;
 						uniqueEPGKey key;
 						fread( &key, sizeof(uniqueEPGKey), 1, f);
-						eventMap &evMap=eventDB[key].first;
+						eventMap &evMap=getService(key).first;
 						fread( &size, sizeof(int), 1, f);
 						while(size--)
 						{
@@ -1263,11 +1305,11 @@ void eEPGCache::load()
 						}
 					}
 				}
-#endif // ENABLE_PRIVATE_EPG
 			}
-			else
-				eDebug("[EPGC] don't read old epg database");
-			posix_fadvise(fileno(f), 0, 0, POSIX_FADV_DONTNEED);
+#endif // ENABLE_PRIVATE_EPG
+			// the pages of a mapped file are still wanted
+			if (!mapped)
+				posix_fadvise(fileno(f), 0, 0, POSIX_FADV_DONTNEED);
 			fclose(f);
 			// We got this far, so the EPG file is okay.
 			if (renameResult == 0)
@@ -1277,31 +1319,654 @@ void eEPGCache::load()
 			}
 		}
 	}
+	replayJournal();
 }
 
-void eEPGCache::save()
+static const eEPGFileHeader *checkMappedHeader(const eEPGMappedFile *file)
 {
-	const char* EPGDAT = m_filename.c_str();
-	if (eventData::isCacheCorrupt)
+	const eEPGFileHeader *header = (const eEPGFileHeader*)file->data();
+	if (file->size() < sizeof(eEPGFileHeader) || header->file_size != file->size())
+		return NULL;
+	if (memcmp(header->version, "ENIGMA_EPG_V8", 13))
+		return NULL;
+	__u32 data_start = sizeof(eEPGFileHeader) + header->services * sizeof(eEPGFileService);
+	__u32 descr_end = header->private_offset ? header->private_offset : header->file_size;
+	if (header->services > header->file_size / sizeof(eEPGFileService) ||
+		header->descriptor_offset < data_start || descr_end < header->descriptor_offset ||
+		descr_end > header->file_size)
+		return NULL;
+	const eEPGFileService *service = (const eEPGFileService*)(header + 1);
+	for (unsigned int i = 0; i < header->services; ++i, ++service)
+	{
+		if (service->offset < data_start || service->size > header->descriptor_offset - service->offset)
+			return NULL;
+	}
+	return header;
+}
+
+/*
+ * Maps an epg.dat of version 8 in the cache: the descriptors are used from
+ * the file, the events of a service are copied out only when the service
+ * is looked up the first time. Leaves f at the private epg tables.
+ */
+bool eEPGCache::loadMapped(FILE *f)
+{
+	ePtr<eEPGMappedFile> file = new eEPGMappedFile;
+	const eEPGFileHeader *header = file->map(fileno(f)) ? checkMappedHeader(file) : NULL;
+	if (!header)
+	{
+		eDebug("[EPGC] epg file is damaged.. dont read it");
+		return false;
+	}
+	// fault the descriptor table in before taking the lock
+	volatile __u8 touch = 0;
+	for (__u32 pos = header->descriptor_offset; pos < header->file_size; pos += 4096)
+		touch += file->data()[pos];
+
+	eRecursiveWrLocker s(cache_lock);
+	int bytes = eventData::descriptors.loadMapped(file, header->descriptor_offset,
+		header->private_offset ? header->private_offset : header->file_size);
+	if (bytes < 0)
+	{
+		eDebug("[EPGC] epg file has a damaged descriptor table.. dont read it");
+		eventData::descriptors.clear();
+		return false;
+	}
+	eventData::CacheSize += bytes;
+	mappedFile = file;
+	m_journal_base = *header;
+
+	int cnt = 0;
+	const eEPGFileService *service = (const eEPGFileService*)(header + 1);
+	for (unsigned int i = 0; i < header->services; ++i, ++service)
+	{
+		if (!service->events)
+			continue;
+		uniqueEPGKey key(service->sid, service->onid, service->tsid);
+		mappedServices[key] = service;
+		eventDB[key];
+		cnt += service->events;
+	}
+	eDebug("[EPGC] %d events of %d services mapped from %s", cnt, header->services, m_filename.c_str());
+	if (header->private_offset)
+		fseek(f, header->private_offset, SEEK_SET);
+	else
+		fseek(f, 0, SEEK_END);
+	return true;
+}
+
+/*
+ * Creates the events of a service from records as stored in epg.dat (type,
+ * length, event) and adds them to the cache, leaving out those already over.
+ * Called with the lock held, for reading with load_lock held: the events
+ * left out keep their descriptors until the cleanLoop, other readers may
+ * be using the pool.
+ */
+void eEPGCache::loadEvents(const uniqueEPGKey &key, const __u8 *p, const __u8 *end, unsigned int events, const char *context)
+{
+	std::vector<eventMap::value_type> evBatch;
+	std::vector<timeMap::value_type> tmBatch;
+	evBatch.reserve(events);
+	tmBatch.reserve(events);
+	time_t now = ::time(0) - historySeconds;
+	for (unsigned int i = 0; i < events; ++i)
+	{
+		if (p + 2 > end || p + 2 + p[1] > end || p[1] < 10)
+		{
+			eventData::cacheCorrupt(context);
+			break;
+		}
+		__u8 type = p[0], len = p[1];
+		const __u8 *data = p + 2;
+		p += 2 + len;
+		if (now > parseDVBtime(data[2], data[3], data[4], data[5], data[6]) +
+			fromBCD(data[7])*3600+fromBCD(data[8])*60+fromBCD(data[9]))
+		{
+			for (int pos = 10; pos + 4 <= len; pos += 4)
+			{
+				__u32 crc;
+				memcpy(&crc, data + pos, 4);
+				expiredDescriptors.push_back(crc);
+			}
+			continue;
+		}
+		eventData *event = new eventData(0, len, type);
+		event->EITdata = (__u8*)eEPGSlab::alloc(len);
+		eventData::CacheSize += len;
+		memcpy(event->EITdata, data, len);
+		evBatch.push_back(eventMap::value_type(event->getEventID(), event));
+		tmBatch.push_back(timeMap::value_type(event->getStartTime(), event));
+	}
+	std::pair<eventMap,timeMap> &servicemap = eventDB[key];
+	servicemap.first.merge(evBatch);
+	servicemap.second.merge(tmBatch);
+}
+
+/*
+ * Called with the lock held for writing, or for reading and load_lock held.
+ * Readers may still use the mapped descriptors, the cleanup after the last
+ * service is left to checkMappedFile from the cleanLoop.
+ */
+void eEPGCache::loadMappedService(mappedServiceMap::iterator it)
+{
+	const eEPGFileService *service = it->second;
+	uniqueEPGKey key = it->first;
+	mappedServices.erase(it);
+	const __u8 *p = mappedFile->data() + service->offset;
+	loadEvents(key, p, p + service->size, service->events, "eEPGCache::loadMappedService");
+}
+
+/* called with the lock held, whether an event of a mapped service refers to
+   one of the count descriptors in the sorted crcs */
+bool eEPGCache::mappedServiceUses(const eEPGFileService *service, const __u32 *crcs, int count)
+{
+	const __u8 *p = mappedFile->data() + service->offset;
+	const __u8 *end = p + service->size;
+	for (unsigned int i = 0; i < service->events && p + 2 <= end && p + 2 + p[1] <= end; ++i)
+	{
+		for (int pos = 12; pos + 4 <= p[1] + 2; pos += 4)
+		{
+			__u32 crc;
+			memcpy(&crc, p + pos, 4);
+			if (std::binary_search(crcs, crcs + count, crc))
+				return true;
+		}
+		p += 2 + p[1];
+	}
+	return false;
+}
+
+/* called with the lock held, drops the events of a mapped service unseen */
+void eEPGCache::dropMappedService(mappedServiceMap::iterator it)
+{
+	const eEPGFileService *service = it->second;
+	mappedServices.erase(it);
+
+	const __u8 *p = mappedFile->data() + service->offset;
+	const __u8 *end = p + service->size;
+	for (unsigned int i = 0; i < service->events; ++i)
+	{
+		if (p + 2 > end || p + 2 + p[1] > end || p[1] < 10)
+		{
+			eventData::cacheCorrupt("eEPGCache::dropMappedService");
+			break;
+		}
+		for (int pos = 12; pos + 4 <= p[1] + 2; pos += 4)
+		{
+			__u32 crc;
+			memcpy(&crc, p + pos, 4);
+			int freed = eventData::descriptors.release(crc);
+			if (freed < 0)
+				eventData::cacheCorrupt("eEPGCache::dropMappedService");
+			else
+				eventData::CacheSize -= freed;
+		}
+		p += 2 + p[1];
+	}
+	checkMappedFile();
+}
+
+/* called with the lock held */
+void eEPGCache::checkMappedFile()
+{
+	if (mappedFile && mappedServices.empty() && !eventData::descriptors.mappedCount())
+	{
+		eDebug("[EPGC] epg file no longer used");
+		mappedFile = 0;
+	}
+}
+
+/*
+ * After a save the mapped file is gone from the directory, but the disk
+ * space stays in use while it is mapped. Switch over to the new file.
+ * Called with the lock held.
+ */
+void eEPGCache::remapSaved(const char *filename)
+{
+	ePtr<eEPGMappedFile> file = new eEPGMappedFile;
+	const eEPGFileHeader *header = NULL;
+	int fd = open(filename, O_RDONLY);
+	if (fd >= 0)
+	{
+		if (file->map(fd))
+			header = checkMappedHeader(file);
+		close(fd);
+	}
+	if (header)
+	{
+		const eEPGFileService *service = (const eEPGFileService*)(header + 1);
+		for (unsigned int i = 0; i < header->services; ++i, ++service)
+		{
+			mappedServiceMap::iterator it = mappedServices.find(uniqueEPGKey(service->sid, service->onid, service->tsid));
+			if (it != mappedServices.end() && it->second->events == service->events && it->second->size == service->size)
+				it->second = service;
+		}
+	}
+	// whatever was not found again is loaded now
+	std::vector<uniqueEPGKey> left;
+	for (mappedServiceMap::iterator it = mappedServices.begin(); it != mappedServices.end(); ++it)
+		if (!file->contains(it->second))
+			left.push_back(it->first);
+	for (std::vector<uniqueEPGKey>::iterator key = left.begin(); key != left.end(); ++key)
+		loadMappedService(mappedServices.find(*key));
+	if (header)
+		eventData::descriptors.remap(file, header->descriptor_offset,
+			header->private_offset ? header->private_offset : header->file_size);
+	else
+		eventData::descriptors.remap(NULL, 0, 0);
+	mappedFile = file;
+	checkMappedFile();
+}
+
+/* called with the lock held for reading at least */
+eventCache::iterator eEPGCache::findService(const uniqueEPGKey &key)
+{
+	singleLock l(load_lock);
+	if (!mappedServices.empty())
+	{
+		mappedServiceMap::iterator it = mappedServices.find(key);
+		if (it != mappedServices.end())
+			loadMappedService(it);
+	}
+	return eventDB.find(key);
+}
+
+/* called with the lock held for writing, it may add the service */
+std::pair<eventMap,timeMap> &eEPGCache::getService(const uniqueEPGKey &key)
+{
+	if (!mappedServices.empty())
+	{
+		mappedServiceMap::iterator it = mappedServices.find(key);
+		if (it != mappedServices.end())
+			loadMappedService(it);
+	}
+	return eventDB[key];
+}
+
+	// keep at most this many changes in memory between two saves
+#define JOURNAL_BUFFER_MAX	(4 * 1024 * 1024)
+
+static __u32 journalCrc(const __u8 *data, size_t len)
+{
+	__u32 crc = 0;
+	while (len--)
+		crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *data++) & 0xFF];
+	return crc;
+}
+
+/* called with the lock held */
+void eEPGCache::journalRecord(int op, const uniqueEPGKey &key, const __u8 *data, int len)
+{
+	if (m_journal_full)
+		return;
+	if (m_journal.size() > JOURNAL_BUFFER_MAX)
+	{
+		eDebug("[EPGC] too many changes for the journal, next save writes all");
+		m_journal_full = true;
+		std::vector<__u8>().swap(m_journal);
+		return;
+	}
+	size_t pos = m_journal.size();
+	__u32 length = 13 + len;
+	m_journal.resize(pos + 8 + length);
+	__u8 *p = &m_journal[pos];
+	memcpy(p, &length, 4);
+	p[8] = op;
+	memcpy(p + 9, &key.sid, 4);
+	memcpy(p + 13, &key.onid, 4);
+	memcpy(p + 17, &key.tsid, 4);
+	if (len)
+		memcpy(p + 21, data, len);
+	__u32 crc = journalCrc(p + 8, length);
+	memcpy(p + 4, &crc, 4);
+}
+
+/* called with the lock held, old is the event evt replaces, if any */
+void eEPGCache::journalEvent(const uniqueEPGKey &key, const eventData *evt, const eventData *old)
+{
+	if (m_journal_full)
+		return;
+	// sections are repeated all the time, most of them change nothing
+	if (old && old->type == evt->type && old->ByteSize == evt->ByteSize &&
+		!memcmp(old->EITdata, evt->EITdata, evt->ByteSize))
+		return;
+	__u8 buf[2 + 255 + 64 * 257];
+	int len = 2 + evt->ByteSize;
+	buf[0] = evt->type;
+	buf[1] = evt->ByteSize;
+	memcpy(buf + 2, evt->EITdata, evt->ByteSize);
+	for (int i = 10; i + 4 <= evt->ByteSize; i += 4)
+	{
+		__u32 crc;
+		memcpy(&crc, evt->EITdata + i, 4);
+		const __u8 *descr = eventData::descriptors.find(crc);
+		if (!descr)
+			return;
+		memcpy(buf + len, descr, descr[1] + 2);
+		len += descr[1] + 2;
+	}
+	journalRecord(JOURNAL_ADD, key, buf, len);
+}
+
+/* called with the lock held */
+void eEPGCache::journalRemove(const uniqueEPGKey &key, __u16 event_id)
+{
+	journalRecord(JOURNAL_REMOVE, key, (const __u8*)&event_id, sizeof(event_id));
+}
+
+/* called with the lock held */
+void eEPGCache::journalFlush(const uniqueEPGKey &key)
+{
+	journalRecord(JOURNAL_FLUSH, key, NULL, 0);
+}
+
+/* called with the lock held */
+void eEPGCache::removeEvent(std::pair<eventMap,timeMap> &servicemap, eventData *evt)
+{
+	eventMap::iterator ev_it = servicemap.first.find(evt->getEventID());
+	if (ev_it != servicemap.first.end() && ev_it->second == evt)
+		servicemap.first.erase(ev_it);
+	timeMap::iterator tm_it = servicemap.second.find(evt->getStartTime());
+	if (tm_it != servicemap.second.end() && tm_it->second == evt)
+		servicemap.second.erase(tm_it);
+	delete evt;
+}
+
+/*
+ * Applies the journal to the epg.dat just loaded. A journal of another
+ * epg.dat is left over from a save interrupted before it could remove it,
+ * the epg.dat has its changes already.
+ */
+void eEPGCache::replayJournal()
+{
+	std::string filename = m_filename + ".journal";
+	int fd = open(filename.c_str(), O_RDWR);
+	if (fd < 0)
+		return;
+	eEPGJournalHeader header;
+	std::vector<__u8> records;
+	struct stat st;
+	bool valid = fstat(fd, &st) == 0 && read(fd, &header, sizeof(header)) == sizeof(header) &&
+		header.magic == 0x98765432 && !memcmp(header.version, "ENIGMA_EPG_J1", 13) &&
+		m_journal_base.magic && !memcmp(&header.base, &m_journal_base, sizeof(m_journal_base));
+	if (valid && st.st_size > (off_t)sizeof(header))
+	{
+		records.resize(st.st_size - sizeof(header));
+		valid = read(fd, &records[0], records.size()) == (ssize_t)records.size();
+	}
+	if (!valid)
+	{
+		eDebug("[EPGC] journal does not belong to %s, removed", m_filename.c_str());
+		close(fd);
+		unlink(filename.c_str());
 		return;
-	// only save epg.dat if it's worth the trouble...
-	if (eventData::CacheSize < 10240)
+	}
+
+	size_t pos = 0;
+	int cnt = 0;
+	time_t now = ::time(0) - historySeconds;
+	eRecursiveWrLocker s(cache_lock);
+	while (pos + 8 + 13 <= records.size())
+	{
+		__u32 length, crc;
+		const __u8 *p = &records[pos];
+		memcpy(&length, p, 4);
+		memcpy(&crc, p + 4, 4);
+		if (length < 13 || length > records.size() - pos - 8 || journalCrc(p + 8, length) != crc)
+			break;
+		const __u8 *end = p + 8 + length;
+		int op = p[8];
+		uniqueEPGKey key;
+		memcpy(&key.sid, p + 9, 4);
+		memcpy(&key.onid, p + 13, 4);
+		memcpy(&key.tsid, p + 17, 4);
+		p += 21;
+		if (op == JOURNAL_ADD && p + 2 + 10 <= end && p + 2 + p[1] <= end)
+		{
+			__u8 type = p[0], len = p[1];
+			const __u8 *descr = p + 2 + len;
+			std::pair<eventMap,timeMap> &servicemap = getService(key);
+			for (int i = 10; i + 4 <= len && descr + 2 <= end && descr + 2 + descr[1] <= end; i += 4)
+			{
+				__u32 crc;
+				memcpy(&crc, p + 2 + i, 4);
+				if (!eventData::descriptors.addRef(crc))
+					eventData::CacheSize += eventData::descriptors.insert(crc, descr);
+				descr += 2 + descr[1];
+			}
+			eventData *evt = new eventData(0, len, type);
+			evt->EITdata = (__u8*)eEPGSlab::alloc(len);
+			eventData::CacheSize += len;
+			memcpy(evt->EITdata, p + 2, len);
+			if (now > evt->getStartTime() + evt->getDuration())
+			{
+				delete evt;
+			}
+			else
+			{
+				eventMap::iterator ev_it = servicemap.first.find(evt->getEventID());
+				if (ev_it != servicemap.first.end())
+					removeEvent(servicemap, ev_it->second);
+				timeMap::iterator tm_it = servicemap.second.find(evt->getStartTime());
+				if (tm_it != servicemap.second.end())
+					removeEvent(servicemap, tm_it->second);
+				servicemap.first[evt->getEventID()] = evt;
+				servicemap.second[evt->getStartTime()] = evt;
+			}
+		}
+		else if (op == JOURNAL_REMOVE && p + 2 <= end)
+		{
+			__u16 event_id;
+			memcpy(&event_id, p, 2);
+			eventCache::iterator it = findService(key);
+			if (it != eventDB.end())
+			{
+				eventMap::iterator ev_it = it->second.first.find(event_id);
+				if (ev_it != it->second.first.end())
+					removeEvent(it->second, ev_it->second);
+			}
+		}
+		else if (op == JOURNAL_FLUSH)
+		{
+			for (mappedServiceMap::iterator it = mappedServices.begin(); it != mappedServices.end(); )
+			{
+				if (!key || it->first == key)
+				{
+					mappedServiceMap::iterator drop = it++;
+					dropMappedService(drop);
+				}
+				else
+					++it;
+			}
+			for (eventCache::iterator it = eventDB.begin(); it != eventDB.end(); )
+			{
+				if (!key || it->first == key)
+				{
+					for (eventMap::iterator i = it->second.first.begin(); i != it->second.first.end(); ++i)
+						delete i->second;
+					eventDB.erase(it++);
+				}
+				else
+					++it;
+			}
+		}
+		pos += 8 + length;
+		++cnt;
+	}
+	if (pos < records.size())
+	{
+		eDebug("[EPGC] journal damaged after %d changes, rest dropped", cnt);
+		if (ftruncate(fd, sizeof(header) + pos) < 0)
+			eDebug("[EPGC] truncating the journal failed (%m)");
+	}
+	close(fd);
+	m_journal_size = sizeof(header) + pos;
+	eDebug("[EPGC] %d changes replayed from the journal", cnt);
+}
+
+/*
+ * Runs in the save thread, writes the changes since the last save to the
+ * journal. Returns false when the whole epg.dat has to be written instead.
+ */
+bool eEPGCache::appendJournal()
+{
+	std::vector<__u8> records;
+	eEPGJournalHeader header;
+	size_t size;
+	{
+		eRecursiveWrLocker l(cache_lock);
+		if (eventData::isCacheCorrupt)
+			return true;
+		// the journal is folded into epg.dat when it reached a quarter of its size
+		if (m_journal_full || !m_journal_base.magic ||
+			(m_journal_size + m_journal.size()) * 4 > m_journal_base.file_size)
+			return false;
+		if (m_journal.empty())
+			return true;
+		records.swap(m_journal);
+		memset(&header, 0, sizeof(header));
+		header.magic = 0x98765432;
+		memcpy(header.version, "ENIGMA_EPG_J1", 13);
+		header.base = m_journal_base;
+		size = m_journal_size;
+	}
+
+	std::string filename = m_filename + ".journal";
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | (size ? 0 : O_TRUNC), 0644);
+	bool ok = fd >= 0;
+	if (ok && !size)
+	{
+		ok = write(fd, &header, sizeof(header)) == sizeof(header);
+		size = sizeof(header);
+	}
+	// after what replay kept, a failed append before may have left garbage
+	if (ok)
+		ok = lseek(fd, size, SEEK_SET) == (off_t)size &&
+			write(fd, &records[0], records.size()) == (ssize_t)records.size() &&
+			fdatasync(fd) == 0;
+	if (fd >= 0)
+		close(fd);
+	if (!ok)
+	{
+		eDebug("[EPGC] writing the journal failed (%m)");
+		return false;
+	}
+	eRecursiveWrLocker l(cache_lock);
+	m_journal_size = size + records.size();
+	eDebug("[EPGC] %d bytes of changes written to the journal", (int)records.size());
+	return true;
+}
+
+void eEPGCache::save()
+{
+	if (m_saver.sync())
+	{
+		eDebug("[EPGC] save already running");
 		return;
+	}
+	m_saver.run();
+}
+
+void eEPGCache::save_thread::thread()
+{
+	hasStarted();
+	nice(5);
+	setIoPrio(IOPRIO_CLASS_BE, 7);
+	if (!cache->appendJournal() && !cache->writeEPG())
+	{
+		// what the journal would need is lost, write everything next time
+		eRecursiveWrLocker l(cache->cache_lock);
+		cache->m_journal_full = true;
+		cache->m_journal.clear();
+	}
+}
+
+/*
+ * The descriptors of a save, in the layout of the file: crc, refs,
+ * descriptor. The reference counts are those of the saved events, so
+ * the file stays consistent while the cache changes during the save.
+ */
+struct savedDescriptors
+{
+	std::vector<__u8> table;
+	__gnu_cxx::hash_map<__u32, size_t> refs; // offset of the count in table
+	int count;
+	savedDescriptors(): count(0) {}
+	bool add(__u32 crc, const __u8 *descr)
+	{
+		__gnu_cxx::hash_map<__u32, size_t>::iterator it = refs.find(crc);
+		if (it != refs.end())
+		{
+			int count;
+			memcpy(&count, &table[it->second], 4);
+			++count;
+			memcpy(&table[it->second], &count, 4);
+			return true;
+		}
+		if (!descr)
+			return false;
+		size_t pos = table.size();
+		int len = descr[1] + 2;
+		int one = 1;
+		table.resize(pos + 8 + len);
+		memcpy(&table[pos], &crc, 4);
+		memcpy(&table[pos + 4], &one, 4);
+		memcpy(&table[pos + 8], descr, len);
+		refs[crc] = pos + 4;
+		++count;
+		return true;
+	}
+};
+
+/*
+ * Runs in the save thread. The services are copied one at a time with
+ * the lock held and written without it, services still in the mapped
+ * file are copied from there.
+ */
+bool eEPGCache::writeEPG()
+{
+	const char* EPGDAT = m_filename.c_str();
+	std::vector<uniqueEPGKey> services;
+	int needed;
+	{
+		eRecursiveWrLocker l(cache_lock);
+		if (eventData::isCacheCorrupt)
+			return false;
+		// only save epg.dat if it's worth the trouble...
+		if (eventData::CacheSize < 10240)
+			return false;
+		needed = eventData::CacheSize;
+		services.reserve(eventDB.size());
+		// the mapped services are in there too
+		for (eventCache::iterator it(eventDB.begin()); it != eventDB.end(); ++it)
+			services.push_back(it->first);
+		for (mappedServiceMap::iterator it(mappedServices.begin()); it != mappedServices.end(); ++it)
+			needed += it->second->size;
+		// everything changed so far is in what follows
+		m_journal.clear();
+		m_journal_full = false;
+	}
+
+	// written next to it and renamed over it when complete, a mapped epg.dat
+	// must not change under us
+	std::string filenametmp = m_filename + ".saving";
+	const char* EPGDATTMP = filenametmp.c_str();
 
 	/* create empty file */
-	FILE *f = fopen(EPGDAT, "w");
+	FILE *f = fopen(EPGDATTMP, "w");
 	if (!f)
 	{
-		eDebug("[EPGC] couldn't save epg data to '%s'(%m)", EPGDAT);
-		return;
+		eDebug("[EPGC] couldn't save epg data to '%s'(%m)", EPGDATTMP);
+		return false;
 	}
 
-	char* buf = realpath(EPGDAT, NULL);
+	char* buf = realpath(EPGDATTMP, NULL);
 	if (!buf)
 	{
-		eDebug("[EPGC] realpath to '%s' failed in save (%m)", EPGDAT);
+		eDebug("[EPGC] realpath to '%s' failed in save (%m)", EPGDATTMP);
 		fclose(f);
-		return;
+		unlink(EPGDATTMP);
+		return false;
 	}
 
 	eDebug("[EPGC] store epg to realpath '%s'", buf);
@@ -1311,8 +1976,9 @@ void eEPGCache::save()
 	if (statfs(buf, &s) < 0) {
 		eDebug("[EPGC] statfs '%s' failed in save (%m)", buf);
 		fclose(f);
+		unlink(EPGDATTMP);
 		free(buf);
-		return;
+		return false;
 	}
 
 	free(buf);
@@ -1320,43 +1986,121 @@ void eEPGCache::save()
 	// check for enough free space on storage
 	tmp=s.f_bfree;
 	tmp*=s.f_bsize;
-	if ( tmp < (eventData::CacheSize*12)/10 ) // 20% overhead
+	if ( tmp < (needed*12)/10 ) // 20% overhead
 	{
-		eDebug("[EPGC] not enough free space at path '%s' %lld bytes availd but %d needed", buf, tmp, (eventData::CacheSize*12)/10);
+		eDebug("[EPGC] not enough free space at path '%s' %lld bytes availd but %d needed", EPGDATTMP, tmp, (needed*12)/10);
 		fclose(f);
-		return;
+		unlink(EPGDATTMP);
+		return false;
 	}
 
 	int cnt=0;
-	unsigned int magic = 0x98765432;
-	fwrite( &magic, sizeof(int), 1, f);
-	const char *text = "UNFINISHED_V7";
-	fwrite( text, 13, 1, f );
-	int size = eventDB.size();
-	fwrite( &size, sizeof(int), 1, f );
-	for (eventCache::iterator service_it(eventDB.begin()); service_it != eventDB.end(); ++service_it)
-	{
-		timeMap &timemap = service_it->second.second;
-		fwrite( &service_it->first, sizeof(uniqueEPGKey), 1, f);
-		size = timemap.size();
-		fwrite( &size, sizeof(int), 1, f);
-		for (timeMap::iterator time_it(timemap.begin()); time_it != timemap.end(); ++time_it)
+	eEPGFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = 0x98765432;
+	memcpy(header.version, "UNFINISHED_V8", 13);
+	std::vector<eEPGFileService> index;
+	index.reserve(services.size());
+	savedDescriptors descriptors;
+	std::vector<__u8> records;
+	__u32 pos = sizeof(header) + services.size() * sizeof(eEPGFileService);
+	fwrite( &header, sizeof(header), 1, f);
+	fseek(f, pos, SEEK_SET);
+	for (std::vector<uniqueEPGKey>::iterator key(services.begin()); key != services.end(); ++key)
+	{
+		eEPGFileService service;
+		service.sid = key->sid;
+		service.onid = key->onid;
+		service.tsid = key->tsid;
+		service.events = 0;
+		records.clear();
+		ePtr<eEPGMappedFile> file;
+		{
+			eRecursiveRdLocker l(cache_lock);
+			eventCache::iterator service_it = eventDB.find(*key);
+			if (service_it == eventDB.end())
+				continue;
+			{
+				// the services never looked at are copied over as they are
+				singleLock m(load_lock);
+				mappedServiceMap::iterator it = mappedServices.find(*key);
+				if (it != mappedServices.end())
+				{
+					service = *it->second;
+					file = mappedFile;
+				}
+			}
+			if (file)
+			{
+				const __u8 *p = file->data() + service.offset;
+				const __u8 *end = p + service.size;
+				while (p + 2 <= end && p + 2 + p[1] <= end)
+				{
+					for (int i = 12; i + 4 <= p[1] + 2; i += 4)
+					{
+						__u32 crc;
+						memcpy(&crc, p + i, 4);
+						if (!descriptors.add(crc, eventData::descriptors.find(crc)))
+							eventData::cacheCorrupt("eEPGCache::writeEPG");
+					}
+					p += 2 + p[1];
+				}
+			}
+			else
+			{
+				timeMap &timemap = service_it->second.second;
+				for (timeMap::iterator time_it(timemap.begin()); time_it != timemap.end(); ++time_it)
+				{
+					eventData *event = time_it->second;
+					size_t at = records.size();
+					records.resize(at + 2 + event->ByteSize);
+					records[at] = event->type;
+					records[at + 1] = event->ByteSize;
+					memcpy(&records[at + 2], event->EITdata, event->ByteSize);
+					for (int i = 10; i + 4 <= event->ByteSize; i += 4)
+					{
+						__u32 crc;
+						memcpy(&crc, event->EITdata + i, 4);
+						if (!descriptors.add(crc, eventData::descriptors.find(crc)))
+							eventData::cacheCorrupt("eEPGCache::writeEPG");
+					}
+					++service.events;
+				}
+			}
+		}
+		if (file)
+		{
+			// the mapping stays, file holds a reference
+			fwrite( file->data() + service.offset, service.size, 1, f);
+		}
+		else
 		{
-			__u8 len = time_it->second->ByteSize;
-			fwrite( &time_it->second->type, sizeof(__u8), 1, f );
-			fwrite( &len, sizeof(__u8), 1, f);
-			fwrite( time_it->second->EITdata, len, 1, f);
-			++cnt;
+			service.size = records.size();
+			if (!records.empty())
+				fwrite( &records[0], records.size(), 1, f);
 		}
+		service.offset = pos;
+		pos += service.size;
+		cnt += service.events;
+		index.push_back(service);
 	}
 	eDebug("[EPGC] %d events written to %s", cnt, EPGDAT);
-	eventData::save(f);
+	header.descriptor_offset = pos;
+	fwrite( &descriptors.count, sizeof(int), 1, f);
+	if (!descriptors.table.empty())
+		fwrite( &descriptors.table[0], descriptors.table.size(), 1, f);
 #ifdef ENABLE_PRIVATE_EPG
+	contentMaps content_tables;
+	{
+		eRecursiveRdLocker l(cache_lock);
+		content_tables = content_time_tables;
+	}
+	header.private_offset = ftell(f);
 	const char* text3 = "PRIVATE_EPG";
 	fwrite( text3, 11, 1, f );
-	size = content_time_tables.size();
+	int size = content_tables.size();
 	fwrite( &size, sizeof(int), 1, f);
-	for (contentMaps::iterator a = content_time_tables.begin(); a != content_time_tables.end(); ++a)
+	for (contentMaps::iterator a = content_tables.begin(); a != content_tables.end(); ++a)
 	{
 		contentMap &content_time_table = a->second;
 		fwrite( &a->first, sizeof(uniqueEPGKey), 1, f);
@@ -1377,12 +2121,45 @@ void eEPGCache::save()
 		}
 	}
 #endif
+	header.services = index.size();
+	header.file_size = ftell(f);
+	fseek(f, sizeof(header), SEEK_SET);
+	if (!index.empty())
+		fwrite( &index[0], sizeof(eEPGFileService), index.size(), f);
 	// write version string after binary data
 	// has been written to disk.
+	fflush(f);
 	fsync(fileno(f));
-	fseek(f, sizeof(int), SEEK_SET);
-	fwrite("ENIGMA_EPG_V7", 13, 1, f);
-	fclose(f);
+	memcpy(header.version, "ENIGMA_EPG_V8", 13);
+	fseek(f, 0, SEEK_SET);
+	fwrite( &header, sizeof(header), 1, f);
+	fflush(f);
+	bool failed = ferror(f) || fsync(fileno(f)) < 0;
+	if (fclose(f) || failed)
+	{
+		eDebug("[EPGC] writing '%s' failed (%m)", EPGDATTMP);
+		unlink(EPGDATTMP);
+		return false;
+	}
+	eRecursiveWrLocker l(cache_lock);
+	if (eventData::isCacheCorrupt)
+	{
+		unlink(EPGDATTMP);
+		return false;
+	}
+	if (rename(EPGDATTMP, EPGDAT))
+	{
+		eDebug("[EPGC] failed to rename '%s' to '%s' (%m)", EPGDATTMP, EPGDAT);
+		unlink(EPGDATTMP);
+		return false;
+	}
+	m_journal_base = header;
+	std::string journal = m_filename + ".journal";
+	unlink(journal.c_str());
+	m_journal_size = 0;
+	if (mappedFile)
+		remapSaved(EPGDAT);
+	return true;
 }
 
 eEPGCache::channel_data::channel_data(eEPGCache *ml)
@@ -1425,7 +2202,7 @@ bool eEPGCache::channel_data::finishEPG()
 #ifdef ENABLE_FREESAT
 		cleanupFreeSat();
 #endif
-		singleLock l(cache->cache_lock);
+		eRecursiveWrLocker l(cache->cache_lock);
 		cache->channelLastUpdated[channel->getChannelID()] = ::time(0);
 		return true;
 	}
@@ -1989,13 +2766,20 @@ void eEPGCache::channel_data::readFreeSatScheduleOtherData( const __u8 *data)
 }
 #endif
 
+time_t eEPGCache::getChannelLastUpdated(const eDVBChannelID &chid)
+{
+	eRecursiveRdLocker l(cache_lock);
+	updateMap::iterator it = channelLastUpdated.find(chid);
+	return it != channelLastUpdated.end() ? it->second : 0;
+}
+
 RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, const eventData *&result, int direction)
 // if t == -1 we search the current event...
 {
 	uniqueEPGKey key(handleGroup(service));
 
 	// check if EPG for this service is ready...
-	eventCache::iterator It = eventDB.find( key );
+	eventCache::iterator It = findService( key );
 	if ( It != eventDB.end() && !It->second.first.empty() ) // entrys cached ?
 	{
 		if (t==-1)
@@ -2032,7 +2816,7 @@ RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, co
 
 RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, const eit_event_struct *&result, int direction)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eventData *data=0;
 	RESULT ret = lookupEventTime(service, t, data, direction);
 	if ( !ret && data )
@@ -2042,7 +2826,7 @@ RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, co
 
 RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, Event *& result, int direction)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eventData *data=0;
 	RESULT ret = lookupEventTime(service, t, data, direction);
 	if ( !ret && data )
@@ -2052,13 +2836,13 @@ RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, Ev
 
 RESULT eEPGCache::lookupEventTime(const eServiceReference &service, time_t t, ePtr<eServiceEvent> &result, int direction)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eventData *data=0;
 	RESULT ret = lookupEventTime(service, t, data, direction);
 	result = NULL;
 	if ( !ret && data )
 	{
-		Event ev((uint8_t*)data->get());
+		eEPGEvent ev(*data);
 		result = new eServiceEvent();
 		const eServiceReferenceDVB &ref = (const eServiceReferenceDVB&)service;
 		ret = result->parseFrom(&ev, (ref.getTransportStreamID().get()<<16)|ref.getOriginalNetworkID().get());
@@ -2070,7 +2854,7 @@ RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id,
 {
 	uniqueEPGKey key(handleGroup(service));
 
-	eventCache::iterator It = eventDB.find( key );
+	eventCache::iterator It = findService( key );
 	if ( It != eventDB.end() && !It->second.first.empty() ) // entrys cached?
 	{
 		eventMap::iterator i( It->second.first.find( event_id ));
@@ -2090,7 +2874,7 @@ RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id,
 
 RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id, const eit_event_struct *&result)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eventData *data=0;
 	RESULT ret = lookupEventId(service, event_id, data);
 	if ( !ret && data )
@@ -2100,7 +2884,7 @@ RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id,
 
 RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id, Event *& result)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eventData *data=0;
 	RESULT ret = lookupEventId(service, event_id, data);
 	if ( !ret && data )
@@ -2110,13 +2894,13 @@ RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id,
 
 RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id, ePtr<eServiceEvent> &result)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eventData *data=0;
 	RESULT ret = lookupEventId(service, event_id, data);
 	result = NULL;
 	if ( !ret && data )
 	{
-		Event ev((uint8_t*)data->get());
+		eEPGEvent ev(*data);
 		result = new eServiceEvent();
 		const eServiceReferenceDVB &ref = (const eServiceReferenceDVB&)service;
 		ret = result->parseFrom(&ev, (ref.getTransportStreamID().get()<<16)|ref.getOriginalNetworkID().get());
@@ -2126,11 +2910,11 @@ RESULT eEPGCache::lookupEventId(const eServiceReference &service, int event_id,
 
 RESULT eEPGCache::startTimeQuery(const eServiceReference &service, time_t begin, int minutes)
 {
-	singleLock s(cache_lock);
+	eRecursiveRdLocker s(cache_lock);
 	const eServiceReferenceDVB &ref = (const eServiceReferenceDVB&)handleGroup(service);
 	if (begin == -1)
 		begin = ::time(0);
-	eventCache::iterator It = eventDB.find(ref);
+	eventCache::iterator It = findService(ref);
 	if ( It != eventDB.end() && It->second.second.size() )
 	{
 		m_timemap_cursor = It->second.second.lower_bound(begin);
@@ -2194,7 +2978,7 @@ RESULT eEPGCache::getNextTimeEntry(ePtr<eServiceEvent> &result)
 {
 	if ( m_timemap_cursor != m_timemap_end )
 	{
-		Event ev((uint8_t*)m_timemap_cursor++->second->get());
+		eEPGEvent ev(*m_timemap_cursor++->second);
 		result = new eServiceEvent();
 		return result->parseFrom(&ev, currentQueryTsidOnid);
 	}
@@ -2501,12 +3285,12 @@ PyObject *eEPGCache::lookupEvent(ePyObject list, ePyObject convertFunc)
 			}
 			if (minutes)
 			{
-				singleLock s(cache_lock);
+				eRecursiveRdLocker s(cache_lock);
 				if (!startTimeQuery(ref, stime, minutes))
 				{
 					while ( m_timemap_cursor != m_timemap_end )
 					{
-						Event ev((uint8_t*)m_timemap_cursor++->second->get());
+						eEPGEvent ev(*m_timemap_cursor++->second);
 						eServiceEvent evt;
 						evt.parseFrom(&ev, currentQueryTsidOnid);
 						if (handleEvent(&evt, dest_list, argstring, argcount, service, nowTime, service_name, convertFunc, convertFuncArgs))
@@ -2522,7 +3306,7 @@ PyObject *eEPGCache::lookupEvent(ePyObject list, ePyObject convertFunc)
 				const eventData *ev_data=0;
 				if (stime)
 				{
-					singleLock s(cache_lock);
+					eRecursiveRdLocker s(cache_lock);
 					if (type == 2)
 						lookupEventId(ref, event_id, ev_data);
 					else
@@ -2530,7 +3314,7 @@ PyObject *eEPGCache::lookupEvent(ePyObject list, ePyObject convertFunc)
 					if (ev_data)
 					{
 						const eServiceReferenceDVB &dref = (const eServiceReferenceDVB&)ref;
-						Event ev((uint8_t*)ev_data->get());
+						eEPGEvent ev(*ev_data);
 						evt.parseFrom(&ev, (dref.getTransportStreamID().get()<<16)|dref.getOriginalNetworkID().get());
 					}
 				}
@@ -2557,6 +3341,142 @@ skip_entry:
 	return dest_list;
 }
 
+	/* the title in the EPG language, preferred like eServiceEvent::parseFrom does */
+static void gridTitle(const eventData *evt, int tsidonid, std::string &title)
+{
+	const std::string &language = eServiceEvent::getEPGLanguage();
+	const std::string &alternative = eServiceEvent::getEPGLanguageAlternative();
+	const __u8 *best = 0;
+	std::string best_cc;
+	int best_rank = 4;
+	for (int i = 0; i < evt->getDescriptorCount() && best_rank; ++i)
+	{
+		const __u8 *descr = evt->getDescriptor(i);
+		if (!descr || descr[0] != SHORT_EVENT_DESCRIPTOR || descr[1] < 5 || descr[5] > descr[1] - 5)
+			continue;
+		std::string cc((const char*)descr + 2, 3);
+		std::transform(cc.begin(), cc.end(), cc.begin(), tolower);
+		int rank = 3;
+		if (language != "---" && language.find(cc) != std::string::npos)
+			rank = 0;
+		else if (alternative != "---" && alternative.find(cc) != std::string::npos)
+			rank = 1;
+		else if (cc == "eng")
+			rank = 2;
+		if (rank < best_rank)
+		{
+			best = descr;
+			best_cc = cc;
+			best_rank = rank;
+		}
+	}
+	if (!best)
+	{
+		title.clear();
+		return;
+	}
+	int table = encodingHandler.getCountryCodeDefaultMapping(best_cc);
+	title = replace_all(replace_all(convertDVBUTF8(best + 6, best[5], table, tsidonid), "\n", " "), "\t", " ");
+}
+
+// the grid screens ask for dozens of services over hours at once, building
+// a tuple per event for that is what made paging them slow. Here the events
+// go into flat records and the titles into one string table, the screen
+// unpacks only what it draws.
+PyObject *eEPGCache::lookupEventGrid(ePyObject services, time_t begin, int minutes)
+{
+	if (!PyList_Check(services))
+	{
+		PyErr_SetString(PyExc_StandardError,
+			"type error");
+		eDebug("no list");
+		return NULL;
+	}
+	if (begin == -1)
+		begin = ::time(0);
+	time_t end = begin + minutes * 60;
+
+	int count = PyList_Size(services);
+	std::vector<eEPGGridService> index(count + 1);
+	std::vector<eEPGGridEvent> events;
+	std::string strings, title;
+	eServiceCenterPtr service_center;
+	eServiceCenter::getPrivInstance(service_center);
+
+	for (int i = 0; i < count; ++i)
+	{
+		index[i].first = events.size();
+		std::string name;
+		ePyObject item = PyList_GET_ITEM(services, i); // borrowed reference!
+		if (PyString_Check(item))
+		{
+			eServiceReference ref(handleGroup(eServiceReference(PyString_AS_STRING(item))));
+			ePtr<iStaticServiceInformation> sptr;
+			if (service_center && !service_center->info(ref, sptr) && sptr)
+			{
+				sptr->getName(ref, name);
+				name = buildShortName(name);
+			}
+			if (ref.type == eServiceReference::idDVB || ref.type == eServiceReference::idServiceMP3)
+			{
+				// redirect subservice querys to parent service
+				eServiceReferenceDVB &dvb_ref = (eServiceReferenceDVB&)ref;
+				if (dvb_ref.getParentTransportStreamID().get()) // linkage subservice
+				{
+					dvb_ref.setTransportStreamID( dvb_ref.getParentTransportStreamID() );
+					dvb_ref.setServiceID( dvb_ref.getParentServiceID() );
+					dvb_ref.setParentTransportStreamID(eTransportStreamID(0));
+					dvb_ref.setParentServiceID(eServiceID(0));
+				}
+				int tsidonid = (dvb_ref.getTransportStreamID().get()<<16) | dvb_ref.getOriginalNetworkID().get();
+
+				eRecursiveRdLocker s(cache_lock);
+				eventCache::iterator It = findService(dvb_ref);
+				if (It != eventDB.end())
+				{
+					timeMap &times = It->second.second;
+					timeMap::iterator t = times.lower_bound(begin);
+					if (t != times.begin())
+					{
+						timeMap::iterator prev = t;
+						--prev;
+						if (prev->first + prev->second->getDuration() > begin)
+							t = prev;
+					}
+					for (; t != times.end() && t->first < end; ++t)
+					{
+						eventData *evt = t->second;
+						gridTitle(evt, tsidonid, title);
+						eEPGGridEvent rec;
+						rec.begin = t->first;
+						rec.duration = evt->getDuration();
+						rec.title = strings.size();
+						rec.title_len = std::min(title.size(), (size_t)0xFFFF);
+						rec.event_id = evt->getEventID();
+						strings.append(title, 0, rec.title_len);
+						events.push_back(rec);
+					}
+				}
+			}
+			else
+				eDebug("service reference for epg query is not valid");
+		}
+		if (name.empty())
+			name = "<n/a>";
+		index[i].name = strings.size();
+		index[i].name_len = name.size();
+		strings += name;
+	}
+	index[count].first = events.size();
+	index[count].name = index[count].name_len = 0;
+
+	ePyObject result = PyTuple_New(3);
+	PyTuple_SET_ITEM(result, 0, PyString_FromStringAndSize((const char*)&index[0], index.size() * sizeof(eEPGGridService)));
+	PyTuple_SET_ITEM(result, 1, PyString_FromStringAndSize(events.empty() ? "" : (const char*)&events[0], events.size() * sizeof(eEPGGridEvent)));
+	PyTuple_SET_ITEM(result, 2, PyString_FromStringAndSize(strings.data(), strings.size()));
+	return result;
+}
+
 static void fill_eit_start(eit_event_struct *evt, time_t t)
 {
     tm *time = gmtime(&t);
@@ -2947,7 +3867,7 @@ PyObject *eEPGCache::search(ePyObject arg)
 					if (ref.valid())
 					{
 						eventid = PyLong_AsLong(PyTuple_GET_ITEM(arg, 4));
-						singleLock s(cache_lock);
+						eRecursiveRdLocker s(cache_lock);
 						const eventData *evData = 0;
 						lookupEventId(ref, eventid, evData);
 						if (evData)
@@ -2959,11 +3879,9 @@ PyObject *eEPGCache::search(ePyObject arg)
 							while(tmp>3)
 							{
 								__u32 crc = *p++;
-								descriptorMap::iterator it =
-									eventData::descriptors.find(crc);
-								if (it != eventData::descriptors.end())
+								const __u8 *descr_data = eventData::descriptors.find(crc);
+								if (descr_data)
 								{
-									__u8 *descr_data = it->second.second;
 									switch(descr_data[0])
 									{
 									case 0x4D ... 0x4E:
@@ -3016,23 +3934,38 @@ PyObject *eEPGCache::search(ePyObject arg)
 							eDebug("lookup events, title starting with '%s' (%s)", str, casetype?"ignore case":"case sensitive");
 							break;
 					}
-					singleLock s(cache_lock);
+					eRecursiveRdLocker s(cache_lock);
 					std::string title;
-					for (descriptorMap::iterator it(eventData::descriptors.begin());
-						it != eventData::descriptors.end() && descridx < 511; ++it)
+					// the title index narrows the titles down to those sharing all
+					// trigrams with str, only for very short texts all are checked
+					std::vector<__u32> candidates;
+					bool indexed;
+					{
+						singleLock l(load_lock);
+						indexed = eventData::descriptors.findTitles(str, textlen, candidates);
+					}
+					unsigned int count = indexed ? candidates.size() : eventData::descriptors.slots();
+					for (unsigned int i = 0; i < count && descridx < 511; ++i)
 					{
-						__u8 *data = it->second.second;
-						if ( data[0] == 0x4D ) // short event descriptor
+						__u32 crc;
+						const __u8 *data;
+						if (indexed)
 						{
-							const char *titleptr = (const char*)&data[6];
-							int title_len = data[5];
-							if (data[6] < 0x20)
-							{
-								/* custom encoding */
-								title = convertDVBUTF8((unsigned char*)titleptr, title_len, 0x40, 0);
-								titleptr = title.data();
-								title_len = title.length();
-							}
+							crc = candidates[i];
+							data = eventData::descriptors.find(crc);
+						}
+						else
+						{
+							const eEPGDescriptor *descriptor = eventData::descriptors.slot(i);
+							if (!descriptor)
+								continue;
+							crc = descriptor->crc;
+							data = descriptor->data;
+						}
+						if ( data && data[0] == 0x4D ) // short event descriptor
+						{
+							int title_len;
+							const char *titleptr = eEPGDescriptorPool::title(data, title_len, title);
 							if (title_len < textlen)
 								/*Doesn't fit, so cannot match anything */
 								continue;
@@ -3053,7 +3986,7 @@ PyObject *eEPGCache::search(ePyObject arg)
 								{
 									if (!strncasecmp(titleptr, str, textlen))
 									{
-										descr[++descridx] = it->first;
+										descr[++descridx] = crc;
 										break;
 									}
 									title_len--;
@@ -3066,7 +3999,7 @@ PyObject *eEPGCache::search(ePyObject arg)
 								{
 									if (!memcmp(titleptr, str, textlen))
 									{
-										descr[++descridx] = it->first;
+										descr[++descridx] = crc;
 										break;
 									}
 									title_len--;
@@ -3115,7 +4048,25 @@ PyObject *eEPGCache::search(ePyObject arg)
 		// ref is only valid in SIMILAR_BROADCASTING_SEARCH
 		// in this case we start searching with the base service
 		bool first = ref.valid() ? true : false;
-		singleLock s(cache_lock);
+		// sorted for the binary searches below
+		std::sort(descr, descr + descridx + 1);
+		eRecursiveRdLocker s(cache_lock);
+		// searching goes through all services, of the mapped ones only those
+		// using one of the descriptors need their events in memory. No other
+		// reader may load a service while we walk them
+		singleLock l(load_lock);
+		std::vector<uniqueEPGKey> hits;
+		for (mappedServiceMap::iterator it(mappedServices.begin()); it != mappedServices.end(); ++it)
+		{
+			if (mappedServiceUses(it->second, descr, descridx + 1))
+				hits.push_back(it->first);
+		}
+		for (std::vector<uniqueEPGKey>::iterator i(hits.begin()); i != hits.end(); ++i)
+		{
+			mappedServiceMap::iterator it = mappedServices.find(*i);
+			if (it != mappedServices.end())
+				loadMappedService(it);
+		}
 		eventCache::iterator cit(ref.valid() ? eventDB.find(ref) : eventDB.begin());
 		while(cit != eventDB.end() && maxcount)
 		{
@@ -3143,17 +4094,13 @@ PyObject *eEPGCache::search(ePyObject arg)
 				while(tmp>3)
 				{
 					__u32 crc32 = *p++;
-					for ( int i=0; i <= descridx; ++i)
+					if (std::binary_search(descr, descr + descridx + 1, crc32))  // found...
 					{
-						if (descr[i] == crc32)  // found...
+						++cnt;
+						if (querytype)
 						{
-							++cnt;
-							if (querytype)
-							{
-								/* we need only one match, when we're not looking for similar broadcasting events */
-								tmp = 0;
-								break;
-							}
+							/* we need only one match, when we're not looking for similar broadcasting events */
+							break;
 						}
 					}
 					tmp-=4;
@@ -3181,7 +4128,7 @@ PyObject *eEPGCache::search(ePyObject arg)
 								else
 								{
 									const eServiceReferenceDVB &dref = (const eServiceReferenceDVB&)ref;
-									Event ev((uint8_t*)ev_data->get());
+									eEPGEvent ev(*ev_data);
 									ptr.parseFrom(&ev, (dref.getTransportStreamID().get()<<16)|dref.getOriginalNetworkID().get());
 								}
 							}
@@ -3403,10 +4350,14 @@ struct less_datetime
 void eEPGCache::privateSectionRead(const uniqueEPGKey &current_service, const __u8 *data)
 {
 	contentMap &content_time_table = content_time_tables[current_service];
-	singleLock s(cache_lock);
+	eRecursiveWrLocker s(cache_lock);
+	// the journal does not cover the private tables
+	m_journal_full = true;
+	m_journal.clear();
 	std::map< date_time, std::list<uniqueEPGKey>, less_datetime > start_times;
-	eventMap &evMap = eventDB[current_service].first;
-	timeMap &tmMap = eventDB[current_service].second;
+	std::pair<eventMap,timeMap> &servicemap = getService(current_service);
+	eventMap &evMap = servicemap.first;
+	timeMap &tmMap = servicemap.second;
 	int ptr=8;
 	int content_id = data[ptr++] << 24;
 	content_id |= data[ptr++] << 16;
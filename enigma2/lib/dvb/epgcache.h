@@ -29,6 +29,7 @@
 #include <lib/dvb/idvb.h>
 #include <lib/dvb/demux.h>
 #include <lib/dvb/dvbtime.h>
+#include <lib/dvb/epgstore.h>
 #include <lib/base/ebase.h>
 #include <lib/base/thread.h>
 #include <lib/base/message.h>
@@ -92,9 +93,9 @@ struct uniqueEPGKey
 };
 
 //eventMap is sorted by event_id
-#define eventMap std::map<__u16, eventData*>
+#define eventMap eEPGIndex<__u16, eventData*>
 //timeMap is sorted by beginTime
-#define timeMap std::map<time_t, eventData*>
+#define timeMap eEPGIndex<time_t, eventData*>
 
 #define channelMapIterator std::map<iDVBChannel*, channel_data*>::iterator
 #define updateMap std::map<eDVBChannelID, time_t>
@@ -110,6 +111,7 @@ struct hash_uniqueEPGKey
 #define tidMap std::set<__u32>
 #if 0 
 	typedef std::unordered_map<uniqueEPGKey, std::pair<eventMap, timeMap>, hash_uniqueEPGKey, uniqueEPGKey::equal> eventCache;
+	typedef std::unordered_map<uniqueEPGKey, const eEPGFileService*, hash_uniqueEPGKey, uniqueEPGKey::equal> mappedServiceMap;
 	#ifdef ENABLE_PRIVATE_EPG
 		typedef std::unordered_map<time_t, std::pair<time_t, __u16> > contentTimeMap;
 		typedef std::unordered_map<int, contentTimeMap > contentMap;
@@ -117,6 +119,7 @@ struct hash_uniqueEPGKey
 	#endif
 #else
 	typedef __gnu_cxx::hash_map<uniqueEPGKey, std::pair<eventMap, timeMap>, hash_uniqueEPGKey, uniqueEPGKey::equal> eventCache;
+	typedef __gnu_cxx::hash_map<uniqueEPGKey, const eEPGFileService*, hash_uniqueEPGKey, uniqueEPGKey::equal> mappedServiceMap;
 	#ifdef ENABLE_PRIVATE_EPG
 		typedef __gnu_cxx::hash_map<time_t, std::pair<time_t, __u16> > contentTimeMap;
 		typedef __gnu_cxx::hash_map<int, contentTimeMap > contentMap;
@@ -124,27 +127,37 @@ struct hash_uniqueEPGKey
 	#endif
 #endif
 
-#define descriptorPair std::pair<int,__u8*>
-#define descriptorMap std::map<__u32, descriptorPair >
-
 class eventData
 {
 	friend class eEPGCache;
+	friend class eEPGEvent;
 private:
 	__u8* EITdata;
 	__u8 ByteSize;
 	__u8 type;
-	static descriptorMap descriptors;
-	static __u8 data[4108];
+	static eEPGDescriptorPool descriptors;
+	static __thread __u8 data[4108];
 	static int CacheSize;
 	static bool isCacheCorrupt;
-	static void load(FILE *);
-	static void save(FILE *);
 	static void cacheCorrupt(const char* context);
 public:
 	eventData(const eit_event_struct* e = NULL, int size = 0, int type = 0, int tsidonid = 0);
 	~eventData();
+	static void *operator new(size_t size) { return eEPGSlab::alloc(size); }
+	static void operator delete(void *p) { eEPGSlab::release(p, sizeof(eventData)); }
+		/* puts the event together as EIT bytes in buf, 4108 bytes at most */
+	const eit_event_struct* get(__u8 *buf) const;
+		/* the same in a buffer of the calling thread, valid until its next call */
 	const eit_event_struct* get() const;
+		/* the descriptors in place, valid while the cache lock is held,
+		   NULL for one missing in the cache */
+	int getDescriptorCount() const { return (ByteSize - 10) / 4; }
+	const __u8 *getDescriptor(int i) const
+	{
+		__u32 crc;
+		memcpy(&crc, EITdata + 10 + i * 4, 4);
+		return descriptors.find(crc);
+	}
 	operator const eit_event_struct*() const
 	{
 		return get();
@@ -162,6 +175,40 @@ public:
 		return fromBCD(EITdata[7])*3600+fromBCD(EITdata[8])*60+fromBCD(EITdata[9]);
 	}
 };
+
+/*
+ * An Event parsed straight from the descriptors of a cached event, without
+ * putting its EIT bytes together first. Build it with the cache lock held,
+ * the Event is a copy and outlives the lock.
+ */
+class eEPGEvent: public Event
+{
+public:
+	eEPGEvent(const eventData &data);
+};
+
+/*
+ * lookupEventGrid returns (services, events, strings), the first two are
+ * arrays of these records in native byte order, the last the UTF-8 names
+ * and titles they point into. services has one record more than the query,
+ * its first ends the events of the last service. GraphMultiEpg.py mirrors
+ * the layout.
+ */
+struct eEPGGridService
+{
+	__u32 first;		// index of its first event
+	__u32 name;		// offset of the short service name in strings
+	__u32 name_len;
+};
+
+struct eEPGGridEvent
+{
+	__u32 begin;
+	__u32 duration;
+	__u32 title;		// offset in strings
+	__u16 title_len;
+	__u16 event_id;
+};
 #endif
 
 #ifdef ENABLE_FREESAT
@@ -255,7 +302,14 @@ class eEPGCache: public eMainloop, private eThread, public Object
 		void abortEPG();
 		void abortNonAvail();
 	};
-	bool FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t TM, int duration, const timeMap::iterator &tm_it, const uniqueEPGKey &service);
+	// writes epg.dat in the background
+	struct save_thread: public eThread
+	{
+		eEPGCache *cache;
+		save_thread(eEPGCache *cache): cache(cache) {}
+		void thread();
+	};
+	bool FixOverlapping(std::pair<eventMap,timeMap> &servicemap, time_t TM, int duration, timeMap::iterator tm_it, const uniqueEPGKey &service);
 public:
 	struct Message
 	{
@@ -308,10 +362,40 @@ private:
 
 	std::vector<int> onid_blacklist;
 	eventCache eventDB;
+	// services of the mapped epg.dat not asked for yet, their events stay in the file
+	mappedServiceMap mappedServices;
+	ePtr<eEPGMappedFile> mappedFile;
+	// descriptor references of events loadEvents left out as over, a
+	// reader must not change the pool, the cleanLoop releases them
+	std::vector<__u32> expiredDescriptors;
 	updateMap channelLastUpdated;
-	static pthread_mutex_t cache_lock, channel_map_lock;
+	/*
+	 * The lookups take cache_lock for reading and run side by side, the
+	 * EPG thread and whatever else changes the cache takes it for writing.
+	 * Readers still load mapped services and build the title index, they
+	 * serialise that on load_lock. The events of a mapped service go into
+	 * the eventDB entry loadMapped made for it, so eventDB itself stays
+	 * unchanged under the readers.
+	 */
+	static eRecursiveRdWrLock cache_lock;
+	static pthread_mutex_t channel_map_lock, load_lock;
 	std::string m_filename;
 	bool m_running;
+	save_thread m_saver;
+
+	// changes not in epg.dat yet, see epgstore.h
+	enum { JOURNAL_ADD, JOURNAL_REMOVE, JOURNAL_FLUSH };
+	std::vector<__u8> m_journal;	// not written to the journal file yet
+	bool m_journal_full;		// the next save has to write the whole epg.dat
+	eEPGFileHeader m_journal_base;	// epg.dat on disk, magic 0 if there is none
+	size_t m_journal_size;		// of the journal file
+	void journalRecord(int op, const uniqueEPGKey &key, const __u8 *data, int len);
+	void journalEvent(const uniqueEPGKey &key, const eventData *evt, const eventData *old);
+	void journalRemove(const uniqueEPGKey &key, __u16 event_id);
+	void journalFlush(const uniqueEPGKey &key);
+	bool appendJournal();
+	void replayJournal();
+	void removeEvent(std::pair<eventMap,timeMap> &servicemap, eventData *evt);
 
 #ifdef ENABLE_PRIVATE_EPG
 	contentMaps content_time_tables;
@@ -319,6 +403,18 @@ private:
 
 	void thread();  // thread function
 
+	bool writeEPG();
+	bool loadMapped(FILE *f);
+	void loadEvents(const uniqueEPGKey &key, const __u8 *data, const __u8 *end, unsigned int events, const char *context);
+	void remapSaved(const char *filename);
+	void loadMappedService(mappedServiceMap::iterator it);
+	void dropMappedService(mappedServiceMap::iterator it);
+	bool mappedServiceUses(const eEPGFileService *service, const __u32 *crcs, int count);
+	void checkMappedFile();
+	// all lookups of a single service go through these, they bring in mapped services
+	eventCache::iterator findService(const uniqueEPGKey &key);
+	std::pair<eventMap,timeMap> &getService(const uniqueEPGKey &key);
+
 #ifdef ENABLE_PRIVATE_EPG
 	void privateSectionRead(const uniqueEPGKey &, const __u8 *);
 #endif
@@ -353,6 +449,8 @@ public:
 #else
 	void PMTready(eDVBServicePMTHandler *pmthandler) {}
 #endif
+		// when the schedule of the transponder was read completely, 0 if never
+	time_t getChannelLastUpdated(const eDVBChannelID &chid);
 
 #endif
 	// must be called once!
@@ -397,6 +495,9 @@ public:
 		NO_CASE_CHECK
 	};
 	PyObject *lookupEvent(SWIG_PYOBJECT(ePyObject) list, SWIG_PYOBJECT(ePyObject) convertFunc=(PyObject*)0);
+	// the events of a list of service reference strings from begin on for minutes,
+	// packed for the EPG grids as a tuple of three strings, see eEPGGridEvent
+	PyObject *lookupEventGrid(SWIG_PYOBJECT(ePyObject) services, time_t begin, int minutes);
 	PyObject *search(SWIG_PYOBJECT(ePyObject));
 
 	// eServiceEvent are parsed epg events.. it's safe to use them after cache unlock
@@ -434,12 +535,12 @@ public:
 #ifndef SWIG
 inline void eEPGCache::Lock()
 {
-	pthread_mutex_lock(&cache_lock);
+	cache_lock.RdLock();
 }
 
 inline void eEPGCache::Unlock()
 {
-	pthread_mutex_unlock(&cache_lock);
+	cache_lock.Unlock();
 }
 #endif
 
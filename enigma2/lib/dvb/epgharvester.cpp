@@ -0,0 +1,152 @@
+#include <lib/dvb/epgharvester.h>
+#include <lib/dvb/db.h>
+#include <lib/dvb/dvb.h>
+#include <lib/dvb/dvbtime.h>
+#include <lib/dvb/epgcache.h>
+#include <lib/base/eerror.h>
+#include <lib/base/nconfig.h>
+#include <algorithm>
+#include <set>
+
+#define HARVEST_CHECK_INTERVAL 10000	// 10 sek, looks at the running jobs and for idle tuners
+#define HARVEST_MAX_DWELL 600		// 10 min on one transponder at most
+#define HARVEST_REFRESH 14400		// transponders updated in the last 4 hours are left alone
+#define HARVEST_RETRY 3600		// a transponder that did not complete waits an hour
+#define HARVEST_BACKOFF 120		// after giving the tuners back
+
+eEPGHarvester *eEPGHarvester::instance;
+
+DEFINE_REF(eEPGHarvester);
+
+eEPGHarvester::eEPGHarvester()
+	:m_paused_until(0), m_timer(eTimer::create(eApp))
+{
+	instance = this;
+	CONNECT(m_timer->timeout, eEPGHarvester::check);
+	m_timer->start(HARVEST_CHECK_INTERVAL, false);
+}
+
+eEPGHarvester::~eEPGHarvester()
+{
+	m_release_conn = 0;
+	m_jobs.clear();
+	instance = 0;
+}
+
+void eEPGHarvester::releaseChannels()
+{
+	if (m_jobs.empty())
+		return;
+	eDebug("[eEPGHarvester] tuners needed, release %zd channels", m_jobs.size());
+		/* the channels go away right here, so the allocation that asked finds their frontends free */
+	m_jobs.clear();
+	m_paused_until = ::time(0) + HARVEST_BACKOFF;
+}
+
+void eEPGHarvester::finishJobs(time_t now)
+{
+	eEPGCache *cache = eEPGCache::getInstance();
+	for (std::list<job>::iterator it = m_jobs.begin(); it != m_jobs.end(); )
+	{
+		int state = iDVBChannel::state_failed;
+		it->channel->getState(state);
+		const char *reason = 0;
+		if (cache && cache->getChannelLastUpdated(it->chid) >= it->started)
+			reason = "complete";
+		else if (state == iDVBChannel::state_failed)
+			reason = "tune failed";
+		else if (now - it->started > HARVEST_MAX_DWELL)
+			reason = "timed out";
+		if (reason)
+		{
+			eDebug("[eEPGHarvester] %04x:%04x %s after %d s", it->chid.transport_stream_id.get(),
+				it->chid.original_network_id.get(), reason, (int)(now - it->started));
+			it = m_jobs.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void eEPGHarvester::getCandidates(time_t now, std::vector<candidate> &candidates)
+{
+	eDVBDB *db = eDVBDB::getInstance();
+	eEPGCache *cache = eEPGCache::getInstance();
+	if (!db || !cache)
+		return;
+
+	std::vector<eDVBChannelID> chids[3];
+	db->getBouquetChannels(chids[0], true);
+	db->getBouquetChannels(chids[1], false);
+	db->getChannels(chids[2]);
+
+	std::set<eDVBChannelID> seen;
+	for (std::list<job>::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+		seen.insert(it->chid);
+	for (int group = 0; group < 3; ++group)
+	{
+		for (unsigned int i = 0; i < chids[group].size(); ++i)
+		{
+			const eDVBChannelID &chid = chids[group][i];
+			if (!seen.insert(chid).second)
+				continue;
+			std::map<eDVBChannelID, time_t>::iterator tried = m_tried.find(chid);
+			if (tried != m_tried.end() && now - tried->second < HARVEST_RETRY)
+				continue;
+			time_t updated = cache->getChannelLastUpdated(chid);
+			if (now - updated < HARVEST_REFRESH)
+				continue;
+			candidate c;
+			c.group = group;
+			c.updated = updated;
+			c.order = i;
+			c.chid = chid;
+			candidates.push_back(c);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+}
+
+void eEPGHarvester::check()
+{
+	time_t now = ::time(0);
+	finishJobs(now);
+
+	if (!eConfigManager::getConfigBoolValue("config.epg.harvest", false))
+	{
+		m_jobs.clear();
+		return;
+	}
+
+	int tuners = eConfigManager::getConfigIntValue("config.epg.harvest_tuners", 2);
+	eDVBLocalTimeHandler *time_handler = eDVBLocalTimeHandler::getInstance();
+	if ((int)m_jobs.size() >= tuners || now < m_paused_until || !time_handler || !time_handler->ready())
+		return;
+
+	ePtr<eDVBResourceManager> res_mgr;
+	if (eDVBResourceManager::getInstance(res_mgr))
+		return;
+	if (!m_release_conn)
+		res_mgr->connectReleaseBackgroundChannels(slot(*this, &eEPGHarvester::releaseChannels), m_release_conn);
+
+	std::vector<candidate> candidates;
+	getCandidates(now, candidates);
+		/* tuners for other delivery systems may still be free when one says busy,
+		   so go on through the list, trying is cheap */
+	for (std::vector<candidate>::iterator it = candidates.begin(); it != candidates.end() && (int)m_jobs.size() < tuners; ++it)
+	{
+			/* allocated in place, a copy of the use pointer would pass through state_last_instance */
+		m_jobs.push_back(job());
+		job &j = m_jobs.back();
+		if (res_mgr->allocateBackgroundChannel(it->chid, j.channel))
+		{
+			m_jobs.pop_back();
+			continue;
+		}
+		eDebug("[eEPGHarvester] read EPG on %04x:%04x, last updated %d min ago", it->chid.transport_stream_id.get(),
+			it->chid.original_network_id.get(), it->updated ? (int)((now - it->updated) / 60) : -1);
+		j.chid = it->chid;
+		j.started = now;
+		m_tried[it->chid] = now;
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef __lib_dvb_epgharvester_h
+#define __lib_dvb_epgharvester_h
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <lib/base/ebase.h>
+#include <lib/base/object.h>
+#include <lib/dvb/idvb.h>
+
+/*
+ * Keeps the EPG of transponders nobody watches up to date with the tuners
+ * that are idle. The harvester takes them through
+ * eDVBResourceManager::allocateBackgroundChannel, the EPG cache attaches to
+ * those channels like to any other and reads the schedules. A transponder is
+ * done once the cache reports it complete in channelLastUpdated, or after
+ * HARVEST_MAX_DWELL. Then its tuner moves on to the next transponder:
+ * first those of the favourites, then those of the other bouquets, then the
+ * rest of the channel list, the least recently updated ones first within
+ * each group.
+ *
+ * As soon as an allocation finds no free tuner the resource manager asks
+ * for the tuners back, and the harvester drops all its channels at once.
+ *
+ * config.epg.harvest turns it on, config.epg.harvest_tuners limits how many
+ * tuners it uses at the same time.
+ */
+class eEPGHarvester: public iObject, public Object
+{
+	DECLARE_REF(eEPGHarvester);
+
+	struct job
+	{
+		eDVBChannelID chid;
+		eUsePtr<iDVBChannel> channel;
+		time_t started;
+	};
+	struct candidate
+	{
+		int group;		/* 0 favourites, 1 bouquets, 2 others */
+		time_t updated;
+		int order;		/* position in the bouquets or the channel list */
+		eDVBChannelID chid;
+		bool operator<(const candidate &c) const
+		{
+			if (group != c.group)
+				return group < c.group;
+			if (updated != c.updated)
+				return updated < c.updated;
+			return order < c.order;
+		}
+	};
+
+	static eEPGHarvester *instance;
+
+	std::list<job> m_jobs;
+	std::map<eDVBChannelID, time_t> m_tried;	/* last start per transponder */
+	time_t m_paused_until;
+	ePtr<eTimer> m_timer;
+	ePtr<eConnection> m_release_conn;
+
+	void check();
+	void finishJobs(time_t now);
+	void getCandidates(time_t now, std::vector<candidate> &candidates);
+	void releaseChannels();
+public:
+	eEPGHarvester();
+	~eEPGHarvester();
+	static eEPGHarvester *getInstance() { return instance; }
+};
+
+#endif
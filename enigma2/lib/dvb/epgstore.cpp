@@ -0,0 +1,523 @@
+#include <lib/dvb/epgstore.h>
+#include <lib/base/eerror.h>
+#include <lib/base/estring.h>
+#include <ext/hash_map>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SLAB_PAGE_SIZE		(64 * 1024)
+#define SLAB_GRANULE		8
+	/* bigger blocks are rare (long extended event texts), they use the heap */
+#define SLAB_MAX_BLOCK		512
+#define SLAB_CLASSES		(SLAB_MAX_BLOCK / SLAB_GRANULE)
+
+struct eEPGSlabPage
+{
+	eEPGSlabPage *prev, *next;	/* pages of this class with free blocks */
+	void *free;			/* blocks given back */
+	unsigned char *unused;		/* start of the part never handed out */
+	unsigned int used;
+	unsigned int cls;
+	bool listed;
+};
+
+#define SLAB_HEADER_SIZE	((sizeof(eEPGSlabPage) + 15) & ~15)
+
+static eEPGSlabPage *partial[SLAB_CLASSES];
+static size_t pages;
+
+static inline size_t blockSize(unsigned int cls)
+{
+	return (cls + 1) * SLAB_GRANULE;
+}
+
+static void unlinkPage(eEPGSlabPage *page)
+{
+	if (page->prev)
+		page->prev->next = page->next;
+	else
+		partial[page->cls] = page->next;
+	if (page->next)
+		page->next->prev = page->prev;
+	page->prev = page->next = NULL;
+	page->listed = false;
+}
+
+static void linkPage(eEPGSlabPage *page)
+{
+	page->prev = NULL;
+	page->next = partial[page->cls];
+	if (page->next)
+		page->next->prev = page;
+	partial[page->cls] = page;
+	page->listed = true;
+}
+
+static void freePage(eEPGSlabPage *page)
+{
+	unlinkPage(page);
+	::free(page);
+	--pages;
+}
+
+void *eEPGSlab::alloc(size_t size)
+{
+	if (!size)
+		size = 1;
+	if (size > SLAB_MAX_BLOCK)
+		return ::operator new(size);
+
+	unsigned int cls = (size - 1) / SLAB_GRANULE;
+	size_t bsize = blockSize(cls);
+	eEPGSlabPage *page = partial[cls];
+	if (!page)
+	{
+		void *mem = NULL;
+		if (posix_memalign(&mem, SLAB_PAGE_SIZE, SLAB_PAGE_SIZE))
+			eFatal("[eEPGSlab] out of memory");
+		page = (eEPGSlabPage*)mem;
+		page->free = NULL;
+		page->unused = (unsigned char*)mem + SLAB_HEADER_SIZE;
+		page->used = 0;
+		page->cls = cls;
+		linkPage(page);
+		++pages;
+	}
+
+	void *block;
+	if (page->free)
+	{
+		block = page->free;
+		page->free = *(void**)block;
+	}
+	else
+	{
+		block = page->unused;
+		page->unused += bsize;
+	}
+	++page->used;
+	if (!page->free && page->unused + bsize > (unsigned char*)page + SLAB_PAGE_SIZE)
+		unlinkPage(page);
+	return block;
+}
+
+void eEPGSlab::release(void *p, size_t size)
+{
+	if (!p)
+		return;
+	if (!size)
+		size = 1;
+	if (size > SLAB_MAX_BLOCK)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	eEPGSlabPage *page = (eEPGSlabPage*)((uintptr_t)p & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+	*(void**)p = page->free;
+	page->free = p;
+	if (!page->listed)
+		linkPage(page);
+	if (!--page->used)
+	{
+			/* keep the last page of a class as a spare, trim() returns it */
+		if (partial[page->cls] != page || page->next)
+			freePage(page);
+	}
+}
+
+void eEPGSlab::trim()
+{
+	for (unsigned int cls = 0; cls < SLAB_CLASSES; ++cls)
+	{
+		eEPGSlabPage *page = partial[cls];
+		while (page)
+		{
+			eEPGSlabPage *next = page->next;
+			if (!page->used)
+				freePage(page);
+			page = next;
+		}
+	}
+}
+
+size_t eEPGSlab::pageCount()
+{
+	return pages;
+}
+
+DEFINE_REF(eEPGMappedFile);
+
+eEPGMappedFile::eEPGMappedFile()
+	:m_data(NULL), m_size(0)
+{
+}
+
+eEPGMappedFile::~eEPGMappedFile()
+{
+	unmap();
+}
+
+bool eEPGMappedFile::map(int fd)
+{
+	unmap();
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0)
+		return false;
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		eDebug("[eEPGMappedFile] mmap failed: %m");
+		return false;
+	}
+	m_data = (const __u8*)data;
+	m_size = st.st_size;
+	return true;
+}
+
+void eEPGMappedFile::unmap()
+{
+	if (m_data)
+		munmap((void*)m_data, m_size);
+	m_data = NULL;
+	m_size = 0;
+}
+
+/*
+ * Trigrams of the ASCII lower cased titles, each with the crcs of the titles
+ * containing it. Released descriptors are not taken out of the lists, the
+ * caller checks every crc found anyway. Once those stale entries outnumber
+ * the live ones the index is dropped and the next search builds it anew.
+ */
+class eEPGTitleIndex
+{
+	typedef __gnu_cxx::hash_map<__u32, std::vector<__u32> > postingMap;
+	postingMap m_postings;
+public:
+	unsigned int live, stale;
+
+	eEPGTitleIndex(): live(0), stale(0) { }
+	static void trigrams(const char *text, int len, std::vector<__u32> &result);
+	void add(__u32 crc, const __u8 *descr);
+	bool find(const char *text, int len, std::vector<__u32> &crcs);
+};
+
+void eEPGTitleIndex::trigrams(const char *text, int len, std::vector<__u32> &result)
+{
+	result.clear();
+	if (len < 3)
+		return;
+	__u32 key = (tolower((__u8)text[0]) << 8) | tolower((__u8)text[1]);
+	for (int i = 2; i < len; ++i)
+	{
+		key = ((key << 8) | tolower((__u8)text[i])) & 0xFFFFFF;
+		result.push_back(key);
+	}
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+}
+
+void eEPGTitleIndex::add(__u32 crc, const __u8 *descr)
+{
+	std::string buffer;
+	std::vector<__u32> keys;
+	int len;
+	const char *text = eEPGDescriptorPool::title(descr, len, buffer);
+	trigrams(text, len, keys);
+	for (std::vector<__u32>::iterator it = keys.begin(); it != keys.end(); ++it)
+		m_postings[*it].push_back(crc);
+	++live;
+}
+
+bool eEPGTitleIndex::find(const char *text, int len, std::vector<__u32> &crcs)
+{
+	std::vector<__u32> keys;
+	trigrams(text, len, keys);
+	if (keys.empty())
+		return false;
+		/* every title found has all trigrams of text, those of the rarest do */
+	const std::vector<__u32> *rarest = NULL;
+	for (std::vector<__u32>::iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		postingMap::iterator p = m_postings.find(*it);
+		if (p == m_postings.end())
+			return true;
+		if (!rarest || p->second.size() < rarest->size())
+			rarest = &p->second;
+	}
+	crcs = *rarest;
+	std::sort(crcs.begin(), crcs.end());
+	crcs.erase(std::unique(crcs.begin(), crcs.end()), crcs.end());
+	return true;
+}
+
+eEPGDescriptorPool::eEPGDescriptorPool()
+	:m_table(NULL), m_mask(0), m_count(0), m_file(NULL), m_mapped(0), m_titles(NULL)
+{
+}
+
+eEPGDescriptorPool::~eEPGDescriptorPool()
+{
+	clear();
+}
+
+eEPGDescriptor *eEPGDescriptorPool::lookup(__u32 crc) const
+{
+	if (!m_table)
+		return NULL;
+	for (unsigned int i = crc & m_mask; m_table[i].data; i = (i + 1) & m_mask)
+	{
+		if (m_table[i].crc == crc)
+			return &m_table[i];
+	}
+	return NULL;
+}
+
+void eEPGDescriptorPool::grow()
+{
+	unsigned int oldslots = slots();
+	unsigned int newslots = oldslots ? oldslots * 2 : 4096;
+	eEPGDescriptor *old = m_table;
+	m_table = new eEPGDescriptor[newslots];
+	memset(m_table, 0, newslots * sizeof(eEPGDescriptor));
+	m_mask = newslots - 1;
+		/* the crcs are evenly spread already, no need to hash them again */
+	for (unsigned int i = 0; i < oldslots; ++i)
+	{
+		if (!old[i].data)
+			continue;
+		unsigned int j = old[i].crc & m_mask;
+		while (m_table[j].data)
+			j = (j + 1) & m_mask;
+		m_table[j] = old[i];
+	}
+	delete [] old;
+}
+
+bool eEPGDescriptorPool::addRef(__u32 crc)
+{
+	eEPGDescriptor *d = lookup(crc);
+	if (!d)
+		return false;
+	++d->refs;
+	return true;
+}
+
+/* crc must not be in the table yet */
+eEPGDescriptor *eEPGDescriptorPool::add(__u32 crc, __u8 *data, __u32 refs)
+{
+		/* keep the load below 3/4, probe sequences stay short */
+	if (!m_table || (m_count + 1) * 4 > slots() * 3)
+		grow();
+	unsigned int i = crc & m_mask;
+	while (m_table[i].data)
+		i = (i + 1) & m_mask;
+	m_table[i].crc = crc;
+	m_table[i].refs = refs;
+	m_table[i].data = data;
+	++m_count;
+	if (m_titles && data[0] == 0x4D)
+		m_titles->add(crc, data);
+	return &m_table[i];
+}
+
+int eEPGDescriptorPool::insert(__u32 crc, const __u8 *descr, __u32 refs)
+{
+	eEPGDescriptor *d = lookup(crc);
+	if (d)
+	{
+		d->refs += refs;
+		return 0;
+	}
+	int len = descr[1] + 2;
+	__u8 *data = (__u8*)eEPGSlab::alloc(len);
+	memcpy(data, descr, len);
+	add(crc, data, refs);
+	return len;
+}
+
+/* the table is an int count and count times: crc, refs, descriptor */
+int eEPGDescriptorPool::loadMapped(const eEPGMappedFile *file, __u32 offset, __u32 end)
+{
+	const __u8 *p = file->data() + offset;
+	const __u8 *e = file->data() + end;
+	int count, bytes = 0;
+	if (end > file->size() || p + sizeof(int) > e)
+		return -1;
+	memcpy(&count, p, sizeof(int));
+	p += sizeof(int);
+	while (count-- > 0)
+	{
+		__u32 crc, refs;
+		if (p + 10 > e || p + 10 + p[9] > e)
+			return -1;
+		memcpy(&crc, p, 4);
+		memcpy(&refs, p + 4, 4);
+		p += 8;
+		int len = p[1] + 2;
+		eEPGDescriptor *d = lookup(crc);
+		if (d)
+			d->refs += refs;
+		else
+		{
+			add(crc, (__u8*)p, refs);
+			m_file = file;
+			++m_mapped;
+			bytes += len;
+		}
+		p += len;
+	}
+	return bytes;
+}
+
+void eEPGDescriptorPool::remap(const eEPGMappedFile *file, __u32 offset, __u32 end)
+{
+	const eEPGMappedFile *old = m_file;
+	unsigned int moved = 0;
+	if (!old)
+		return;
+	if (file && end <= file->size() && offset + sizeof(int) <= end)
+	{
+		const __u8 *p = file->data() + offset;
+		const __u8 *e = file->data() + end;
+		int count;
+		memcpy(&count, p, sizeof(int));
+		p += sizeof(int);
+		while (count-- > 0 && p + 10 <= e && p + 10 + p[9] <= e)
+		{
+			__u32 crc;
+			memcpy(&crc, p, 4);
+			p += 8;
+			eEPGDescriptor *d = lookup(crc);
+			if (d && old->contains(d->data) && !memcmp(d->data, p, p[1] + 2))
+			{
+				d->data = (__u8*)p;
+				++moved;
+			}
+			p += p[1] + 2;
+		}
+	}
+	if (moved != m_mapped)
+	{
+		for (unsigned int i = 0; i < slots(); ++i)
+		{
+			__u8 *data = m_table[i].data;
+			if (data && old->contains(data))
+			{
+				int len = data[1] + 2;
+				m_table[i].data = (__u8*)eEPGSlab::alloc(len);
+				memcpy(m_table[i].data, data, len);
+			}
+		}
+	}
+	m_mapped = moved;
+	m_file = moved ? file : NULL;
+}
+
+void eEPGDescriptorPool::freeData(__u8 *data)
+{
+	if (m_file && m_file->contains(data))
+	{
+		if (!--m_mapped)
+			m_file = NULL;
+	}
+	else
+		eEPGSlab::release(data, data[1] + 2);
+}
+
+int eEPGDescriptorPool::release(__u32 crc)
+{
+	eEPGDescriptor *d = lookup(crc);
+	if (!d)
+		return -1;
+	if (--d->refs)
+		return 0;
+
+	int len = d->data[1] + 2;
+	if (m_titles && d->data[0] == 0x4D)
+	{
+		--m_titles->live;
+		if (++m_titles->stale > m_titles->live + 1024)
+		{
+			delete m_titles;
+			m_titles = NULL;
+		}
+	}
+	freeData(d->data);
+	--m_count;
+
+	/* close the gap so no lookup stops early, moving back every entry
+	   of the probe sequence that would not be found anymore otherwise */
+	unsigned int i = d - m_table;
+	unsigned int j = i;
+	while (1)
+	{
+		j = (j + 1) & m_mask;
+		if (!m_table[j].data)
+			break;
+		unsigned int k = m_table[j].crc & m_mask;
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+		{
+			m_table[i] = m_table[j];
+			i = j;
+		}
+	}
+	m_table[i].data = NULL;
+	return len;
+}
+
+void eEPGDescriptorPool::clear()
+{
+	for (unsigned int i = 0; i < slots(); ++i)
+	{
+		if (m_table[i].data)
+			freeData(m_table[i].data);
+	}
+	delete [] m_table;
+	m_table = NULL;
+	m_mask = 0;
+	m_count = 0;
+	m_file = NULL;
+	m_mapped = 0;
+	delete m_titles;
+	m_titles = NULL;
+}
+
+const char *eEPGDescriptorPool::title(const __u8 *descr, int &len, std::string &buffer)
+{
+	const char *text = (const char*)descr + 6;
+	len = descr[5];
+		/* the language code and the title length are in there at least */
+	if (descr[1] < 4 || len > descr[1] - 4)
+		len = 0;
+	else if (len && descr[6] < 0x20)
+	{
+		/* custom encoding */
+		buffer = convertDVBUTF8(descr + 6, len, 0x40, 0);
+		text = buffer.data();
+		len = buffer.length();
+	}
+	return text;
+}
+
+bool eEPGDescriptorPool::findTitles(const char *text, int len, std::vector<__u32> &crcs)
+{
+	crcs.clear();
+	if (len < 3)
+		return false;
+	if (!m_titles)
+	{
+		m_titles = new eEPGTitleIndex;
+		for (unsigned int i = 0; i < slots(); ++i)
+		{
+			if (m_table[i].data && m_table[i].data[0] == 0x4D)
+				m_titles->add(m_table[i].crc, m_table[i].data);
+		}
+		eDebug("[eEPGDescriptorPool] title index built over %u titles", m_titles->live);
+	}
+	return m_titles->find(text, len, crcs);
+}
@@ -0,0 +1,266 @@
+#ifndef __lib_dvb_epgstore_h
+#define __lib_dvb_epgstore_h
+
+#include <stddef.h>
+#include <asm/types.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <lib/base/object.h>
+
+/*
+ * Storage for the EPG cache. Nothing in here locks, all users already hold
+ * eEPGCache::cache_lock.
+ *
+ * eEPGSlab hands out small blocks from 64 KiB pages, one free list per
+ * 8 byte size class. A page goes back to the system as soon as its last
+ * block is freed, so expiring or flushing events returns whole pages
+ * instead of leaving millions of small holes in the heap.
+ */
+
+class eEPGSlab
+{
+public:
+	static void *alloc(size_t size);
+		/* size must be the one passed to alloc() */
+	static void release(void *p, size_t size);
+		/* returns the empty pages kept as spares */
+	static void trim();
+	static size_t pageCount();
+};
+
+/*
+ * epg.dat version 8, written by eEPGCache::save and mapped by load, all
+ * integers in native byte order:
+ *
+ *   eEPGFileHeader
+ *   eEPGFileService[services]
+ *   per service: events * (type, length, event record as held in memory)
+ *   descriptor table: count, count * (crc, refs, descriptor)
+ *   private epg tables, like in version 7
+ *
+ * The first 17 bytes are laid out like in the older versions, so those
+ * readers reject the file by its version string.
+ */
+struct eEPGFileHeader
+{
+	__u32 magic;		/* 0x98765432 */
+	char version[13];	/* ENIGMA_EPG_V8 */
+	__u8 reserved[3];
+	__u32 services;
+	__u32 descriptor_offset;
+	__u32 private_offset;	/* 0 without private epg */
+	__u32 file_size;
+};
+
+struct eEPGFileService
+{
+	int sid, onid, tsid;	/* uniqueEPGKey */
+	__u32 events;
+	__u32 offset;		/* of the first event */
+	__u32 size;		/* bytes of all events */
+};
+
+/*
+ * epg.dat.journal, the changes since epg.dat was written, appended by each
+ * save until the next full save folds them into epg.dat:
+ *
+ *   eEPGJournalHeader
+ *   records: length, crc32 of the payload, payload:
+ *     op, sid, onid, tsid, then
+ *     ADD:    type, length, event record, the descriptors it refers to
+ *     REMOVE: event id
+ *     FLUSH:  nothing, the service -1/-1/-1 stands for all services
+ *
+ * Loading replays the records up to the first incomplete one.
+ */
+struct eEPGJournalHeader
+{
+	__u32 magic;		/* 0x98765432 */
+	char version[13];	/* ENIGMA_EPG_J1 */
+	__u8 reserved[3];
+	eEPGFileHeader base;	/* of the epg.dat the journal continues */
+};
+
+/* a read only mapping of a whole file, a running save keeps it alive */
+class eEPGMappedFile: public iObject
+{
+	DECLARE_REF(eEPGMappedFile);
+	const __u8 *m_data;
+	size_t m_size;
+public:
+	eEPGMappedFile();
+	~eEPGMappedFile();
+	bool map(int fd);
+	void unmap();
+	const __u8 *data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool contains(const void *p) const { return m_data && (const __u8*)p >= m_data && (const __u8*)p < m_data + m_size; }
+};
+
+struct eEPGDescriptor
+{
+	__u32 crc;	/* the handle stored in the event records, and the key on disk */
+	__u32 refs;
+	__u8 *data;	/* the raw descriptor, data[1]+2 bytes, NULL for a free slot */
+};
+
+class eEPGTitleIndex;
+
+/*
+ * The descriptors shared by all events, reference counted and found by
+ * their CRC through an open addressing hash table.
+ *
+ * For the title search the pool keeps a trigram index over the titles of
+ * the short event descriptors. It is built by the first search and kept up
+ * to date from then on, so a box nobody searches on never pays for it.
+ */
+class eEPGDescriptorPool
+{
+	eEPGDescriptor *m_table;
+	unsigned int m_mask;
+	unsigned int m_count;
+	const eEPGMappedFile *m_file;
+	unsigned int m_mapped;
+	eEPGTitleIndex *m_titles;
+
+	eEPGDescriptor *lookup(__u32 crc) const;
+	void grow();
+	eEPGDescriptor *add(__u32 crc, __u8 *data, __u32 refs);
+	void freeData(__u8 *data);
+public:
+	eEPGDescriptorPool();
+	~eEPGDescriptorPool();
+
+	__u8 *find(__u32 crc) const
+	{
+		eEPGDescriptor *d = lookup(crc);
+		return d ? d->data : 0;
+	}
+		/* takes another reference, false if crc is unknown */
+	bool addRef(__u32 crc);
+		/* stores a copy of descr with refs references, returns its length */
+	int insert(__u32 crc, const __u8 *descr, __u32 refs = 1);
+		/* adds the descriptor table of a mapped epg.dat at offset, the
+		   descriptors are used in place. Returns their size, -1 if the
+		   table is damaged */
+	int loadMapped(const eEPGMappedFile *file, __u32 offset, __u32 end);
+		/* after the cache was saved to file: serves the mapped descriptors
+		   from the table in there and copies those not found to memory,
+		   file NULL copies all. Then the old file can be unmapped */
+	void remap(const eEPGMappedFile *file, __u32 offset, __u32 end);
+		/* drops a reference, returns the bytes freed, or -1 if crc is unknown */
+	int release(__u32 crc);
+	void clear();
+
+		/* the title of a short event descriptor as the search compares it,
+		   converted to UTF-8 into buffer when it has a custom encoding */
+	static const char *title(const __u8 *descr, int &len, std::string &buffer);
+		/* the crcs of the short event descriptors whose title may contain
+		   text ignoring ASCII case, to be checked by the caller. False when
+		   text is too short for the index, then all titles need checking */
+	bool findTitles(const char *text, int len, std::vector<__u32> &crcs);
+
+	unsigned int size() const { return m_count; }
+		/* descriptors still served from the mapped file */
+	unsigned int mappedCount() const { return m_mapped; }
+		/* for walking all descriptors, NULL for free slots */
+	unsigned int slots() const { return m_table ? m_mask + 1 : 0; }
+	const eEPGDescriptor *slot(unsigned int i) const { return m_table[i].data ? &m_table[i] : 0; }
+};
+
+/*
+ * The per service event indices, a vector of (key, event) pairs kept sorted
+ * by key. It offers the part of the std::map interface the cache uses, but
+ * a lookup is a binary search over one contiguous block and a scan over a
+ * time range reads neighbouring cache lines instead of chasing tree nodes.
+ *
+ * Unlike with std::map, inserting or erasing invalidates all iterators.
+ */
+template <class K, class T>
+class eEPGIndex
+{
+public:
+	typedef std::pair<K, T> value_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+private:
+	std::vector<value_type> m_items;
+
+	struct keyLess
+	{
+		bool operator()(const value_type &a, const K &b) const { return a.first < b; }
+		bool operator()(const K &a, const value_type &b) const { return a < b.first; }
+		bool operator()(const value_type &a, const value_type &b) const { return a.first < b.first; }
+	};
+public:
+	iterator begin() { return m_items.begin(); }
+	iterator end() { return m_items.end(); }
+	const_iterator begin() const { return m_items.begin(); }
+	const_iterator end() const { return m_items.end(); }
+	size_t size() const { return m_items.size(); }
+	bool empty() const { return m_items.empty(); }
+	void clear() { std::vector<value_type>().swap(m_items); }
+
+	iterator lower_bound(const K &key) { return std::lower_bound(m_items.begin(), m_items.end(), key, keyLess()); }
+	iterator upper_bound(const K &key) { return std::upper_bound(m_items.begin(), m_items.end(), key, keyLess()); }
+	iterator find(const K &key)
+	{
+		iterator it = lower_bound(key);
+		return (it != m_items.end() && !(key < it->first)) ? it : m_items.end();
+	}
+
+	T &operator[](const K &key)
+	{
+		iterator it = lower_bound(key);
+		if (it == m_items.end() || key < it->first)
+			it = m_items.insert(it, value_type(key, T()));
+		return it->second;
+	}
+
+		/* like std::map, returns the existing entry when key is present */
+	iterator insert(iterator hint, const value_type &v)
+	{
+			/* the events of a section come in order, usually the new
+			   one belongs right behind the previous insert, the hint */
+		if (hint != m_items.end() && hint->first < v.first)
+			++hint;
+		if ((hint != m_items.end() && !(v.first < hint->first)) ||
+			(hint != m_items.begin() && !((hint - 1)->first < v.first)))
+		{
+			hint = lower_bound(v.first);
+			if (hint != m_items.end() && !(v.first < hint->first))
+				return hint;
+		}
+		return m_items.insert(hint, v);
+	}
+
+		/* returns the entry after the erased one */
+	iterator erase(iterator it) { return m_items.erase(it); }
+	size_t erase(const K &key)
+	{
+		iterator it = find(key);
+		if (it == m_items.end())
+			return 0;
+		m_items.erase(it);
+		return 1;
+	}
+
+		/* adds a batch of entries whose keys are not in the index yet with one
+		   merge pass instead of an insertion (and a tail move) per entry */
+	void merge(std::vector<value_type> &batch)
+	{
+		if (batch.empty())
+			return;
+		std::sort(batch.begin(), batch.end(), keyLess());
+		size_t count = m_items.size();
+		m_items.insert(m_items.end(), batch.begin(), batch.end());
+		if (count && batch.front().first < m_items[count - 1].first)
+			std::inplace_merge(m_items.begin(), m_items.begin() + count, m_items.end(), keyLess());
+		batch.clear();
+	}
+};
+
+#endif
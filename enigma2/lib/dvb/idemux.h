@@ -3,6 +3,9 @@
 
 #include <lib/dvb/idvb.h>
 
+class eTsShmRing;
+class eStreamFanout;
+
 class iDVBSectionReader: public iObject
 {
 public:
@@ -37,6 +40,10 @@ public:
 	virtual RESULT setTimingPID(int pid, timing_pid_type pidtype, int streamtype) = 0;
 	
 	virtual RESULT setTargetFD(int fd) = 0;
+		/* write into the shared memory ring read by xine instead of an fd */
+	virtual RESULT setTargetRing(eTsShmRing *ring) = 0;
+		/* hand the packets to the stream clients attached to the fan-out */
+	virtual RESULT setTargetFanout(eStreamFanout *fanout) = 0;
 		/* for saving additional meta data. */
 	virtual RESULT setTargetFilename(const std::string& filename) = 0;
 	virtual RESULT setBoundary(off_t max) = 0;
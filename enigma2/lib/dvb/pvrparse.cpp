@@ -1,4 +1,5 @@
 #include <lib/dvb/pvrparse.h>
+#include <lib/dvb/startcode.h>
 #include <lib/base/eerror.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -18,6 +19,10 @@
 #define MAPSIZE (PAGESIZE*8)
 
 eMPEGStreamInformation::eMPEGStreamInformation():
+	m_access_points(NULL),
+	m_access_points_count(0),
+	m_access_points_mapped(0),
+	m_access_points_prepared(false),
 	m_structure_read_fd(-1),
 	m_cache_index(-1),
 	m_current_entry(-1),
@@ -35,6 +40,15 @@ eMPEGStreamInformation::~eMPEGStreamInformation()
 
 void eMPEGStreamInformation::close()
 {
+	if (m_access_points_mapped)
+		::munmap((void*)m_access_points, m_access_points_mapped);
+	m_access_points = NULL;
+	m_access_points_count = 0;
+	m_access_points_mapped = 0;
+	std::vector<unsigned long long>().swap(m_sorted_access_points);
+	m_timestamp_deltas.clear();
+	m_access_points_prepared = false;
+	m_streamtime_accesspoints = false;
 	if (m_structure_read_fd >= 0)
 	{
 		if (m_structure_cache != NULL)
@@ -57,84 +71,185 @@ int eMPEGStreamInformation::load(const char *filename)
 	close();
 	std::string s_filename(filename);
 	m_structure_read_fd = ::open((s_filename + ".sc").c_str(), O_RDONLY);
-	m_access_points.clear();
-	m_pts_to_offset.clear();
-	m_timestamp_deltas.clear();
-	FILE *f = fopen((s_filename + ".ap").c_str(), "rb");
-	if (!f)
+	int fd = ::open((s_filename + ".ap").c_str(), O_RDONLY);
+	if (fd < 0)
 		return -1;
-	while (1)
+		/* the records are only looked at when a query needs them, so
+		   opening a recording costs the same whatever its length */
+	struct stat st;
+	if (::fstat(fd, &st) == 0 && st.st_size >= 16)
+	{
+		void *map = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED)
+		{
+			m_access_points = (const unsigned long long*)map;
+			m_access_points_mapped = st.st_size;
+			m_access_points_count = st.st_size / 16;
+		}
+		else
+			eDebug("[eMPEGStreamInformation] mmap %s.ap failed: %m", filename);
+	}
+	::close(fd);
+	return 0;
+}
+
+void eMPEGStreamInformation::prepareAccessPoints()
+{
+	eSingleLocker lock(m_prepare_lock);
+	if (m_access_points_prepared)
+		return;
+	for (size_t i = 1; i < m_access_points_count; ++i)
 	{
-		unsigned long long d[2];
-		if (fread(d, sizeof(d), 1, f) < 1)
+		if (accessPointOffset(i) < accessPointOffset(i - 1))
+		{
+			sortAccessPoints();
 			break;
-		d[0] = be64toh(d[0]);
-		d[1] = be64toh(d[1]);
-		m_access_points[d[0]] = d[1];
-		m_pts_to_offset.insert(std::pair<pts_t,off_t>(d[1], d[0]));
+		}
 	}
-	fclose(f);
 	/* assume the accesspoints are in streamtime, if they start with a 0 timestamp */
-	m_streamtime_accesspoints = (!m_access_points.empty() && m_access_points.begin()->second == 0);
+	m_streamtime_accesspoints = (m_access_points_count && accessPointPTS(0) == 0);
 	fixupDiscontinuties();
-	return 0;
+	m_access_points_prepared = true;
+}
+
+namespace
+{
+	struct accessPointLess
+	{
+		bool operator()(const std::pair<off_t, pts_t> &a, const std::pair<off_t, pts_t> &b) const { return a.first < b.first; }
+	};
+}
+
+void eMPEGStreamInformation::sortAccessPoints()
+{
+	/* the recorder writes them in order, so this is for files from elsewhere */
+	eDebug("[eMPEGStreamInformation] access points not in order, sorting %zu", m_access_points_count);
+	std::vector<std::pair<off_t, pts_t> > sorted;
+	sorted.reserve(m_access_points_count);
+	for (size_t i = 0; i < m_access_points_count; ++i)
+		sorted.push_back(std::make_pair(accessPointOffset(i), accessPointPTS(i)));
+	std::stable_sort(sorted.begin(), sorted.end(), accessPointLess());
+	m_sorted_access_points.clear();
+	m_sorted_access_points.reserve(sorted.size() * 2);
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+			/* like the map this used to be, the last one of an offset counts */
+		if (i + 1 < sorted.size() && sorted[i + 1].first == sorted[i].first)
+			continue;
+		m_sorted_access_points.push_back(htobe64(sorted[i].first));
+		m_sorted_access_points.push_back(htobe64(sorted[i].second));
+	}
+	if (m_access_points_mapped)
+		::munmap((void*)m_access_points, m_access_points_mapped);
+	m_access_points_mapped = 0;
+	m_access_points = &m_sorted_access_points[0];
+	m_access_points_count = m_sorted_access_points.size() / 2;
+}
+
+size_t eMPEGStreamInformation::lowerAccessPoint(off_t offset) const
+{
+	size_t first = 0, count = m_access_points_count;
+	while (count)
+	{
+		size_t half = count / 2;
+		if (accessPointOffset(first + half) < offset)
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+	return first;
+}
+
+size_t eMPEGStreamInformation::upperAccessPoint(off_t offset) const
+{
+	size_t first = 0, count = m_access_points_count;
+	while (count)
+	{
+		size_t half = count / 2;
+		if (!(offset < accessPointOffset(first + half)))
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+	return first;
 }
 
 void eMPEGStreamInformation::fixupDiscontinuties()
 {
-	if (m_access_points.empty())
+	m_timestamp_deltas.clear();
+	if (!m_access_points_count)
 		return;
 		/* if we have no delta at the beginning, extrapolate it */
-	if ((m_access_points.find(0) == m_access_points.end()) && (m_access_points.size() > 1))
+	if (accessPointOffset(0) != 0 && m_access_points_count > 1)
 	{
-		std::map<off_t,pts_t>::const_iterator second = m_access_points.begin();
-		std::map<off_t,pts_t>::const_iterator first  = second++;
-		if (first->first < second->first) /* i.e., not equal or broken */
+		off_t first = accessPointOffset(0), second = accessPointOffset(1);
+		if (first < second) /* i.e., not equal or broken */
 		{
-			off_t diff = second->first - first->first;
-			pts_t tdiff = second->second - first->second;
-			tdiff *= first->first;
+			off_t diff = second - first;
+			pts_t tdiff = accessPointPTS(1) - accessPointPTS(0);
+			tdiff *= first;
 			tdiff /= diff;
-			m_timestamp_deltas[0] = first->second - tdiff;
-//			eDebug("first delta is %08llx", first->second - tdiff);
+			m_timestamp_deltas.push_back(TimestampDelta(0, accessPointPTS(0) - tdiff, 0));
+//			eDebug("first delta is %08llx", accessPointPTS(0) - tdiff);
 		}
 	}
 
 	if (m_timestamp_deltas.empty())
-		m_timestamp_deltas[m_access_points.begin()->first] = m_access_points.begin()->second;
+		m_timestamp_deltas.push_back(TimestampDelta(accessPointOffset(0), accessPointPTS(0), 0));
 
-	pts_t currentDelta = m_timestamp_deltas.begin()->second, lastpts_t = 0;
-	for (std::map<off_t,pts_t>::const_iterator i(m_access_points.begin()); i != m_access_points.end(); ++i)
+	pts_t currentDelta = m_timestamp_deltas.front().delta, lastpts_t = 0;
+	for (size_t i = 0; i < m_access_points_count; ++i)
 	{
-		pts_t current = i->second - currentDelta;
+		pts_t pts = accessPointPTS(i);
+		pts_t current = pts - currentDelta;
 		pts_t diff = current - lastpts_t;
 		
 		if (llabs(diff) > (90000*10)) // 10sec diff
 		{
-//			eDebug("%llx < %llx, have discont. new timestamp is %llx (diff is %llx)!", current, lastpts_t, i->second, diff);
-			currentDelta = i->second - lastpts_t; /* FIXME: should be the extrapolated new timestamp, based on the current rate */
-//			eDebug("current delta now %llx, making current to %llx", currentDelta, i->second - currentDelta);
-			m_timestamp_deltas[i->first] = currentDelta;
+//			eDebug("%llx < %llx, have discont. new timestamp is %llx (diff is %llx)!", current, lastpts_t, pts, diff);
+			currentDelta = pts - lastpts_t; /* FIXME: should be the extrapolated new timestamp, based on the current rate */
+//			eDebug("current delta now %llx, making current to %llx", currentDelta, pts - currentDelta);
+			off_t offset = accessPointOffset(i);
+			if (m_timestamp_deltas.back().offset == offset)
+				m_timestamp_deltas.back().delta = currentDelta;
+			else
+				m_timestamp_deltas.push_back(TimestampDelta(offset, currentDelta, i));
 		}
-		lastpts_t = i->second - currentDelta;
+		lastpts_t = pts - currentDelta;
 	}
 }
 
 pts_t eMPEGStreamInformation::getDelta(off_t offset)
 {
-	if (!m_timestamp_deltas.size())
+	if (m_timestamp_deltas.empty())
 		return 0;
-	std::map<off_t,pts_t>::iterator i = m_timestamp_deltas.upper_bound(offset);
-	/* i can be the first when you query for something before the first PTS */
-	if (i != m_timestamp_deltas.begin())
-		--i;
-	return i->second;
+	/* the last delta at or before offset. the first when you query for something before the first PTS */
+	size_t first = 0, count = m_timestamp_deltas.size();
+	while (count)
+	{
+		size_t half = count / 2;
+		if (!(offset < m_timestamp_deltas[first + half].offset))
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+	return m_timestamp_deltas[first ? first - 1 : 0].delta;
 }
 
 // fixupPTS is apparently called to get UI time information and such
 int eMPEGStreamInformation::fixupPTS(const off_t &offset, pts_t &ts)
 {
 	//eDebug("eMPEGStreamInformation::fixupPTS(offset=%llu pts=%llu)", offset, ts);
+	prepareAccessPoints();
 	if (m_streamtime_accesspoints)
 	{
 		/*
@@ -148,21 +263,45 @@ int eMPEGStreamInformation::fixupPTS(const off_t &offset, pts_t &ts)
 	if (m_timestamp_deltas.empty())
 		return -1;
 
-	std::multimap<pts_t, off_t>::const_iterator 
-		l = m_pts_to_offset.upper_bound(ts - 60 * 90000), 
-		u = m_pts_to_offset.upper_bound(ts + 60 * 90000), 
-		nearest = m_pts_to_offset.end();
-
-	while (l != u)
+	/*
+	 * The nearest access point within a minute of ts. The raw pts rise
+	 * between two discontinuities, so each of those stretches is searched
+	 * for the two access points around ts.
+	 */
+	size_t nearest = m_access_points_count;
+	pts_t nearest_diff = 0;
+	for (size_t k = 0; k < m_timestamp_deltas.size(); ++k)
 	{
-		if ((nearest == m_pts_to_offset.end()) || (llabs(l->first - ts) < llabs(nearest->first - ts)))
-			nearest = l;
-		++l;
+		size_t lo = m_timestamp_deltas[k].index;
+		size_t hi = k + 1 < m_timestamp_deltas.size() ? m_timestamp_deltas[k + 1].index : m_access_points_count;
+		size_t first = lo, count = hi - lo;
+		while (count)
+		{
+			size_t half = count / 2;
+			if (accessPointPTS(first + half) < ts)
+			{
+				first += half + 1;
+				count -= half + 1;
+			}
+			else
+				count = half;
+		}
+		for (size_t i = first > lo ? first - 1 : first; i <= first && i < hi; ++i)
+		{
+			pts_t diff = llabs(accessPointPTS(i) - ts);
+			if (accessPointPTS(i) <= ts - 60 * 90000 || accessPointPTS(i) > ts + 60 * 90000)
+				continue;
+			if (nearest == m_access_points_count || diff < nearest_diff)
+			{
+				nearest = i;
+				nearest_diff = diff;
+			}
+		}
 	}
-	if (nearest == m_pts_to_offset.end())
+	if (nearest == m_access_points_count)
 		return 1;
 
-	ts -= getDelta(nearest->second);
+	ts -= getDelta(accessPointOffset(nearest));
 
 	return 0;
 }
@@ -171,20 +310,21 @@ int eMPEGStreamInformation::fixupPTS(const off_t &offset, pts_t &ts)
 int eMPEGStreamInformation::getPTS(off_t &offset, pts_t &pts)
 {
 	//eDebug("[eMPEGStreamInformation] {%d} getPTS(offset=%llu, pts=%llu)", gettid(), offset, pts);
-	std::map<off_t,pts_t>::iterator before = m_access_points.lower_bound(offset);
+	prepareAccessPoints();
+	size_t before = lowerAccessPoint(offset);
 
 		/* usually, we prefer the AP before the given offset. however if there is none, we take any. */
-	if (before != m_access_points.begin())
+	if (before != 0)
 		--before;
 	
-	if (before == m_access_points.end())
+	if (before == m_access_points_count)
 	{
 		pts = 0;
 		return -1;
 	}
 	
-	offset = before->first;
-	pts = before->second - getDelta(offset);
+	offset = accessPointOffset(before);
+	pts = accessPointPTS(before) - getDelta(offset);
 	
 	return 0;
 }
@@ -192,33 +332,27 @@ int eMPEGStreamInformation::getPTS(off_t &offset, pts_t &pts)
 pts_t eMPEGStreamInformation::getInterpolated(off_t offset)
 {
 		/* get the PTS values before and after the offset. */
-	std::map<off_t,pts_t>::iterator before, after;
-	after = m_access_points.upper_bound(offset);
-	before = after;
-
-	if (before != m_access_points.begin())
-		--before;
-	else	/* we query before the first known timestamp ... FIXME */
-		return 0;
+	prepareAccessPoints();
+	size_t after = upperAccessPoint(offset);
 
-		/* empty... */
-	if (before == m_access_points.end())
+		/* we query before the first known timestamp ... FIXME, or empty */
+	if (after == 0)
 		return 0;
+	size_t before = after - 1;
 
 		/* if after == end, then we need to extrapolate ... FIXME */
-	if ((before->first == offset) || (after == m_access_points.end()))
-		return before->second - getDelta(offset);
+	if ((accessPointOffset(before) == offset) || (after == m_access_points_count))
+		return accessPointPTS(before) - getDelta(offset);
 	
-	pts_t before_ts = before->second - getDelta(before->first);
-	pts_t after_ts = after->second - getDelta(after->first);
+	pts_t before_ts = getFixedPTS(before);
+	pts_t after_ts = getFixedPTS(after);
 	
 //	eDebug("%08llx .. ? .. %08llx", before_ts, after_ts);
-//	eDebug("%08llx .. %08llx .. %08llx", before->first, offset, after->first);
 	
 	pts_t diff = after_ts - before_ts;
-	off_t diff_off = after->first - before->first;
+	off_t diff_off = accessPointOffset(after) - accessPointOffset(before);
 	
-	diff = (offset - before->first) * diff / diff_off;
+	diff = (offset - accessPointOffset(before)) * diff / diff_off;
 //	eDebug("%08llx .. %08llx .. %08llx", before_ts, before_ts + diff, after_ts);
 	return before_ts + diff;
 }
@@ -227,23 +361,24 @@ off_t eMPEGStreamInformation::getAccessPoint(pts_t ts, int marg)
 {
 	//eDebug("eMPEGStreamInformation::getAccessPoint(ts=%llu, marg=%d)", ts, marg);
 		/* FIXME: more efficient implementation */
+	prepareAccessPoints();
 	off_t last = 0;
 	off_t last2 = 0;
 	ts += 1; // Add rounding error margin
-	for (std::map<off_t, pts_t>::const_iterator i(m_access_points.begin()); i != m_access_points.end(); ++i)
+	for (size_t i = 0; i < m_access_points_count; ++i)
 	{
-		pts_t delta = getDelta(i->first);
-		pts_t c = i->second - delta;
+		off_t offset = accessPointOffset(i);
+		pts_t c = accessPointPTS(i) - getDelta(offset);
 		if (c > ts) {
 			if (marg > 0)
-				return (last + i->first)/376*188;
+				return (last + offset)/376*188;
 			else if (marg < 0)
 				return (last + last2)/376*188;
 			else
 				return last;
 		}
 		last2 = last;
-		last = i->first;
+		last = offset;
 	}
 	if (marg < 0)
 		return (last + last2)/376*188;
@@ -253,53 +388,57 @@ off_t eMPEGStreamInformation::getAccessPoint(pts_t ts, int marg)
 
 int eMPEGStreamInformation::getNextAccessPoint(pts_t &ts, const pts_t &start, int direction)
 {
-	if (m_access_points.empty())
+	if (!m_access_points_count)
 	{
 		eDebug("can't get next access point without streaminfo (yet)");
 		return -1;
 	}
 	off_t offset = getAccessPoint(start);
-	std::map<off_t, pts_t>::const_iterator i = m_access_points.find(offset);
-	if (i == m_access_points.end())
+	size_t i = lowerAccessPoint(offset);
+	if (i == m_access_points_count || accessPointOffset(i) != offset)
 	{
 		eDebug("getNextAccessPoint: initial AP not found");
 		return -1;
 	}
-	pts_t c1 = i->second - getDelta(i->first);
+	pts_t c1 = getFixedPTS(i);
 	while (direction)
 	{
 		while (direction > 0)
 		{
-			if (i == m_access_points.end())
+			if (i + 1 >= m_access_points_count)
 				return -1;
 			++i;
-			pts_t c2 = i->second - getDelta(i->first);
+			pts_t c2 = getFixedPTS(i);
 			if (c1 == c2) { // Discontinuity
+				if (i + 1 >= m_access_points_count)
+					return -1;
 				++i;
-				c2 = i->second - getDelta(i->first);
+				c2 = getFixedPTS(i);
 			}
 			c1 = c2;
 			direction--;
 		}
 		while (direction < 0)
 		{
-			if (i == m_access_points.begin())
+			if (i == 0)
 			{
 				eDebug("getNextAccessPoint at start");
 				return -1;
 			}
 			--i;
-			pts_t c2 = i->second - getDelta(i->first);
+			pts_t c2 = getFixedPTS(i);
 			if (c1 == c2) { // Discontinuity
+				if (i == 0)
+					return -1;
 				--i;
-				c2 = i->second - getDelta(i->first);
+				c2 = getFixedPTS(i);
 			}
 			c1 = c2;
 			direction++;
 		}
 	}
-	ts = i->second - getDelta(i->first);
-	eDebug("getNextAccessPoint fine, at %lld - %lld = %lld", ts, i->second, getDelta(i->first));
+	ts = getFixedPTS(i);
+	eDebug("getNextAccessPoint fine, at %lld - %lld = %lld", ts, accessPointPTS(i), getDelta(accessPointOffset(i)));
 	return 0;
 }
 
@@ -517,11 +656,11 @@ int eMPEGStreamInformation::getStructureEntryNext(off_t &offset, unsigned long l
 int eMPEGStreamInformation::getFirstFrame(off_t &offset, pts_t& pts)
 {
 	//eDebug("{%d} eMPEGStreamInformation::getFirstFrame", gettid());
-	std::map<off_t,pts_t>::const_iterator entry = m_access_points.begin();
-	if (entry != m_access_points.end())
+	prepareAccessPoints();
+	if (m_access_points_count)
 	{
-		offset = entry->first;
-		pts = entry->second;
+		offset = accessPointOffset(0);
+		pts = accessPointPTS(0);
 		return 0;
 	}
 	// No access points (yet?) use the .sc data instead
@@ -552,11 +691,11 @@ int eMPEGStreamInformation::getFirstFrame(off_t &offset, pts_t& pts)
 int eMPEGStreamInformation::getLastFrame(off_t &offset, pts_t& pts)
 {
 	//eDebug("{%d} eMPEGStreamInformation::getLastFrame", gettid());
-	std::map<off_t,pts_t>::const_reverse_iterator entry = m_access_points.rbegin();
-	if (entry != m_access_points.rend())
+	prepareAccessPoints();
+	if (m_access_points_count)
 	{
-		offset = entry->first;
-		pts = entry->second;
+		offset = accessPointOffset(m_access_points_count - 1);
+		pts = accessPointPTS(m_access_points_count - 1);
 		return 0;
 	}
 	// No access points (yet?) use the .sc data instead
@@ -618,7 +757,8 @@ eMPEGStreamInformationWriter::eMPEGStreamInformationWriter():
 	m_structure_write_fd(-1),
 	m_structure_pos(0),
 	m_write_buffer(NULL),
-	m_buffer_filled(0)
+	m_buffer_filled(0),
+	m_ring(NULL)
 {}
 
 eMPEGStreamInformationWriter::~eMPEGStreamInformationWriter()
@@ -647,8 +787,13 @@ int eMPEGStreamInformationWriter::stopSave(void)
 		return 1;
 	std::string ap_filename(m_filename);
 	ap_filename += ".ap";
+	/* players map the .ap, truncating it under them would crash them.
+	   A new file renamed over it leaves a mapped old one intact. */
+	std::string tmp_filename(ap_filename);
+	tmp_filename += ".tmp";
+	FILE *f;
 	{
-		FILE *f = fopen(ap_filename.c_str(), "wb");
+		f = fopen(tmp_filename.c_str(), "wb");
 		if (!f)
 			return -1;
 		for (std::deque<AccessPoint>::const_iterator i(m_streamtime_access_points.begin()); i != m_streamtime_access_points.end(); ++i)
@@ -667,14 +812,26 @@ int eMPEGStreamInformationWriter::stopSave(void)
 			if (fwrite(d, sizeof(d), 1, f) <= 0)
 				goto write_ap_error;
 		}
-		fclose(f);
+		if (fclose(f) != 0)
+		{
+			f = NULL;
+			goto write_ap_error;
+		}
+		if (::rename(tmp_filename.c_str(), ap_filename.c_str()) < 0)
+		{
+			eDebug("Failed to rename %s: %m", tmp_filename.c_str());
+			::unlink(tmp_filename.c_str());
+			return -1;
+		}
 	}
 	return 0;
 write_ap_error:
 	/* Writing half an AP file is worse than no file at all, so unlink
 	* it if writing it fails */
-	eDebug("Failed to write %s, removing it", ap_filename.c_str());
-	::unlink(ap_filename.c_str());
+	eDebug("Failed to write %s, removing it", tmp_filename.c_str());
+	if (f)
+		fclose(f);
+	::unlink(tmp_filename.c_str());
 	return -1;
 }
 
@@ -719,7 +876,8 @@ void eMPEGStreamInformationWriter::writeStructureEntry(off_t offset, unsigned lo
 }
 
 eMPEGStreamInformationWriter::PendingWrite::PendingWrite():
-	m_buffer(NULL) // empty constructor because deque will make a COPY first.
+	m_buffer(NULL), // empty constructor because deque will make a COPY first.
+	m_ring(NULL)
 {
 }
 
@@ -739,6 +897,16 @@ int eMPEGStreamInformationWriter::PendingWrite::start(int fd, off_t where, void*
 	return r;
 }
 
+int eMPEGStreamInformationWriter::PendingWrite::start(eIOUring *ring, int fd, off_t where, void* buffer, size_t buffer_size)
+{
+	m_buffer = buffer; // Note: We take ownership of the buffer!
+	m_ring = ring;
+	int r = ring->write(fd, buffer, buffer_size, where, -1, &m_request);
+	if (r < 0)
+		eDebug("[eMPEGStreamInformationWriter] io_uring write returned failure: %s", strerror(-r));
+	return r;
+}
+
 eMPEGStreamInformationWriter::PendingWrite::~PendingWrite()
 {
 	if (m_buffer != NULL)
@@ -751,6 +919,13 @@ eMPEGStreamInformationWriter::PendingWrite::~PendingWrite()
 int eMPEGStreamInformationWriter::PendingWrite::wait()
 {
 	//eDebug("[eMPEGStreamInformationWriter] PendingWrite waiting for IO completion");
+	if (m_ring)
+	{
+		int r = m_ring->wait(&m_request);
+		if (r < 0)
+			eDebug("[eMPEGStreamInformationWriter] io_uring write returned failure: %s", strerror(-r));
+		return r;
+	}
 	struct aiocb* aio = &m_aio;
 	while (aio_error(aio) == EINPROGRESS)
 	{
@@ -774,14 +949,25 @@ bool eMPEGStreamInformationWriter::PendingWrite::poll()
 {
 	if (m_buffer == NULL)
 		return true; // Nothing pending
-	if (aio_error(&m_aio) == EINPROGRESS)
+	if (m_ring)
 	{
-		return false; // still busy
+		m_ring->reap();
+		if (m_request.busy)
+			return false; // still busy
+		if (m_request.result < 0)
+			eDebug("[eMPEGStreamInformationWriter] io_uring write returned failure: %s", strerror(-m_request.result));
 	}
-	int r = aio_return(&m_aio);
-	if (r < 0)
+	else
 	{
-		eDebug("[eMPEGStreamInformationWriter] aio_return returned failure: %m");
+		if (aio_error(&m_aio) == EINPROGRESS)
+		{
+			return false; // still busy
+		}
+		int r = aio_return(&m_aio);
+		if (r < 0)
+		{
+			eDebug("[eMPEGStreamInformationWriter] aio_return returned failure: %m");
+		}
 	}
 	free(m_buffer);
 	m_buffer = NULL;
@@ -808,7 +994,10 @@ void eMPEGStreamInformationWriter::commit()
 	if (m_write_buffer != NULL)
 	{
 		m_pending_writes.push_back(PendingWrite()); // calls copy constructor, so don't initialize it
-		m_pending_writes.back().start(m_structure_write_fd, m_structure_pos, m_write_buffer, m_buffer_filled);
+		if (m_ring)
+			m_pending_writes.back().start(m_ring, m_structure_write_fd, m_structure_pos, m_write_buffer, m_buffer_filled);
+		else
+			m_pending_writes.back().start(m_structure_write_fd, m_structure_pos, m_write_buffer, m_buffer_filled);
 		m_structure_pos += m_buffer_filled;
 		m_write_buffer = NULL;
 		m_buffer_filled = 0;
@@ -821,7 +1010,16 @@ void eMPEGStreamInformationWriter::close()
 	if (m_structure_write_fd != -1)
 	{
 		commit();
+		if (m_ring)
+		{
+			// the sync is queued behind the writes and drains them
+			eIOUringRequest sync;
+			if (m_ring->fdatasync(m_structure_write_fd, &sync) == 0 && m_ring->wait(&sync) < 0)
+				eDebug("[eMPEGStreamInformationWriter] fdatasync failed: %s", strerror(-sync.result));
+		}
 		m_pending_writes.clear(); // this waits for all IO to complete
+		if (!m_ring)
+			::fdatasync(m_structure_write_fd);
 		::close(m_structure_write_fd);
 		m_structure_write_fd = -1;
 		if ((m_structure_pos == 0) && !m_filename.empty())
@@ -962,75 +1160,73 @@ int eMPEGStreamParserTS::processPacket(const unsigned char *pkt, off_t offset)
 		pkt += pkt[8] + 9;
 	}
 
-	for (; pkt < (end-4); ++pkt)
+		/* start codes may sit anywhere up to the last 5 bytes, each needs pkt[3..5] */
+	for (; (pkt = findStartCode(pkt, end - 2)) != NULL; ++pkt)
 	{
 		int pkt_offset = pkt - begin;
-		if (!(pkt[0] || pkt[1] || (pkt[2] != 1)))
-		{
 //			 ("SC %02x %02x %02x %02x, %02x", pkt[0], pkt[1], pkt[2], pkt[3], pkt[4]);
-			unsigned int sc = pkt[3];
+		unsigned int sc = pkt[3];
 
-			if (m_streamtype < 0) /* unknown */
+		if (m_streamtype < 0) /* unknown */
+		{
+			if ((sc == 0x00) || (sc == 0xb3) || (sc == 0xb8))
 			{
-				if ((sc == 0x00) || (sc == 0xb3) || (sc == 0xb8))
-				{
-					eDebug("eMPEGStreamParserTS - detected MPEG2 stream");
-					m_streamtype = 0;
-				}
-				else if (sc == 0x09)
-				{
-					eDebug("eMPEGStreamParserTS - detected H264 stream");
-					m_streamtype =  1;
-				}
-				else
-					continue;
+				eDebug("eMPEGStreamParserTS - detected MPEG2 stream");
+				m_streamtype = 0;
+			}
+			else if (sc == 0x09)
+			{
+				eDebug("eMPEGStreamParserTS - detected H264 stream");
+				m_streamtype =  1;
 			}
+			else
+				continue;
+		}
 
-			if (m_streamtype == 0) /* mpeg2 */
+		if (m_streamtype == 0) /* mpeg2 */
+		{
+			if ((sc == 0x00) || (sc == 0xb3) || (sc == 0xb8)) /* picture, sequence, group start code */
 			{
-				if ((sc == 0x00) || (sc == 0xb3) || (sc == 0xb8)) /* picture, sequence, group start code */
+				if ((sc == 0xb3) && m_enable_accesspoints) /* sequence header */
 				{
-					if ((sc == 0xb3) && m_enable_accesspoints) /* sequence header */
-					{
-						if (ptsvalid)
-						{
-							addAccessPoint(offset, pts);
-							//eDebug("Sequence header at %llx, pts %llx", offset, pts);
-						}
-					}
-					if (pkt <= (end - 6))
-					{
-						unsigned long long data = sc | ((unsigned)pkt[4] << 8) | ((unsigned)pkt[5] << 16);
-						if (ptsvalid) // If available, add timestamp data as well. PTS = 33 bits
-							data |= (pts << 31) | 0x1000000;
-						writeStructureEntry(offset + pkt_offset, data);
-					}
-					else
+					if (ptsvalid)
 					{
-						// Returning non-zero suggests we need more data. This does not
-						// work, and never has, so we should make this a void function
-						// or fix that...
-						return 1;
+						addAccessPoint(offset, pts);
+						//eDebug("Sequence header at %llx, pts %llx", offset, pts);
 					}
 				}
-			}
-			else /* (m_streamtype == 1) means H.264 */
-			{
-				if (sc == 0x09)
+				if (pkt <= (end - 6))
 				{
-					/* store image type */
-					unsigned long long data = sc | (pkt[4] << 8);
+					unsigned long long data = sc | ((unsigned)pkt[4] << 8) | ((unsigned)pkt[5] << 16);
 					if (ptsvalid) // If available, add timestamp data as well. PTS = 33 bits
 						data |= (pts << 31) | 0x1000000;
 					writeStructureEntry(offset + pkt_offset, data);
-					if ( //pkt[3] == 0x09 &&   /* MPEG4 AVC NAL unit access delimiter */
-						 (pkt[4] >> 5) == 0) /* and I-frame */
+				}
+				else
+				{
+					// Returning non-zero suggests we need more data. This does not
+					// work, and never has, so we should make this a void function
+					// or fix that...
+					return 1;
+				}
+			}
+		}
+		else /* (m_streamtype == 1) means H.264 */
+		{
+			if (sc == 0x09)
+			{
+				/* store image type */
+				unsigned long long data = sc | (pkt[4] << 8);
+				if (ptsvalid) // If available, add timestamp data as well. PTS = 33 bits
+					data |= (pts << 31) | 0x1000000;
+				writeStructureEntry(offset + pkt_offset, data);
+				if ( //pkt[3] == 0x09 &&   /* MPEG4 AVC NAL unit access delimiter */
+					 (pkt[4] >> 5) == 0) /* and I-frame */
+				{
+					if (ptsvalid && m_enable_accesspoints)
 					{
-						if (ptsvalid && m_enable_accesspoints)
-						{
-							addAccessPoint(offset, pts);
-							// eDebug("MPEG4 AVC UAD at %llx, pts %llx", offset, pts);
-						}
+						addAccessPoint(offset, pts);
+						// eDebug("MPEG4 AVC UAD at %llx, pts %llx", offset, pts);
 					}
 				}
 			}
@@ -1102,6 +1298,21 @@ void eMPEGStreamParserTS::parseData(off_t offset, const void *data, unsigned int
 		
 		if (!len)
 			break;
+
+			/* most packets belong to other pids (or are H.264 packets we
+			   don't need), step over those whole while in sync */
+		if (!m_pktptr)
+		{
+			while (len >= (unsigned int)m_packetsize && packet[m_header_offset] == 0x47 && !wantPacket(packet))
+			{
+				packet += m_packetsize;
+				len -= m_packetsize;
+			}
+			if (!len)
+				break;
+			if (packet[m_header_offset] != 0x47)
+				continue;
+		}
 		
 		if (m_pktptr)
 		{
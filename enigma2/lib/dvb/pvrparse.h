@@ -1,12 +1,16 @@
 #ifndef __include_lib_dvb_pvrparse_h
 #define __include_lib_dvb_pvrparse_h
 
+#include <lib/base/elock.h>
+#include <lib/base/iouring.h>
 #include <lib/dvb/idvb.h>
 #include <lib/dvb/idemux.h>
 #include <map>
 #include <set>
 #include <deque>
+#include <vector>
 #include <aio.h>
+#include <endian.h>
 
 	/* This module parses TS data and collects valuable information  */
 	/* about it, like PTS<->offset correlations and sequence starts. */
@@ -30,7 +34,7 @@ public:
 	
 	int getNextAccessPoint(pts_t &ts, const pts_t &start, int direction);
 	
-	bool hasAccessPoints() { return !m_access_points.empty(); }
+	bool hasAccessPoints() { return m_access_points_count != 0; }
 	bool hasStructure() { return m_structure_read_fd >= 0; }
 	
 		/* get a structure entry at given offset (or previous one, if no exact match was found).
@@ -51,17 +55,42 @@ private:
 	pts_t getInterpolated(off_t offset);
 	/* get delta at specific offset */
 	pts_t getDelta(off_t offset);
+	/* checks the order of the access points and finds the discontinuities,
+	   once after load, before the first query */
+	void prepareAccessPoints();
+	void sortAccessPoints();
 	/* recalculates timestampDeltas */
 	void fixupDiscontinuties();
-	/* we order by off_t here, since the timestamp may */
-	/* wrap around. */
+
+	/* the .ap file, mapped and used in place: 16 byte records of offset and */
+	/* pts, big endian, ordered by offset. we order by off_t here, since the */
+	/* timestamp may wrap around. */
 	/* we only record sequence start's pts values here. */
-	std::map<off_t, pts_t> m_access_points;
+	const unsigned long long *m_access_points;
+	size_t m_access_points_count;
+	size_t m_access_points_mapped;	/* size of the mapping, 0 when m_access_points is the sorted copy */
+	std::vector<unsigned long long> m_sorted_access_points;	/* only for files not in offset order */
+	off_t accessPointOffset(size_t i) const { return (off_t)be64toh(m_access_points[i * 2]); }
+	pts_t accessPointPTS(size_t i) const { return (pts_t)be64toh(m_access_points[i * 2 + 1]); }
+	/* index of the first access point at or after (lower) or after (upper) offset */
+	size_t lowerAccessPoint(off_t offset) const;
+	size_t upperAccessPoint(off_t offset) const;
+	pts_t getFixedPTS(size_t i) { return accessPointPTS(i) - getDelta(accessPointOffset(i)); }
+
 	/* timestampDelta is in fact the difference between */
 	/* the PTS in the stream and a real PTS from 0..max */
-	std::map<off_t, pts_t> m_timestamp_deltas;
-	/* these are non-fixed up pts value (like m_access_points), just used to accelerate stuff. */
-	std::multimap<pts_t, off_t> m_pts_to_offset;
+	/* a handful of entries, one per discontinuity. between two of them */
+	/* the raw pts rise with the offset, which fixupPTS searches. */
+	struct TimestampDelta
+	{
+		off_t offset;
+		pts_t delta;
+		size_t index;	/* first access point it applies to */
+		TimestampDelta(off_t o, pts_t d, size_t i): offset(o), delta(d), index(i) {}
+	};
+	std::vector<TimestampDelta> m_timestamp_deltas;
+	bool m_access_points_prepared;
+	eSingleLock m_prepare_lock;	/* the playback threads may query first concurrently */
 
 	int m_structure_read_fd;
 	int m_cache_index;   // Location of cache
@@ -83,6 +112,9 @@ public:
 	virtual void addAccessPoint(off_t offset, pts_t pts, bool streamtime);
 	void writeStructureEntry(off_t offset, unsigned long long data);
 	void commit();
+		/* the .sc writes go through ring instead of POSIX AIO, the
+		   owner of the ring submits them together with its own */
+	void setIOUring(eIOUring *ring) { m_ring = ring; }
 private:
 	void close();
 	struct AccessPoint
@@ -97,10 +129,13 @@ private:
 		PendingWrite();
 		~PendingWrite();
 		int start(int fd, off_t where, void* buffer, size_t buffer_size);
+		int start(eIOUring *ring, int fd, off_t where, void* buffer, size_t buffer_size);
 		bool poll(); // releases resources when ready, returns true if released
 		int wait();
 		void* m_buffer;
 		struct aiocb m_aio;
+		eIOUring *m_ring; // NULL for POSIX AIO
+		eIOUringRequest m_request;
 	};
 	std::deque<PendingWrite> m_pending_writes;
 	std::string m_filename;
@@ -108,6 +143,7 @@ private:
 	off_t m_structure_pos;
 	void* m_write_buffer;
 	size_t m_buffer_filled;
+	eIOUring *m_ring;
 };
 
 
@@ -0,0 +1,68 @@
+#include <lib/dvb/startcode.h>
+#include <stddef.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const unsigned char *findStartCodeScalar(const unsigned char *data, const unsigned char *end)
+{
+	while (end - data >= 3)
+	{
+		if (data[2] > 1)
+			data += 3;	/* no start code can begin at data, data + 1 or data + 2 */
+		else if (!data[2])
+			++data;
+		else
+		{
+			if (!data[0] && !data[1])
+				return data;
+			data += 3;
+		}
+	}
+	return NULL;
+}
+
+const unsigned char *findStartCode(const unsigned char *data, const unsigned char *end)
+{
+#if defined(__AVX2__)
+	const __m256i zero32 = _mm256_setzero_si256(), one32 = _mm256_set1_epi8(1);
+		/* the last load reads data[33] */
+	while (end - data >= 34)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)data);
+		__m256i za = _mm256_cmpeq_epi8(a, zero32);
+			/* a start code begins with a zero byte, most blocks have none */
+		if (_mm256_movemask_epi8(za))
+		{
+			__m256i b = _mm256_loadu_si256((const __m256i*)(data + 1));
+			__m256i c = _mm256_loadu_si256((const __m256i*)(data + 2));
+			unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(za,
+				_mm256_cmpeq_epi8(b, zero32)), _mm256_cmpeq_epi8(c, one32)));
+			if (mask)
+				return data + __builtin_ctz(mask);
+		}
+		data += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+	while (end - data >= 18)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)data);
+		__m128i za = _mm_cmpeq_epi8(a, zero);
+		if (_mm_movemask_epi8(za))
+		{
+			__m128i b = _mm_loadu_si128((const __m128i*)(data + 1));
+			__m128i c = _mm_loadu_si128((const __m128i*)(data + 2));
+			unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(za,
+				_mm_cmpeq_epi8(b, zero)), _mm_cmpeq_epi8(c, one)));
+			if (mask)
+				return data + __builtin_ctz(mask);
+		}
+		data += 16;
+	}
+#endif
+	return findStartCodeScalar(data, end);
+}
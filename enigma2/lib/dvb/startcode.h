@@ -0,0 +1,15 @@
+#ifndef __lib_dvb_startcode_h
+#define __lib_dvb_startcode_h
+
+	/* returns the first 00 00 01 start code that lies completely inside
+	   [data, end), or NULL if there is none. Compares 16 (SSE2) or 32 (AVX2)
+	   positions at a time when the compiler targets those, the rest with
+	   findStartCodeScalar */
+const unsigned char *findStartCode(const unsigned char *data, const unsigned char *end);
+
+	/* the same without vector instructions. Still skips three bytes
+	   wherever the third one rules out a start code, like most of the time
+	   in compressed video */
+const unsigned char *findStartCodeScalar(const unsigned char *data, const unsigned char *end);
+
+#endif
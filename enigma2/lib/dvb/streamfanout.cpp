@@ -0,0 +1,354 @@
+#include <lib/dvb/streamfanout.h>
+#include <lib/base/eerror.h>
+#include <lib/base/nconfig.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+	/* iovecs per sendmsg, 64 chunks are far more than a socket buffer takes */
+#define STREAM_IOV_COUNT	64
+	/* idle chunks kept for reuse, enough for a few recorders in flight */
+#define STREAM_CHUNK_POOL	32
+
+eStreamWriter *eStreamWriter::instance;
+
+eStreamWriter::eStreamWriter()
+	:m_wakeup_pending(false)
+{
+	m_max_backlog = eConfigManager::getConfigIntValue("config.streaming.client_backlog", 2048) * 1024;
+	m_epoll = epoll_create(16);
+	m_wakeup = eventfd(0, EFD_NONBLOCK);
+	if (m_epoll < 0 || m_wakeup < 0)
+		eFatal("[eStreamWriter] epoll setup failed: %m");
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = m_wakeup;
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+}
+
+eStreamWriter *eStreamWriter::getInstance()
+{
+	if (!instance)
+	{
+		instance = new eStreamWriter();
+		instance->run();
+	}
+	return instance;
+}
+
+int eStreamWriter::addClient(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -1;
+
+	eSingleLocker lock(m_lock);
+	if (m_clients.find(fd) != m_clients.end())
+		return -1;
+		/* edge triggered: we hear about the socket again once a send hit EAGAIN and it drained */
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT | EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+	{
+		eDebug("[eStreamWriter] epoll_ctl failed for %d: %m", fd);
+		return -1;
+	}
+	Client *client = new Client;
+	client->offset = 0;
+	client->ready = false;
+	client->blocked = false;
+	memset(&client->stats, 0, sizeof(client->stats));
+	client->stats.fd = fd;
+	m_clients[fd] = client;
+	eDebug("[eStreamWriter] client %d added", fd);
+	return 0;
+}
+
+void eStreamWriter::removeClient(int fd)
+{
+	eSingleLocker lock(m_lock);
+	std::map<int, Client*>::iterator it = m_clients.find(fd);
+	if (it == m_clients.end())
+		return;
+	Client *client = it->second;
+	eDebug("[eStreamWriter] client %d removed: %llu bytes sent, %u chunks dropped, peak backlog %zd kB",
+		fd, client->stats.sent, client->stats.dropped, client->stats.peak_backlog >> 10);
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+	release(client);
+	delete client;
+	m_clients.erase(it);
+		/* a pending entry in m_ready is skipped by the lookup in the thread */
+}
+
+bool eStreamWriter::clientFailed(int fd)
+{
+	eSingleLocker lock(m_lock);
+	std::map<int, Client*>::iterator it = m_clients.find(fd);
+	return it == m_clients.end() || it->second->stats.failed;
+}
+
+eStreamChunk *eStreamWriter::allocChunk(size_t size)
+{
+	{
+		eSingleLocker lock(m_lock);
+		if (!m_free.empty() && m_free.back()->size == size)
+		{
+			eStreamChunk *chunk = m_free.back();
+			m_free.pop_back();
+			return chunk;
+		}
+	}
+	eStreamChunk *chunk = new eStreamChunk;
+	chunk->refs = 0;
+	chunk->size = size;
+	chunk->len = 0;
+	chunk->data = new unsigned char[size];
+	return chunk;
+}
+
+/* called with the lock held */
+void eStreamWriter::unref(eStreamChunk *chunk)
+{
+	if (--chunk->refs > 0)
+		return;
+	chunk->refs = 0;
+	chunk->len = 0;
+	if (m_free.size() < STREAM_CHUNK_POOL)
+	{
+		m_free.push_back(chunk);
+		return;
+	}
+	delete [] chunk->data;
+	delete chunk;
+}
+
+void eStreamWriter::freeChunk(eStreamChunk *chunk)
+{
+	eSingleLocker lock(m_lock);
+	chunk->refs = 1;
+	unref(chunk);
+}
+
+/* called with the lock held */
+void eStreamWriter::release(Client *client)
+{
+	for (std::deque<eStreamChunk*>::iterator it = client->queue.begin(); it != client->queue.end(); ++it)
+		unref(*it);
+	client->queue.clear();
+	client->offset = 0;
+	client->stats.backlog = 0;
+}
+
+void eStreamWriter::queue(const std::set<int> &fds, eStreamChunk *chunk)
+{
+	eSingleLocker lock(m_lock);
+	bool wake = false;
+	chunk->refs = 1; /* ours, until every client has its reference */
+	for (std::set<int>::const_iterator i = fds.begin(); i != fds.end(); ++i)
+	{
+		std::map<int, Client*>::iterator it = m_clients.find(*i);
+		if (it == m_clients.end() || it->second->stats.failed)
+			continue;
+		Client *client = it->second;
+			/* drop oldest, but never the chunk a partial send is pending on */
+		while (client->stats.backlog + chunk->len > m_max_backlog && client->queue.size() > (client->offset ? 1u : 0u))
+		{
+			std::deque<eStreamChunk*>::iterator victim = client->queue.begin();
+			if (client->offset)
+				++victim;
+			client->stats.backlog -= (*victim)->len;
+			unref(*victim);
+			client->queue.erase(victim);
+			if (!(client->stats.dropped++ % 100))
+				eDebug("[eStreamWriter] client %d too slow, %u chunks dropped", *i, client->stats.dropped);
+		}
+		chunk->refs++;
+		client->queue.push_back(chunk);
+		client->stats.backlog += chunk->len;
+		if (client->stats.backlog > client->stats.peak_backlog)
+			client->stats.peak_backlog = client->stats.backlog;
+		if (!client->blocked && !client->ready)
+		{
+			client->ready = true;
+			m_ready.push_back(*i);
+			wake = true;
+		}
+	}
+	unref(chunk);
+	if (wake && !m_wakeup_pending)
+	{
+		eventfd_write(m_wakeup, 1);
+		m_wakeup_pending = true;
+	}
+}
+
+void eStreamWriter::getStats(const std::set<int> &fds, std::vector<eStreamClientStats> &stats)
+{
+	eSingleLocker lock(m_lock);
+	for (std::set<int>::const_iterator i = fds.begin(); i != fds.end(); ++i)
+	{
+		std::map<int, Client*>::iterator it = m_clients.find(*i);
+		if (it != m_clients.end())
+			stats.push_back(it->second->stats);
+	}
+}
+
+/* called with the lock held, returns <0 if the client is gone */
+int eStreamWriter::send(int fd, Client *client)
+{
+	while (!client->queue.empty())
+	{
+		struct iovec iov[STREAM_IOV_COUNT];
+		int count = 0;
+		for (std::deque<eStreamChunk*>::iterator it = client->queue.begin();
+			it != client->queue.end() && count < STREAM_IOV_COUNT; ++it, ++count)
+		{
+			size_t skip = count ? 0 : client->offset;
+			iov[count].iov_base = (*it)->data + skip;
+			iov[count].iov_len = (*it)->len - skip;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+			/* sendmsg instead of writev, a vanished client must not raise SIGPIPE */
+		ssize_t written = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (written < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				client->blocked = true;
+				return 0;
+			}
+			if (errno == EINTR)
+				continue;
+			eDebug("[eStreamWriter] client %d send failed: %m", fd);
+			return -1;
+		}
+		client->stats.sent += written;
+		client->stats.backlog -= written;
+		written += client->offset;
+		while (!client->queue.empty() && (size_t)written >= client->queue.front()->len)
+		{
+			written -= client->queue.front()->len;
+			unref(client->queue.front());
+			client->queue.pop_front();
+		}
+		client->offset = written;
+	}
+	return 0;
+}
+
+void eStreamWriter::thread()
+{
+	hasStarted();
+	struct epoll_event events[STREAM_IOV_COUNT];
+	while (1)
+	{
+		int count = epoll_wait(m_epoll, events, STREAM_IOV_COUNT, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			eDebug("[eStreamWriter] epoll_wait failed: %m");
+			break;
+		}
+
+		eSingleLocker lock(m_lock);
+		for (int i = 0; i < count; ++i)
+		{
+			int fd = events[i].data.fd;
+			if (fd == m_wakeup)
+			{
+				eventfd_t value;
+				eventfd_read(m_wakeup, &value);
+				m_wakeup_pending = false;
+				continue;
+			}
+			std::map<int, Client*>::iterator it = m_clients.find(fd);
+			if (it == m_clients.end())
+				continue;
+			Client *client = it->second;
+			client->blocked = false;
+			if (!client->ready && !client->queue.empty())
+			{
+				client->ready = true;
+				m_ready.push_back(fd);
+			}
+		}
+
+		for (std::vector<int>::iterator i = m_ready.begin(); i != m_ready.end(); ++i)
+		{
+			std::map<int, Client*>::iterator it = m_clients.find(*i);
+			if (it == m_clients.end())
+				continue;
+			Client *client = it->second;
+			client->ready = false;
+			if (client->stats.failed)
+				continue;
+			if (send(*i, client) < 0)
+			{
+					/* the read notifier of the stream client notices the
+					   closed connection and removes the client */
+				client->stats.failed = true;
+				release(client);
+			}
+		}
+		m_ready.clear();
+	}
+}
+
+DEFINE_REF(eStreamFanout);
+
+eStreamFanout::eStreamFanout()
+	:m_writer(eStreamWriter::getInstance())
+{
+}
+
+eStreamFanout::~eStreamFanout()
+{
+	for (std::set<int>::iterator it = m_fds.begin(); it != m_fds.end(); ++it)
+		m_writer->removeClient(*it);
+}
+
+int eStreamFanout::addClient(int fd)
+{
+	eSingleLocker lock(m_lock);
+	if (m_writer->addClient(fd) < 0)
+		return -1;
+	m_fds.insert(fd);
+	return 0;
+}
+
+void eStreamFanout::removeClient(int fd)
+{
+	eSingleLocker lock(m_lock);
+	if (m_fds.erase(fd))
+		m_writer->removeClient(fd);
+}
+
+int eStreamFanout::clientCount()
+{
+	eSingleLocker lock(m_lock);
+	return m_fds.size();
+}
+
+void eStreamFanout::push(eStreamChunk *chunk)
+{
+	eSingleLocker lock(m_lock);
+	m_writer->queue(m_fds, chunk);
+}
+
+void eStreamFanout::getStats(std::vector<eStreamClientStats> &stats)
+{
+	eSingleLocker lock(m_lock);
+	m_writer->getStats(m_fds, stats);
+}
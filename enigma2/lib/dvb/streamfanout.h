@@ -0,0 +1,110 @@
+#ifndef __lib_dvb_streamfanout_h
+#define __lib_dvb_streamfanout_h
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <lib/base/object.h>
+#include <lib/base/thread.h>
+#include <lib/base/elock.h>
+
+/*
+ * Output side of the stream server.
+ *
+ * A recorder reads into an eStreamChunk and hands it to its eStreamFanout,
+ * which queues a reference to the chunk for every client of the service.
+ * One eStreamWriter thread serves the clients of all services: it waits on
+ * their non-blocking sockets with epoll and sends each queue with a single
+ * scatter/gather call. A client that cannot keep up loses its oldest chunks
+ * once its queue exceeds the backlog limit, the others are not held up by it.
+ */
+
+struct eStreamChunk
+{
+	int refs;
+	size_t size;		/* allocated */
+	size_t len;		/* valid bytes */
+	unsigned char *data;
+};
+
+struct eStreamClientStats
+{
+	int fd;
+	size_t backlog;		/* bytes queued right now */
+	size_t peak_backlog;	/* largest backlog seen */
+	unsigned long long sent;
+	unsigned int dropped;	/* chunks discarded because the client was too slow */
+	bool failed;
+};
+
+class eStreamWriter: public eThread
+{
+	struct Client
+	{
+		std::deque<eStreamChunk*> queue;
+		size_t offset;		/* bytes of the first chunk already sent */
+		bool ready;		/* on m_ready */
+		bool blocked;		/* socket full, epoll reports when it drains */
+		eStreamClientStats stats;
+	};
+
+	static eStreamWriter *instance;
+
+	std::map<int, Client*> m_clients;
+	std::vector<int> m_ready;
+	std::vector<eStreamChunk*> m_free;
+	eSingleLock m_lock;
+	int m_epoll;
+	int m_wakeup;
+	bool m_wakeup_pending;
+	size_t m_max_backlog;
+
+	eStreamWriter();
+	void unref(eStreamChunk *chunk);
+	void release(Client *client);
+	int send(int fd, Client *client);
+	void thread();
+public:
+	static eStreamWriter *getInstance();
+
+		/* the socket is switched to non-blocking mode, it still belongs to the caller */
+	int addClient(int fd);
+	void removeClient(int fd);
+	bool clientFailed(int fd);
+
+	eStreamChunk *allocChunk(size_t size);
+	void freeChunk(eStreamChunk *chunk);
+		/* queues chunk->len bytes of chunk to every fd, takes over the chunk */
+	void queue(const std::set<int> &fds, eStreamChunk *chunk);
+
+	void getStats(const std::set<int> &fds, std::vector<eStreamClientStats> &stats);
+};
+
+	/* the clients of one service */
+class eStreamFanout: public iObject
+{
+	DECLARE_REF(eStreamFanout);
+
+	std::set<int> m_fds;
+	eSingleLock m_lock;
+	eStreamWriter *m_writer;
+public:
+	eStreamFanout();
+	~eStreamFanout();
+
+	int addClient(int fd);
+	void removeClient(int fd);
+	int clientCount();
+	bool clientFailed(int fd) { return m_writer->clientFailed(fd); }
+
+		/* called by the recorder thread, takes over the chunk */
+	void push(eStreamChunk *chunk);
+	eStreamChunk *allocChunk(size_t size) { return m_writer->allocChunk(size); }
+	void freeChunk(eStreamChunk *chunk) { m_writer->freeChunk(chunk); }
+
+	void getStats(std::vector<eStreamClientStats> &stats);
+};
+
+#endif
@@ -9,6 +9,34 @@
 
 #include <lib/dvb/streamserver.h>
 
+eStreamSession::eStreamSession(eStreamServer *handler, const std::string &serviceref)
+ : parent(handler), m_serviceref(serviceref), m_fanout(new eStreamFanout())
+{
+}
+
+eStreamSession::~eStreamSession()
+{
+	stop();
+	parent->sessionClosed(this);
+}
+
+int eStreamSession::start()
+{
+	return eDVBServiceStream::start(m_serviceref.c_str(), (eStreamFanout*)m_fanout);
+}
+
+void eStreamSession::streamStopped()
+{
+	parent->sessionFailed(this);
+}
+
+void eStreamSession::tuneFailed()
+{
+	parent->sessionFailed(this);
+}
+
+DEFINE_REF(eStreamClient);
+
 eStreamClient::eStreamClient(eStreamServer *handler, int socket)
  : parent(handler), streamFd(socket)
 {
@@ -18,7 +46,12 @@ eStreamClient::eStreamClient(eStreamServer *handler, int socket)
 eStreamClient::~eStreamClient()
 {
 	rsn->stop();
-	stop();
+	if (session)
+	{
+		session->removeClient(streamFd);
+			/* stops streaming when this was the last client of the service */
+		session = 0;
+	}
 	if (streamFd >= 0) ::close(streamFd);
 }
 
@@ -37,7 +70,6 @@ void eStreamClient::notifier(int what)
 		if ((len = singleRead(streamFd, buf, sizeof(buf))) <= 0)
 		{
 			rsn->stop();
-			stop();
 			parent->connectionLost(this);
 			return;
 		}
@@ -57,10 +89,12 @@ void eStreamClient::notifier(int what)
 						{
 							const char *reply = "HTTP/1.0 200 OK\r\nConnection: Close\r\nContent-Type: video/mpeg\r\nServer: streamserver\r\n\r\n";
 							writeAll(streamFd, reply, strlen(reply));
-							if (eDVBServiceStream::start(serviceref.c_str(), streamFd) >= 0)
+							if (parent->getSession(serviceref, session) >= 0 && session->addClient(streamFd) >= 0)
 							{
 								running = true;
 							}
+							else
+								session = 0;
 						}
 					}
 				}
@@ -78,18 +112,6 @@ void eStreamClient::notifier(int what)
 	}
 }
 
-void eStreamClient::streamStopped()
-{
-	rsn->stop();
-	parent->connectionLost(this);
-}
-
-void eStreamClient::tuneFailed()
-{
-	rsn->stop();
-	parent->connectionLost(this);
-}
-
 DEFINE_REF(eStreamServer);
 
 eStreamServer::eStreamServer()
@@ -121,4 +143,44 @@ void eStreamServer::connectionLost(eStreamClient *client)
 	}
 }
 
+int eStreamServer::getSession(const std::string &serviceref, ePtr<eStreamSession> &session)
+{
+	std::map<std::string, eStreamSession *>::iterator it = sessions.find(serviceref);
+	if (it != sessions.end())
+	{
+		session = it->second;
+		return 0;
+	}
+	session = new eStreamSession(this, serviceref);
+	sessions[serviceref] = session;
+	if (session->start() < 0)
+	{
+		session = 0;
+		return -1;
+	}
+	eDebug("[eStreamServer] new session for %s", serviceref.c_str());
+	return 0;
+}
+
+void eStreamServer::sessionFailed(eStreamSession *session)
+{
+		/* the clients hold the last references, keep it alive while we drop them */
+	ePtr<eStreamSession> ref = session;
+	sessionClosed(session);
+	for (eSmartPtrList<eStreamClient>::iterator it = clients.begin(); it != clients.end(); )
+	{
+		if (it->getSession() == session)
+			it = clients.erase(it);
+		else
+			++it;
+	}
+}
+
+void eStreamServer::sessionClosed(eStreamSession *session)
+{
+	std::map<std::string, eStreamSession *>::iterator it = sessions.find(session->getServiceRef());
+	if (it != sessions.end() && it->second == session)
+		sessions.erase(it);
+}
+
 eAutoInitPtr<eStreamServer> init_eStreamServer(eAutoInitNumbers::dvb + 1, "Stream server");
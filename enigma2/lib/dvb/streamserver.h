@@ -1,15 +1,38 @@
 #ifndef __DVB_STREAMSERVER_H_
 #define __DVB_STREAMSERVER_H_
 
+#include <map>
 #include <vector>
 
 #include <lib/network/serversocket.h>
 #include <lib/service/servicedvbstream.h>
+#include <lib/dvb/streamfanout.h>
 
 class eStreamServer;
 
-class eStreamClient: public eDVBServiceStream
+	/* one tuned service and its recorder, shared by all clients of that service */
+class eStreamSession: public eDVBServiceStream
 {
+	eStreamServer *parent;
+	std::string m_serviceref;
+	ePtr<eStreamFanout> m_fanout;
+
+	void streamStopped();
+	void tuneFailed();
+
+public:
+	eStreamSession(eStreamServer *handler, const std::string &serviceref);
+	~eStreamSession();
+
+	int start();
+	const std::string &getServiceRef() const { return m_serviceref; }
+	int addClient(int fd) { return m_fanout->addClient(fd); }
+	void removeClient(int fd) { m_fanout->removeClient(fd); }
+};
+
+class eStreamClient: public iObject, public Object
+{
+	DECLARE_REF(eStreamClient);
 protected:
 	eStreamServer *parent;
 	int streamFd;
@@ -18,17 +41,16 @@ protected:
 
 	void notifier(int);
 	ePtr<eSocketNotifier> rsn;
+	ePtr<eStreamSession> session;
 
 	std::string request;
 
-	void streamStopped();
-	void tuneFailed();
-
 public:
 	eStreamClient(eStreamServer *handler, int socket);
 	~eStreamClient();
 
 	void start();
+	eStreamSession *getSession() { return session; }
 };
 
 class eStreamServer: public eServerSocket
@@ -36,6 +58,7 @@ class eStreamServer: public eServerSocket
 	DECLARE_REF(eStreamServer);
 
 	eSmartPtrList<eStreamClient> clients;
+	std::map<std::string, eStreamSession *> sessions;
 
 	void newConnection(int socket);
 
@@ -44,6 +67,11 @@ public:
 	~eStreamServer();
 
 	void connectionLost(eStreamClient *client);
+
+		/* returns the running session of serviceref, or starts one */
+	int getSession(const std::string &serviceref, ePtr<eStreamSession> &session);
+	void sessionFailed(eStreamSession *session);
+	void sessionClosed(eStreamSession *session);
 };
 
 #endif /* __DVB_STREAMSERVER_H_ */
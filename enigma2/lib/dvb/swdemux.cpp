@@ -0,0 +1,581 @@
+#include <lib/dvb/swdemux.h>
+#include <lib/base/eerror.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/dvb/dmx.h>
+
+#include "crc32.h"
+
+#define SOFTDEMUX_BUFFER	(1024*1024)	/* kernel buffer of the shared demux fd */
+#define SOFTDEMUX_READ		(188*348)	/* a little less than 64 KiB per read */
+#define SOFTDEMUX_QUEUE		(256*1024)	/* default queue of a reader */
+#define SOFTDEMUX_PES_CHUNK	16384		/* PES data is delivered in chunks like the kernel reader reads it */
+#define MAX_SECTION_SIZE	4096
+
+DEFINE_REF(eDVBSoftDemux);
+
+eDVBSoftDemux::eDVBSoftDemux(int adapter, int demux)
+	:m_adapter(adapter), m_demux(demux), m_fd(-1), m_filter_set(false), m_running(false), m_stop(false),
+	m_buffer(SOFTDEMUX_READ + 188)
+{
+	m_wakeup = eventfd(0, EFD_NONBLOCK);
+	if (m_wakeup < 0)
+		eDebug("[eDVBSoftDemux] eventfd failed: %m");
+}
+
+eDVBSoftDemux::~eDVBSoftDemux()
+{
+		/* each reader holds a reference, so they are all gone by now */
+	stopThread();
+	if (m_fd >= 0)
+		::close(m_fd);
+	if (m_wakeup >= 0)
+		::close(m_wakeup);
+}
+
+int eDVBSoftDemux::startPID(int pid)
+{
+	if (m_fd < 0)
+	{
+		char filename[64];
+		snprintf(filename, sizeof(filename), "/dev/dvb/adapter%d/demux%d", m_adapter, m_demux);
+		m_fd = ::open(filename, O_RDWR | O_NONBLOCK);
+		if (m_fd < 0)
+		{
+			eDebug("[eDVBSoftDemux] cannot open %s: %m", filename);
+			return -1;
+		}
+		if (::ioctl(m_fd, DMX_SET_BUFFER_SIZE, SOFTDEMUX_BUFFER) < 0)
+			eDebug("[eDVBSoftDemux] DMX_SET_BUFFER_SIZE failed: %m");
+		m_filter_set = false;
+	}
+
+	if (!m_filter_set)
+	{
+		dmx_pes_filter_params flt;
+		flt.pes_type = DMX_PES_OTHER;
+		flt.pid = pid;
+		flt.input = DMX_IN_FRONTEND;
+		flt.output = DMX_OUT_TSDEMUX_TAP;
+		flt.flags = DMX_IMMEDIATE_START;
+		if (::ioctl(m_fd, DMX_SET_PES_FILTER, &flt) < 0)
+		{
+			eDebug("[eDVBSoftDemux] DMX_SET_PES_FILTER for pid %04x failed: %m", pid);
+			return -1;
+		}
+		m_filter_set = true;
+		return 0;
+	}
+
+	__u16 p = pid;
+	while (::ioctl(m_fd, DMX_ADD_PID, &p) < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			continue;
+		eDebug("[eDVBSoftDemux] DMX_ADD_PID %04x failed: %m", pid);
+		return -1;
+	}
+	return 0;
+}
+
+void eDVBSoftDemux::stopPID(int pid)
+{
+	__u16 p = pid;
+	while (::ioctl(m_fd, DMX_REMOVE_PID, &p) < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			continue;
+		eDebug("[eDVBSoftDemux] DMX_REMOVE_PID %04x failed: %m", pid);
+		break;
+	}
+}
+
+void eDVBSoftDemux::stopThread()
+{
+	if (!m_running)
+		return;
+	m_stop = true;
+	eventfd_write(m_wakeup, 1);
+	kill();
+	eventfd_t value;
+	eventfd_read(m_wakeup, &value);
+	m_running = false;
+}
+
+int eDVBSoftDemux::addReader(int pid, eDVBSoftReader *reader)
+{
+	eSingleLocker run_lock(m_run_lock);
+	if (m_wakeup < 0)
+		return -1;
+	bool new_pid;
+	{
+		eSingleLocker lock(m_lock);
+		new_pid = m_pids.find(pid) == m_pids.end();
+	}
+	if (new_pid && startPID(pid) < 0)
+	{
+		if (m_pids.empty())
+		{
+			::close(m_fd);
+			m_fd = -1;
+		}
+		return -1;
+	}
+	{
+		eSingleLocker lock(m_lock);
+		if (new_pid)
+		{
+			pidState &state = m_pids[pid];
+			state.cc = -1;
+			state.sync = false;
+		}
+		m_pids[pid].readers.push_back(reader);
+	}
+	if (!m_running)
+	{
+		m_stop = false;
+		m_running = true;
+		run();
+	}
+	return 0;
+}
+
+void eDVBSoftDemux::removeReader(int pid, eDVBSoftReader *reader)
+{
+	eSingleLocker run_lock(m_run_lock);
+	bool last_reader = false, empty;
+	{
+		eSingleLocker lock(m_lock);
+		std::map<int, pidState>::iterator it = m_pids.find(pid);
+		if (it == m_pids.end())
+			return;
+		std::vector<eDVBSoftReader*> &readers = it->second.readers;
+		readers.erase(std::remove(readers.begin(), readers.end(), reader), readers.end());
+		if (readers.empty())
+		{
+			m_pids.erase(it);
+			last_reader = true;
+		}
+		empty = m_pids.empty();
+	}
+	if (empty)
+	{
+			/* the next reader starts over with a fresh fd and filter */
+		stopThread();
+		::close(m_fd);
+		m_fd = -1;
+	}
+	else if (last_reader)
+		stopPID(pid);
+}
+
+void eDVBSoftDemux::thread()
+{
+	hasStarted();
+	struct pollfd pfd[2];
+	pfd[0].fd = m_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = m_wakeup;
+	pfd[1].events = POLLIN;
+	__u8 *buffer = &m_buffer[0];
+	int fill = 0;
+
+	while (!m_stop)
+	{
+		if (::poll(pfd, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			eDebug("[eDVBSoftDemux] poll failed: %m");
+			break;
+		}
+		if (pfd[1].revents)
+			continue;
+		if (!(pfd[0].revents & (POLLIN | POLLERR)))
+			continue;
+
+		ssize_t r = ::read(m_fd, buffer + fill, SOFTDEMUX_READ);
+		if (r < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			if (errno == EOVERFLOW)
+			{
+				eWarning("[eDVBSoftDemux] demux%d overflow", m_demux);
+				fill = 0;
+				eSingleLocker lock(m_lock);
+				for (std::map<int, pidState>::iterator it = m_pids.begin(); it != m_pids.end(); ++it)
+				{
+					it->second.cc = -1;
+					it->second.sync = false;
+					it->second.section.clear();
+				}
+				continue;
+			}
+			eDebug("[eDVBSoftDemux] read failed: %m");
+			break;
+		}
+		fill += r;
+
+		int pos = 0;
+		{
+			eSingleLocker lock(m_lock);
+			while (fill - pos >= 188)
+			{
+				if (buffer[pos] != 0x47)
+				{
+					++pos;	/* resync */
+					continue;
+				}
+				packet(buffer + pos);
+				pos += 188;
+			}
+		}
+		fill -= pos;
+		memmove(buffer, buffer + pos, fill);
+	}
+}
+
+void eDVBSoftDemux::packet(const __u8 *pkt)
+{
+	int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+	std::map<int, pidState>::iterator it = m_pids.find(pid);
+	if (it == m_pids.end())
+		return;
+	pidState &state = it->second;
+
+	if (pkt[1] & 0x80)	/* transport error */
+	{
+		state.cc = -1;
+		state.sync = false;
+		state.section.clear();
+		return;
+	}
+	int afc = (pkt[3] >> 4) & 3;
+	if (!(afc & 1))		/* no payload */
+		return;
+	int cc = pkt[3] & 0x0F;
+	if (state.cc == cc)	/* duplicate */
+		return;
+	if (state.cc >= 0 && cc != ((state.cc + 1) & 0x0F))
+	{
+		state.sync = false;
+		state.section.clear();
+	}
+	state.cc = cc;
+
+	int offset = 4;
+	if (afc & 2)
+		offset += 1 + pkt[4];
+	if (offset >= 188)
+		return;
+	const __u8 *payload = pkt + offset;
+	int len = 188 - offset;
+	bool pusi = pkt[1] & 0x40;
+
+	bool sections = false;
+	for (std::vector<eDVBSoftReader*>::iterator i = state.readers.begin(); i != state.readers.end(); ++i)
+	{
+		eDVBSoftReader *reader = *i;
+		if (reader->m_sections)
+		{
+			sections = true;
+			continue;
+		}
+		if (pusi)
+			reader->m_pes_started = true;
+		if (reader->m_pes_started)
+			reader->queue(payload, len);
+	}
+	if (!sections)
+		return;
+
+	if (pusi)
+	{
+		int pointer = payload[0];
+		++payload;
+		--len;
+		if (pointer >= len)
+		{
+			state.sync = false;
+			state.section.clear();
+			return;
+		}
+			/* the pointer field skips the rest of the previous section */
+		if (state.sync)
+			sectionData(state, payload, pointer);
+		payload += pointer;
+		len -= pointer;
+		state.section.clear();
+		state.sync = true;
+	}
+	if (state.sync)
+		sectionData(state, payload, len);
+}
+
+void eDVBSoftDemux::sectionData(pidState &state, const __u8 *data, int len)
+{
+	std::vector<__u8> &s = state.section;
+	while (len > 0 && state.sync)
+	{
+		if (s.empty() && data[0] == 0xFF)
+		{
+				/* stuffing up to the next unit start */
+			state.sync = false;
+			return;
+		}
+		size_t want = s.size() < 3 ? 3 : 3 + (((s[1] & 0x0F) << 8) | s[2]);
+		int take = std::min((size_t)len, want - s.size());
+		s.insert(s.end(), data, data + take);
+		data += take;
+		len -= take;
+		if (s.size() < 3)
+			continue;
+		size_t total = 3 + (((s[1] & 0x0F) << 8) | s[2]);
+		if (total > MAX_SECTION_SIZE)
+		{
+			state.sync = false;
+			s.clear();
+			return;
+		}
+		if (s.size() == total)
+		{
+			section(state);
+			s.clear();
+		}
+	}
+}
+
+void eDVBSoftDemux::section(pidState &state)
+{
+	const __u8 *data = &state.section[0];
+	int len = state.section.size();
+	int crc_failed = -1;	/* computed once, for the first reader that asks */
+	for (std::vector<eDVBSoftReader*>::iterator i = state.readers.begin(); i != state.readers.end(); ++i)
+	{
+		eDVBSoftReader *reader = *i;
+		if (!reader->m_sections || !reader->matches(data, len))
+			continue;
+		if (reader->m_check_crc)
+		{
+			if (crc_failed < 0)
+				crc_failed = crc32((unsigned)-1, data, len) ? 1 : 0;
+			if (crc_failed)
+				continue;
+		}
+		reader->queue(data, len);
+	}
+}
+
+eDVBSoftReader::eDVBSoftReader(eDVBSoftDemux *soft, eMainloop *context, bool sections, RESULT &res)
+	:m_max_queue(SOFTDEMUX_QUEUE), m_dropped(0), m_generation(0), m_soft(soft),
+	m_pid(-1), m_sections(sections), m_check_crc(false), m_pes_started(false)
+{
+	m_event = eventfd(0, EFD_NONBLOCK);
+	if (m_event < 0)
+	{
+		eDebug("[eDVBSoftDemux] eventfd failed: %m");
+		res = errno;
+		return;
+	}
+	m_notifier = eSocketNotifier::create(context, m_event, eSocketNotifier::Read, false);
+	res = 0;
+}
+
+eDVBSoftReader::~eDVBSoftReader()
+{
+		/* the subclass already stopped, the thread must not call matches() on a half destroyed reader */
+	if (m_event >= 0)
+		::close(m_event);
+}
+
+int eDVBSoftReader::startReader(int pid)
+{
+	if (m_event < 0)
+		return -ENODEV;
+	stopReader();
+	m_pes_started = false;
+	if (m_soft->addReader(pid, this) < 0)
+		return -1;
+	m_pid = pid;
+	m_notifier->start();
+	return 0;
+}
+
+void eDVBSoftReader::stopReader()
+{
+	if (m_pid < 0)
+		return;
+	m_soft->removeReader(m_pid, this);
+	m_pid = -1;
+	m_notifier->stop();
+	eSingleLocker lock(m_lock);
+	m_queue.clear();
+	++m_generation;
+}
+
+void eDVBSoftReader::setQueueSize(int size)
+{
+	eSingleLocker lock(m_lock);
+	m_max_queue = std::max(size, SOFTDEMUX_QUEUE);
+}
+
+void eDVBSoftReader::queue(const __u8 *data, int len)
+{
+	eSingleLocker lock(m_lock);
+	if (m_queue.size() + len > m_max_queue)
+	{
+		if (!(m_dropped++ % 100))
+			eDebug("[eDVBSoftDemux] reader %p too slow, %u packets or sections dropped", this, m_dropped);
+		return;
+	}
+	bool wakeup = m_queue.empty();
+	m_queue.insert(m_queue.end(), data, data + len);
+	if (wakeup)
+		eventfd_write(m_event, 1);
+}
+
+unsigned int eDVBSoftReader::takeQueue(std::vector<__u8> &data)
+{
+	eventfd_t value;
+	eventfd_read(m_event, &value);
+	eSingleLocker lock(m_lock);
+	data.swap(m_queue);
+	return m_generation;
+}
+
+DEFINE_REF(eDVBSoftSectionReader);
+
+eDVBSoftSectionReader::eDVBSoftSectionReader(eDVBSoftDemux *soft, eMainloop *context, RESULT &res)
+	:eDVBSoftReader(soft, context, true, res)
+{
+	if (!res)
+		CONNECT(m_notifier->activated, eDVBSoftSectionReader::data);
+}
+
+eDVBSoftSectionReader::~eDVBSoftSectionReader()
+{
+	stopReader();
+}
+
+bool eDVBSoftSectionReader::matches(const __u8 *section, int len)
+{
+		/* like the kernel: filter byte 0 is table_id, the others skip the section length */
+	for (int i = 0; i < DMX_FILTER_SIZE; ++i)
+	{
+		int pos = i ? i + 2 : 0;
+		if (pos >= len)
+			break;
+		__u8 diff = (section[pos] ^ m_mask.data[i]) & m_mask.mask[i] & ~m_mask.mode[i];
+		if (diff)
+			return false;
+	}
+	bool negative = false, differs = false;
+	for (int i = 0; i < DMX_FILTER_SIZE; ++i)
+	{
+		__u8 bits = m_mask.mask[i] & m_mask.mode[i];
+		if (!bits)
+			continue;
+		negative = true;
+		int pos = i ? i + 2 : 0;
+		if (pos < len && ((section[pos] ^ m_mask.data[i]) & bits))
+			differs = true;
+	}
+	return !negative || differs;
+}
+
+void eDVBSoftSectionReader::data(int)
+{
+	ePtr<eDVBSoftSectionReader> ref = this;	/* a callback may drop the last other reference */
+	std::vector<__u8> data;
+	unsigned int generation = takeQueue(data);
+	size_t pos = 0;
+	while (pos + 3 <= data.size() && isCurrent(generation))
+	{
+		const __u8 *section = &data[pos];
+		pos += 3 + (((section[1] & 0x0F) << 8) | section[2]);
+		m_read(section);
+	}
+}
+
+RESULT eDVBSoftSectionReader::setBufferSize(int size)
+{
+	setQueueSize(size);
+	return 0;
+}
+
+RESULT eDVBSoftSectionReader::start(const eDVBSectionFilterMask &mask)
+{
+	m_mask = mask;
+	m_check_crc = mask.flags & eDVBSectionFilterMask::rfCRC;
+	return startReader(mask.pid);
+}
+
+RESULT eDVBSoftSectionReader::stop()
+{
+	if (m_pid < 0)
+		return -1;
+	stopReader();
+	return 0;
+}
+
+RESULT eDVBSoftSectionReader::connectRead(const Slot1<void,const __u8*> &r, ePtr<eConnection> &conn)
+{
+	conn = new eConnection(this, m_read.connect(r));
+	return 0;
+}
+
+DEFINE_REF(eDVBSoftPESReader);
+
+eDVBSoftPESReader::eDVBSoftPESReader(eDVBSoftDemux *soft, eMainloop *context, RESULT &res)
+	:eDVBSoftReader(soft, context, false, res)
+{
+	if (!res)
+		CONNECT(m_notifier->activated, eDVBSoftPESReader::data);
+}
+
+eDVBSoftPESReader::~eDVBSoftPESReader()
+{
+	stopReader();
+}
+
+void eDVBSoftPESReader::data(int)
+{
+	ePtr<eDVBSoftPESReader> ref = this;
+	std::vector<__u8> data;
+	unsigned int generation = takeQueue(data);
+	for (size_t pos = 0; pos < data.size() && isCurrent(generation); pos += SOFTDEMUX_PES_CHUNK)
+		m_read(&data[pos], std::min(data.size() - pos, (size_t)SOFTDEMUX_PES_CHUNK));
+}
+
+RESULT eDVBSoftPESReader::setBufferSize(int size)
+{
+	setQueueSize(size);
+	return 0;
+}
+
+RESULT eDVBSoftPESReader::start(int pid)
+{
+	return startReader(pid);
+}
+
+RESULT eDVBSoftPESReader::stop()
+{
+	if (m_pid < 0)
+		return -1;
+	stopReader();
+	return 0;
+}
+
+RESULT eDVBSoftPESReader::connectRead(const Slot2<void,const __u8*,int> &r, ePtr<eConnection> &conn)
+{
+	conn = new eConnection(this, m_read.connect(r));
+	return 0;
+}
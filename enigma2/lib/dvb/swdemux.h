@@ -0,0 +1,132 @@
+#ifndef __lib_dvb_swdemux_h
+#define __lib_dvb_swdemux_h
+
+#include <map>
+#include <vector>
+
+#include <lib/base/ebase.h>
+#include <lib/base/elock.h>
+#include <lib/base/thread.h>
+#include <lib/dvb/idemux.h>
+
+class eDVBSoftReader;
+
+/*
+ * The software demultiplexer, used for the section and PES readers when
+ * config.usage.software_demux is set.
+ *
+ * The kernel readers each open the demux device with a filter of their
+ * own, and the kernel copies the data into every one of them. Here all
+ * readers of a demux share a single demux fd in TS tap mode, which carries
+ * the packets of each PID somebody wants. One thread takes the packets
+ * apart, assembles the sections of a PID once and queues every reader what
+ * its filter matches. A PID takes one hardware filter, however many readers
+ * want it, which helps tuners with few filter slots.
+ *
+ * The readers keep the interface and threading of the kernel ones, each is
+ * woken up in its own mainloop once data is queued for it.
+ */
+class eDVBSoftDemux: public iObject, private eThread
+{
+	DECLARE_REF(eDVBSoftDemux);
+
+	struct pidState
+	{
+		int cc;				/* continuity counter of the last packet, -1 after a gap */
+		bool sync;			/* section points to the start of a section */
+		std::vector<__u8> section;	/* being assembled */
+		std::vector<eDVBSoftReader*> readers;
+	};
+
+	int m_adapter, m_demux;
+	int m_fd, m_wakeup;
+	bool m_filter_set;		/* later pids are added to the filter */
+	bool m_running;
+	volatile bool m_stop;
+	std::vector<__u8> m_buffer;	/* read by the thread, with the partial packet left over */
+		/* m_run_lock serialises the readers coming and going, and so
+		   starting and stopping the thread. m_lock guards m_pids, the
+		   thread holds it while it dispatches */
+	eSingleLock m_run_lock, m_lock;
+	std::map<int, pidState> m_pids;
+
+	int startPID(int pid);
+	void stopPID(int pid);
+	void stopThread();
+	void thread();
+	void packet(const __u8 *pkt);
+	void sectionData(pidState &state, const __u8 *data, int len);
+	void section(pidState &state);
+public:
+	eDVBSoftDemux(int adapter, int demux);
+	~eDVBSoftDemux();
+
+	int addReader(int pid, eDVBSoftReader *reader);
+		/* after it returns the thread does not touch the reader anymore */
+	void removeReader(int pid, eDVBSoftReader *reader);
+};
+
+	/* the queue between the demux thread and the mainloop of a reader */
+class eDVBSoftReader
+{
+	friend class eDVBSoftDemux;
+	int m_event;
+	eSingleLock m_lock;
+	std::vector<__u8> m_queue;
+	size_t m_max_queue;
+	unsigned int m_dropped, m_generation;
+protected:
+	ePtr<eDVBSoftDemux> m_soft;
+	ePtr<eSocketNotifier> m_notifier;
+	int m_pid;			/* -1 while stopped */
+	bool m_sections;
+	bool m_check_crc;
+	bool m_pes_started;		/* a PES reader saw the start of a PES packet */
+
+	eDVBSoftReader(eDVBSoftDemux *soft, eMainloop *context, bool sections, RESULT &res);
+	virtual ~eDVBSoftReader();
+	int startReader(int pid);
+	void stopReader();
+		/* the kernel readers reset their buffer size on start, so a caller
+		   asking for less than the default gets the default */
+	void setQueueSize(int size);
+		/* called by the demux thread */
+	void queue(const __u8 *data, int len);
+	virtual bool matches(const __u8 *section, int len) { return true; }
+		/* called in the mainloop, moves the queued data to data and returns
+		   the generation, delivering stops once isCurrent says otherwise */
+	unsigned int takeQueue(std::vector<__u8> &data);
+	bool isCurrent(unsigned int generation) { return m_pid >= 0 && m_generation == generation; }
+};
+
+class eDVBSoftSectionReader: public iDVBSectionReader, public eDVBSoftReader, public Object
+{
+	DECLARE_REF(eDVBSoftSectionReader);
+	eDVBSectionFilterMask m_mask;
+	Signal1<void, const __u8*> m_read;
+	bool matches(const __u8 *section, int len);
+	void data(int);
+public:
+	eDVBSoftSectionReader(eDVBSoftDemux *soft, eMainloop *context, RESULT &res);
+	virtual ~eDVBSoftSectionReader();
+	RESULT setBufferSize(int size);
+	RESULT start(const eDVBSectionFilterMask &mask);
+	RESULT stop();
+	RESULT connectRead(const Slot1<void,const __u8*> &read, ePtr<eConnection> &conn);
+};
+
+class eDVBSoftPESReader: public iDVBPESReader, public eDVBSoftReader, public Object
+{
+	DECLARE_REF(eDVBSoftPESReader);
+	Signal2<void, const __u8*, int> m_read;
+	void data(int);
+public:
+	eDVBSoftPESReader(eDVBSoftDemux *soft, eMainloop *context, RESULT &res);
+	virtual ~eDVBSoftPESReader();
+	RESULT setBufferSize(int size);
+	RESULT start(int pid);
+	RESULT stop();
+	RESULT connectRead(const Slot2<void,const __u8*, int> &read, ePtr<eConnection> &conn);
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <lib/base/init.h>
 #include <lib/base/init_num.h>
 #include <lib/base/eenv.h>
+#include <lib/base/tsshmring.h>
 #include <lib/driver/input_fake.h>
 #include <lib/driver/rcxlib.h>
 
@@ -61,6 +62,8 @@ gXlibDC::gXlibDC() : m_pump(eApp, 1)
 	
 	umask(0);
 	mknod("/tmp/ENIGMA_FIFO", S_IFIFO|0666, 0);
+	/* preferred over the FIFO, xine attaches to it when it exists */
+	eTsShmRing::getInstance();
 
 	CONNECT(m_pump.recv_msg, gXlibDC::pumpEvent);
 
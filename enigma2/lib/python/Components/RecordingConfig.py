@@ -14,3 +14,10 @@ def InitRecordingConfig():
 		("short", _("Short filenames")),
 		("long", _("Long filenames")) ] )
 	config.recording.offline_decode_delay = ConfigNumber(default = 1000)
+	config.recording.preallocate = ConfigSelection(default = "0", choices = [
+		("0", _("no")),
+		("16", "16 MB"),
+		("64", "64 MB"),
+		("256", "256 MB") ] )
+	config.recording.direct_io = ConfigYesNo(default = False)
+	config.recording.io_uring = ConfigYesNo(default = False)
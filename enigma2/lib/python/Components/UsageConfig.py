@@ -51,6 +51,7 @@ def InitUsageConfig():
 	config.usage.infobar_frontend_source = ConfigSelection(default = "tuner", choices = [("settings", _("Settings")), ("tuner", _("Tuner"))])
 	config.usage.show_spinner = ConfigYesNo(default = True)
 	config.usage.enable_tt_caching = ConfigYesNo(default = True)
+	config.usage.software_demux = ConfigYesNo(default = False)
 	choicelist = []
 	for i in (10, 30):
 		choicelist.append(("%d" % i, ngettext("%d second", "%d seconds", i) % i))
@@ -278,6 +279,10 @@ def InitUsageConfig():
 		eEPGCache.getInstance().setEpgHistorySeconds(config.epg.histminutes.getValue()*60)
 	config.epg.histminutes.addNotifier(EpgHistorySecondsChanged)
 
+	# read by eEPGHarvester on each round
+	config.epg.harvest = ConfigYesNo(default = False)
+	config.epg.harvest_tuners = ConfigSelectionNumber(min = 1, max = 8, stepwidth = 1, default = 2, wraparound = True)
+
 	def setHDDStandby(configElement):
 		for hdd in harddiskmanager.HDDList():
 			hdd[1].setIdleTime(int(configElement.value))
@@ -475,11 +480,13 @@ def InitUsageConfig():
 	config.pc.image4_3_zoom_y = ConfigNumber(default = 100)
 	config.pc.image16_9_zoom_x = ConfigNumber(default = 100)
 	config.pc.image16_9_zoom_y = ConfigNumber(default = 100)
+	config.pc.dvr_readahead = ConfigNumber(default = 64)
 	config.streaming = ConfigSubsection()
 	config.streaming.stream_ecm = ConfigYesNo(default = False)
 	config.streaming.descramble = ConfigYesNo(default = True)
 	config.streaming.stream_eit = ConfigYesNo(default = True)
 	config.streaming.stream_ait = ConfigYesNo(default = True)
+	config.streaming.client_backlog = ConfigNumber(default = 2048)
 #	config.pc.initial_window_width = ConfigNumber(default = 0)
 #	config.pc.initial_window_height = ConfigNumber(default = 0)
 
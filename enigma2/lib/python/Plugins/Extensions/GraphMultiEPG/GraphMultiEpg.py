@@ -30,12 +30,43 @@ from enigma import eEPGCache, eListbox, gFont, eListboxPythonMultiContent, RT_HA
 	RT_VALIGN_CENTER, RT_WRAP, BT_SCALE, BT_KEEP_ASPECT_RATIO, eSize, eRect, eTimer, getBestPlayableServiceReference, loadPNG
 from GraphMultiEpgSetup import GraphMultiEpgSetup
 from time import localtime, time, strftime
+from struct import Struct
 from Components.PluginComponent import plugins
 from Plugins.Plugin import PluginDescriptor
 from Tools.BoundFunction import boundFunction
 
 MAX_TIMELINES = 6
 
+# records of eEPGCache.lookupEventGrid, eEPGGridService and eEPGGridEvent in epgcache.h
+GRID_SERVICE = Struct("=III")	# first event, name offset, name length
+GRID_EVENT = Struct("=IIIHH")	# begin, duration, title offset, title length, event id
+
+class EPGGridRow(object):
+	# the events of one service, (event_id, event_title, begin_time, duration)
+	# tuples unpacked from the packed lookup result only when asked for
+	__slots__ = ("events", "strings", "first", "count")
+
+	def __init__(self, events, strings, first, count):
+		self.events = events
+		self.strings = strings
+		self.first = first
+		self.count = count
+
+	def __len__(self):
+		return self.count
+
+	def __getitem__(self, idx):
+		if idx < 0:
+			idx += self.count
+		if idx < 0 or idx >= self.count:
+			raise IndexError("event index out of range")
+		begin, duration, title, title_len, event_id = GRID_EVENT.unpack_from(self.events, (self.first + idx) * GRID_EVENT.size)
+		return (event_id, self.strings[title:title + title_len], begin, duration)
+
+	def __iter__(self):
+		for idx in xrange(self.count):
+			yield self[idx]
+
 config.misc.graph_mepg = ConfigSubsection()
 config.misc.graph_mepg.prev_time = ConfigClock(default = time())
 config.misc.graph_mepg.prev_time_period = ConfigInteger(default = 120, limits = (60, 300))
@@ -585,38 +616,28 @@ class EPGList(HTMLComponent, GUIComponent):
 			self.time_base = int(stime)
 		if services is None:
 			time_base = self.time_base + self.offs * self.time_epoch * 60
-			test = [ (service[0], 0, time_base, self.time_epoch) for service in self.list ]
+			refs = [ service[0] for service in self.list ]
 			serviceList = self.list
 			piconIdx = 3
 		else:
 			self.cur_event = None
 			self.cur_service = None
-			test = [ (service.ref.toString(), 0, self.time_base, self.time_epoch) for service in services ]
+			time_base = self.time_base
+			refs = [ service.ref.toString() for service in services ]
 			serviceList = services
 			piconIdx = 0
 
-		test.insert(0, 'XRnITBD') #return record, service ref, service name, event id, event title, begin time, duration
-		epg_data = [] if self.epgcache is None else self.epgcache.lookupEvent(test)
 		self.list = [ ]
-		tmp_list = None
-		service = ""
-		sname = ""
-
-		serviceIdx = 0
-		for x in epg_data:
-			if service != x[0]:
-				if tmp_list is not None:
-					picon = None if piconIdx == 0 else serviceList[serviceIdx][piconIdx]
-					self.list.append((service, sname, tmp_list[0][0] is not None and tmp_list or None, picon))
-					serviceIdx += 1
-				service = x[0]
-				sname = x[1]
-				tmp_list = [ ]
-			tmp_list.append((x[2], x[3], x[4], x[5])) #(event_id, event_title, begin_time, duration)
-		if tmp_list and len(tmp_list):
+		if self.epgcache is None or not refs:
+			index, events, strings = "", "", ""
+		else:
+			index, events, strings = self.epgcache.lookupEventGrid(refs, time_base, self.time_epoch)
+		for serviceIdx in range(len(index) / GRID_SERVICE.size - 1):
+			first, name, name_len = GRID_SERVICE.unpack_from(index, serviceIdx * GRID_SERVICE.size)
+			count = GRID_SERVICE.unpack_from(index, (serviceIdx + 1) * GRID_SERVICE.size)[0] - first
 			picon = None if piconIdx == 0 else serviceList[serviceIdx][piconIdx]
-			self.list.append((service, sname, tmp_list[0][0] is not None and tmp_list or None, picon))
-			serviceIdx += 1
+			row = count and EPGGridRow(events, strings, first, count) or None
+			self.list.append((refs[serviceIdx], strings[name:name + name_len], row, picon))
 
 		self.l.setList(self.list)
 		self.findBestEvent()
@@ -90,6 +90,8 @@ public:
 	RESULT parseFrom(const std::string& filename, int tsidonid=0);
 	static void setEPGLanguage(const std::string& language) { m_language = language; }
 	static void setEPGLanguageAlternative(const std::string& language) { m_language_alternative = language; }
+	static const std::string &getEPGLanguage() { return m_language; }
+	static const std::string &getEPGLanguageAlternative() { return m_language_alternative; }
 #endif
 	time_t getBeginTime() const { return m_begin; }
 	int getDuration() const { return m_duration; }
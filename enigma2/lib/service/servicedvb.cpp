@@ -18,6 +18,7 @@
 #include <lib/python/python.h>
 #include <lib/base/nconfig.h> // access to python config
 #include <lib/base/httpstream.h>
+#include <lib/base/tsshmring.h>
 
 		/* for subtitles */
 #include <lib/gui/esubtitle.h>
@@ -1226,12 +1227,16 @@ void eDVBServicePlay::serviceEvent(int event)
                         if (!m_openpliPC_record)
                                 return;
 
-                        if (m_openpliPC_fd < 0)
+                        eTsShmRing *ring = eTsShmRing::getInstance();
+                        if (ring)
+                                m_openpliPC_record->setTargetRing(ring);
+                        else if (m_openpliPC_fd < 0)
                         {
                                 m_openpliPC_record = 0;
                                 return;
                         }
-                        m_openpliPC_record->setTargetFD(m_openpliPC_fd);
+                        else
+                                m_openpliPC_record->setTargetFD(m_openpliPC_fd);
                         m_openpliPC_record->setTargetFilename(m_openpliPC_file);
                         m_openpliPC_record->enableAccessPoints(false);
                         updateTimeshiftPids(); // workaround to set PIDs
@@ -2769,12 +2774,18 @@ void eDVBServicePlay::switchToLive()
 		if (!m_openpliPC_record)
 			return;
 
-		if (m_openpliPC_fd < 0)
+		/* xine attaches to the ring whenever there is one, the FIFO
+		   may also have been closed when timeshift started */
+		eTsShmRing *ring = eTsShmRing::getInstance();
+		if (ring)
+			m_openpliPC_record->setTargetRing(ring);
+		else if (m_openpliPC_fd < 0)
 		{
 			m_openpliPC_record = 0;
 			return;
 		}
-		m_openpliPC_record->setTargetFD(m_openpliPC_fd);
+		else
+			m_openpliPC_record->setTargetFD(m_openpliPC_fd);
 		m_openpliPC_record->setTargetFilename(m_openpliPC_file);
 		m_openpliPC_record->enableAccessPoints(false);
 		updateTimeshiftPids(); // workaround to set PIDs
@@ -2847,10 +2858,7 @@ void eDVBServicePlay::switchToTimeshift()
 
 	m_cue->seekTo(0, -1000);
 
-	ePtr<iTsSource> source = createTsSource(r);
-	m_service_handler_timeshift.tuneExt(r, 1, source, m_timeshift_file.c_str(), m_cue, 0, m_dvb_service, eDVBServicePMTHandler::timeshift_playback, false); /* use the decoder demux for everything */
-
-/* stop openpliPC
+// stop openpliPC before the timeshift filepush starts producing for xine
 	if (m_openpliPC_record)
 	{
 		m_openpliPC_record->stop();
@@ -2861,23 +2869,16 @@ void eDVBServicePlay::switchToTimeshift()
 		close(m_openpliPC_fd);
 		m_openpliPC_fd = -1;
 	}
-*/
+	eTsShmRing *ring = eTsShmRing::getInstance();
+	if (ring)
+		ring->flush();
+
+	ePtr<iTsSource> source = createTsSource(r);
+	m_service_handler_timeshift.tuneExt(r, 1, source, m_timeshift_file.c_str(), m_cue, 0, m_dvb_service, eDVBServicePMTHandler::timeshift_playback, false); /* use the decoder demux for everything */
+
 	eDebug("eDVBServicePlay::switchToTimeshift, in pause mode now.");
 	pause();
 	updateDecoder(true); /* mainly to switch off PCR, and to set pause */
-
-// stop openpliPC
-        if (m_openpliPC_record)
-        {
-                m_openpliPC_record->stop();
-                m_openpliPC_record = 0;
-        }
-        if (m_openpliPC_fd > 0) {
-                printf("Switch from Live TV to Timeshift, close(m_openpliPC_fd) %d\n", m_openpliPC_fd);
-                close(m_openpliPC_fd);
-                m_openpliPC_fd = -1;
-        }
-//
 }
 
 void eDVBServicePlay::updateDecoder(bool sendSeekableStateChanged)
@@ -82,6 +82,16 @@ int eDVBServiceStream::start(const char *serviceref, int fd)
 	return doRecord();
 }
 
+int eDVBServiceStream::start(const char *serviceref, eStreamFanout *fanout)
+{
+	if (m_state != stateIdle) return -1;
+	m_ref = eServiceReferenceDVB(serviceref);
+	if (doPrepare() < 0) return -1;
+	m_target_fanout = fanout;
+	m_want_record = 1;
+	return doRecord();
+}
+
 RESULT eDVBServiceStream::stop()
 {
 	eDebug("stop streaming");
@@ -144,7 +154,10 @@ int eDVBServiceStream::doRecord()
 			eDebug("eDVBServiceStream - no ts recorder available.");
 			return -1;
 		}
-		m_record->setTargetFD(m_target_fd);
+		if (m_target_fanout)
+			m_record->setTargetFanout(m_target_fanout);
+		else
+			m_record->setTargetFD(m_target_fd);
 		m_record->connectEvent(slot(*this, &eDVBServiceStream::recordEvent), m_con_record_event);
 	}
 
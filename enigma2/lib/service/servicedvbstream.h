@@ -5,6 +5,7 @@
 
 #include <lib/dvb/pmt.h>
 #include <lib/dvb/eit.h>
+#include <lib/dvb/streamfanout.h>
 #include <set>
 
 #include <lib/service/servicedvb.h>
@@ -15,6 +16,8 @@ class eDVBServiceStream: public eDVBServiceBase, public Object
 public:
 	eDVBServiceStream();
 	int start(const char *serviceref, int fd);
+		/* record once for all clients attached to the fan-out */
+	int start(const char *serviceref, eStreamFanout *fanout);
 	int stop();
 
 private:
@@ -33,6 +36,7 @@ private:
 	std::set<int> m_pids_active;
 
 	int m_target_fd;
+	ePtr<eStreamFanout> m_target_fanout;
 
 	int doPrepare();
 	int doRecord();
@@ -93,6 +93,7 @@ void keyEvent(const eRCKey &key)
 #include <lib/dvb/db.h>
 #include <lib/dvb/dvbtime.h>
 #include <lib/dvb/epgcache.h>
+#include <lib/dvb/epgharvester.h>
 
 class eMain: public eApplication, public Object
 {
@@ -103,6 +104,7 @@ class eMain: public eApplication, public Object
 	ePtr<eDVBResourceManager> m_mgr;
 	ePtr<eDVBLocalTimeHandler> m_locale_time_handler;
 	ePtr<eEPGCache> m_epgcache;
+	ePtr<eEPGHarvester> m_epgharvester;
 
 public:
 	eMain()
@@ -114,6 +116,7 @@ public:
 		m_locale_time_handler = new eDVBLocalTimeHandler();
 		m_epgcache = new eEPGCache();
 		m_mgr->setChannelList(m_dvbdb);
+		m_epgharvester = new eEPGHarvester();
 	}
 	
 	~eMain()
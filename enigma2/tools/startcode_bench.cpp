@@ -0,0 +1,103 @@
+/*
+ * Measures the start code scan of the recording indexer over a captured
+ * transport stream:
+ *
+ *   startcode_bench file.ts [pid [rounds]]
+ *
+ * Scans the payload of every packet of pid (all pids without one) the way
+ * eMPEGStreamParserTS does, once with the byte by byte loop the parser used
+ * before, then with findStartCodeScalar and findStartCode, and checks that
+ * all three find the same start codes. Build with "make -C tools startcode_bench",
+ * add -msse2 or -mavx2 to CXXFLAGS to compare the vector versions.
+ */
+
+#include <lib/dvb/startcode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+typedef const unsigned char *(*scanner)(const unsigned char *data, const unsigned char *end);
+
+static const unsigned char *findStartCodeBytewise(const unsigned char *data, const unsigned char *end)
+{
+	for (; end - data >= 3; ++data)
+		if (!(data[0] || data[1] || (data[2] != 1)))
+			return data;
+	return NULL;
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long run(const char *name, scanner scan, const std::vector<unsigned char> &ts, const std::vector<int> &payloads, int rounds)
+{
+	unsigned long found = 0;
+	double start = now();
+	for (int round = 0; round < rounds; ++round)
+	{
+		found = 0;
+		for (unsigned int i = 0; i < payloads.size(); ++i)
+		{
+			const unsigned char *pkt = &ts[(size_t)i * 188];
+			const unsigned char *end = pkt + 188;
+				/* like processPacket: codes up to the last 5 bytes */
+			for (const unsigned char *p = pkt + payloads[i]; (p = scan(p, end - 2)) != NULL; ++p)
+				++found;
+		}
+	}
+	double seconds = now() - start;
+	double bytes = (double)payloads.size() * 188 * rounds;
+	printf("%-10s %8lu start codes, %8.1f MB/s\n", name, found, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file.ts [pid [rounds]]\n", argv[0]);
+		return 1;
+	}
+	int pid = argc > 2 ? strtol(argv[2], NULL, 0) : -1;
+	int rounds = argc > 3 ? atoi(argv[3]) : 10;
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+		/* keep the packets of pid, with the offset of their payload */
+	std::vector<unsigned char> ts;
+	std::vector<int> payloads;
+	unsigned char pkt[188];
+	while (fread(pkt, sizeof(pkt), 1, f) == 1)
+	{
+		if (pkt[0] != 0x47 || !(pkt[3] & 0x10) || (pkt[3] & 0xc0))
+			continue;
+		if (pid >= 0 && (((pkt[1] & 0x1f) << 8) | pkt[2]) != pid)
+			continue;
+		int offset = (pkt[3] & 0x20) ? 5 + pkt[4] : 4;
+		if (offset >= 188)
+			continue;
+		ts.insert(ts.end(), pkt, pkt + sizeof(pkt));
+		payloads.push_back(offset);
+	}
+	fclose(f);
+	printf("%zu packets, %d rounds\n", payloads.size(), rounds);
+
+	unsigned long bytewise = run("bytewise", findStartCodeBytewise, ts, payloads, rounds);
+	unsigned long scalar = run("scalar", findStartCodeScalar, ts, payloads, rounds);
+	unsigned long vector = run("vector", findStartCode, ts, payloads, rounds);
+	if (bytewise != scalar || bytewise != vector)
+	{
+		printf("MISMATCH\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2000-2003 the xine project
+ *
+ * This file is part of xine, a free video player.
+ *
+ * xine is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * xine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ */
+
+/*
+ * Shared memory TS ring written by enigma2 (lib/base/tsshmring.h).
+ * The layout must match the enigma2 side exactly, it is checked
+ * through the magic and version fields on attach.
+ */
+
+#ifndef HAVE_ENIGMA_RING_H
+#define HAVE_ENIGMA_RING_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define ENIGMA_RING_NAME     "/ENIGMA_TS_RING"
+#define ENIGMA_RING_MAGIC    0x45545352 /* "ETSR" */
+#define ENIGMA_RING_VERSION  1
+
+typedef struct enigma_ring_s
+{
+  uint32_t        magic;
+  uint32_t        version;
+  uint32_t        size;        /* bytes in the data area */
+  uint32_t        data_offset; /* start of the data area within the shm object */
+  pthread_mutex_t lock;        /* process shared, protects everything below */
+  pthread_cond_t  cond;        /* broadcast on every commit, consume and flush */
+  uint64_t        head;        /* total bytes committed by enigma2 */
+  uint64_t        tail;        /* total bytes consumed by us */
+  uint32_t        readers;
+  uint32_t        overruns;
+} enigma_ring_t;
+
+#endif
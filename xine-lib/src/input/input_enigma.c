@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 
 #define LOG_MODULE "input_enigma"
@@ -40,6 +41,7 @@
 #include <xine/input_plugin.h>
 //#include "net_buf_ctrl.h"
 #include "combined_enigma.h"
+#include "enigma_ring.h"
 
 // xvdr
 #include <sys/time.h>
@@ -100,6 +102,9 @@ struct enigma_input_plugin_s {
   input_plugin_t      input_plugin;
   xine_stream_t      *stream;
   int                 fh;
+  enigma_ring_t      *ring;        /* shared memory ring, preferred over fh */
+  uint8_t            *ring_data;
+  size_t              ring_map_size;
   char               *mrl;
   off_t               curpos;
   char                seek_buf[BUFSIZE];
@@ -501,6 +506,126 @@ static off_t enigma_read_abort(xine_stream_t *stream, int fd, char *buf, off_t t
   return ret;
 }
 
+static int enigma_ring_attach(enigma_input_plugin_t *this)
+{
+  enigma_ring_t ring;
+  void *map;
+  int fd = shm_open(ENIGMA_RING_NAME, O_RDWR, 0);
+
+  if (fd < 0)
+    return 0;
+
+  if (read(fd, &ring, sizeof(ring)) != sizeof(ring)
+    || ring.magic != ENIGMA_RING_MAGIC
+    || ring.version != ENIGMA_RING_VERSION)
+  {
+    printf("enigma_ring: %s has no usable ring, falling back to the FIFO\n", ENIGMA_RING_NAME);
+    close(fd);
+    return 0;
+  }
+
+  this->ring_map_size = ring.data_offset + ring.size;
+  map = mmap(NULL, this->ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    printf("enigma_ring: mmap failed: %s\n", strerror(errno));
+    return 0;
+  }
+
+  this->ring = (enigma_ring_t *)map;
+  this->ring_data = (uint8_t *)map + ring.data_offset;
+
+  pthread_mutex_lock(&this->ring->lock);
+  this->ring->readers++;
+  pthread_mutex_unlock(&this->ring->lock);
+
+  printf("enigma_ring: attached to %s (%u kB)\n", ENIGMA_RING_NAME, ring.size >> 10);
+  return 1;
+}
+
+static void enigma_ring_detach(enigma_input_plugin_t *this)
+{
+  pthread_mutex_lock(&this->ring->lock);
+  this->ring->readers--;
+  pthread_cond_broadcast(&this->ring->cond);
+  pthread_mutex_unlock(&this->ring->lock);
+
+  munmap(this->ring, this->ring_map_size);
+  this->ring = NULL;
+  this->ring_data = NULL;
+}
+
+static void enigma_ring_unlock(void *lock)
+{
+  pthread_mutex_unlock((pthread_mutex_t *)lock);
+}
+
+/*
+ * Same contract as _x_read_abort(): fill buf completely, but give up
+ * with a short read when an action is pending on the stream.
+ */
+static off_t enigma_ring_read(enigma_input_plugin_t *this, uint8_t *buf, off_t todo)
+{
+  enigma_ring_t *ring = this->ring;
+  off_t total = 0;
+
+  while (total < todo)
+  {
+    uint64_t tail, avail;
+    size_t n, pos, first;
+
+    pthread_testcancel();
+
+    pthread_mutex_lock(&ring->lock);
+    pthread_cleanup_push(enigma_ring_unlock, &ring->lock);
+    if (ring->head == ring->tail)
+    {
+      struct timeval now;
+      struct timespec abstime;
+      gettimeofday(&now, NULL);
+      abstime.tv_sec  = now.tv_sec;
+      abstime.tv_nsec = (now.tv_usec + 50000) * 1000;
+      if (abstime.tv_nsec >= 1000000000)
+      {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&ring->cond, &ring->lock, &abstime);
+    }
+    tail  = ring->tail;
+    avail = ring->head - tail;
+    pthread_cleanup_pop(1);
+
+    if (!avail)
+    {
+      if (_x_action_pending(this->stream))
+        break;
+      continue;
+    }
+
+    /* copy outside the lock, enigma2 never touches [tail, head) */
+    n = avail < (uint64_t)(todo - total) ? (size_t)avail : (size_t)(todo - total);
+    pos = tail % ring->size;
+    first = n < ring->size - pos ? n : ring->size - pos;
+    memcpy(&buf[total], this->ring_data + pos, first);
+    if (n > first)
+      memcpy(&buf[total + first], this->ring_data, n - first);
+
+    pthread_mutex_lock(&ring->lock);
+    /* a flush (seek) while copying makes this data stale, drop it */
+    if (ring->tail == tail)
+    {
+      ring->tail += n;
+      total += n;
+    }
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+  }
+
+  return total;
+}
+
 static off_t enigma_plugin_read (input_plugin_t *this_gen,
 				void *buf_gen, off_t len) {
 
@@ -514,6 +639,9 @@ static off_t enigma_plugin_read (input_plugin_t *this_gen,
   if( len > 0 )
   {
     int retries = 0;
+    if (this->ring)
+      n = enigma_ring_read (this, &buf[total], len-total);
+    else
     do
     {
       n = enigma_read_abort (this->stream, this->fh, (char *)&buf[total], len-total);
@@ -697,6 +825,9 @@ static void enigma_plugin_dispose (input_plugin_t *this_gen ) {
   pthread_mutex_destroy(&this->find_sync_point_lock); // need
 
 
+  if (this->ring)
+    enigma_ring_detach(this);
+
   if (this->fh != -1)
     close(this->fh);
 
@@ -734,7 +865,10 @@ static int enigma_plugin_open (input_plugin_t *this_gen ) {
 
   printf ("trying to open '%s'...\n", this->mrl);
 
-  if (this->fh == -1) {
+  if (!this->ring && this->fh == -1 && enigma_ring_attach(this))
+    printf("using shared memory ring instead of the FIFO\n");
+
+  if (!this->ring && this->fh == -1) {
 //    int err = 0;
     char *filename = (char *)ENIGMA_ABS_FIFO_DIR "/ENIGMA_FIFO";
     this->fh = open (filename, FILE_FLAGS);